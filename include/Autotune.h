@@ -0,0 +1,64 @@
+// Autotune.h
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+#include "LoopNest.h"
+#include "Target.h"
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace Autotune {
+    // One matrix operation as the tuner sees it: its shape, operand walk
+    // strides under the chosen layouts, and which operands are streamed
+    struct Problem {
+        LoopNest::MatMulNest nest;
+        LoopNest::WalkStrides strides;
+        bool streamA = false;
+        bool streamC = false;
+        int defaultTileRows = 1; // tile height used without tuning
+    };
+    
+    // A point in the search space and its cost
+    struct Config {
+        LoopNest::Dataflow dataflow = LoopNest::OUTPUT_STATIONARY;
+        int tileRows = 0;   // rows of A and C per streamed tile
+        double cost = 0;    // measured cycles of the operation's code
+        double movement = 0; // element accesses of the dataflow, breaking ties in cost
+    };
+    
+    // Cycles of the code generated for a problem under a configuration
+    using Measure = std::function<double(const Problem&, const Config&)>;
+    
+    // Candidate configurations: both dataflows, and for streamed operations
+    // every power-of-two tile height up to M whose pair of ping-pong tiles
+    // fits one subarray, plus the default height
+    std::vector<Config> candidates(const Problem& problem, const Target::Description& target);
+    
+    // Best configuration of every problem, measuring all candidates on a pool
+    // of threads; ties go to the earlier candidate, so the result is deterministic
+    std::vector<Config> search(const std::vector<Problem>& problems, const Target::Description& target,
+                               const Measure& measure, int jobs, size_t* evaluated = nullptr);
+    
+    // Database key for a problem on a target
+    std::string key(const Problem& problem, const Target::Description& target);
+    
+    // Persistent tuning results keyed by shape and target, so later compiles
+    // look configurations up instead of searching again
+    class Database {
+    public:
+        bool load(const std::string& path);
+        void save(const std::string& path) const;
+        
+        bool lookup(const std::string& key, Config& config) const;
+        void store(const std::string& key, const Config& config);
+        
+        size_t size() const { return entries.size(); }
+    
+    private:
+        std::map<std::string, Config> entries;
+    };
+}
+
+#endif // AUTOTUNE_H
@@ -2,34 +2,110 @@
 #define CODEGEN_H
 
 #include "Parser.h"
+#include "LoopNest.h"
+#include "Layout.h"
+#include "Schedule.h"
+#include "FragmentCache.h"
+#include "Target.h"
+#include "Autotune.h"
+#include "Partition.h"
 #include <vector>
 #include <string>
 #include <unordered_map>
+#include <map>
 #include <set>
 #include <memory>
 
+// How a single MATRIX_OP_NODE is lowered
+struct OpPlan {
+    LoopNest::MatMulNest nest;
+    LoopNest::Dataflow dataflow = LoopNest::OUTPUT_STATIONARY;
+    int tile_rows = 0; // streamed tile height chosen by the autotuner, 0 for the default
+    int split = 1;     // K partitions computed on separate cores and merged by matrix_add
+};
+
+// Code generation modes selected on the command line
+struct CodeGenOptions {
+    bool double_buffer = false; // stream A and C tiles through ping-pong buffers
+    int jobs = 1;               // threads planning functions and generating their fragments
+    bool autotune = false;      // search tile heights and dataflows per operation
+    bool weight_resident = false; // load operands constant across calls once, then run each call
+    Partition::Slice slice;       // the device's share of every product when partitioned across devices
+};
+
 class CodeGen {
 public:
-    CodeGen(std::unique_ptr<ASTNode> ast, int size);
+    CodeGen(std::unique_ptr<ASTNode> ast, int size,
+            std::unordered_map<std::string, int> defines = {});
     std::vector<std::string> generatePIM_ISA();
+    void setOptions(const CodeGenOptions& opts) { options = opts; }
+    void setFragmentCache(FragmentCache* cache) { fragment_cache = cache; }
+    void setTarget(const Target::Description& description);
+    void setTuningDatabase(Autotune::Database* database) { tuning_db = database; }
     
 private:
     void identifyMatrices();
-    void processFunctionNode(const ASTNode* funcNode, std::vector<std::string>& isa);
-    void generateMatrixMultiplyExecution(const std::string& matA, const std::string& matB,
-                                        const std::string& matC, std::vector<std::string>& isa);
+    void planOperations();
+    FunctionPlan planFunction(const ASTNode* funcNode) const;
+    uint64_t planFingerprint(const ASTNode* funcNode) const;
+    void tuneOperations(const std::vector<const ASTNode*>& order);
+    void planSplitK(const std::vector<const ASTNode*>& order);
+    void planBankConflicts(const std::vector<Fragment>& fragments);
+    void collectOperations(const ASTNode* funcNode, std::vector<const ASTNode*>& ops,
+                           std::vector<Schedule::OpAccess>& access,
+                           std::vector<std::string>* log) const;
+    int memoryCapacity() const; // bytes the allocator may place regions in
+    std::vector<Fragment> generateFragments(const std::vector<const ASTNode*>& functions) const;
+    Fragment generateFunctionFragment(const ASTNode* funcNode) const;
+    uint64_t fragmentFingerprint(const ASTNode* funcNode) const;
+    void linkFragment(const Fragment& fragment, std::vector<std::string>& isa) const;
+    void generateMatrixMultiplyExecution(const OpPlan& plan, std::vector<std::string>& isa,
+                                        int core = -1) const;
+    void generateDoubleBufferedExecution(const OpPlan& plan, const std::string& reg,
+                                         std::vector<std::string>& isa) const;
+    void generateSplitKExecution(const OpPlan& plan, const std::string& reg,
+                                 std::vector<std::string>& isa, int core) const;
+    void generateLayoutTransforms(bool toDevice, std::vector<std::string>& isa);
+    void generateResidentTransfers(bool toDevice, std::vector<std::string>& isa);
+    std::string wholeTransfer(bool toDevice, const std::string& name, const std::string& host) const;
+    void planResidency();
+    void generateCallPhases(const std::vector<const ASTNode*>& functions,
+                            const std::vector<Fragment>& fragments, std::vector<std::string>& isa);
+    void allocateTransferBuffers(std::vector<std::string>& isa);
+    int tileRows(const OpPlan& plan) const;
     std::string allocateMatrix(const std::string& name);
+    int placeRegion(const std::string& name, int bytes);
     void validateMatrix(const std::string& name);
     
     // Changed function names to better reflect their purpose
     void generateMacOperation(std::vector<std::string>& isa);
     void generateMatrixMultiplyOperation(std::vector<std::string>& isa);
+    void generateWeightStationaryOperation(std::vector<std::string>& isa);
+    void generateGemvOperation(std::vector<std::string>& isa);
+    void generateBatchedOperation(std::vector<std::string>& isa);
+    void generateMatrixAddOperation(std::vector<std::string>& isa);
     
     std::unique_ptr<ASTNode> root;
     int matrix_size;
     std::unordered_map<std::string, std::string> matrix_map;
+    std::vector<std::string> allocation_order;
     std::set<std::string> matrices_to_allocate;
-    int current_address = 0x1000; // Start allocating at 0x1000
+    std::vector<int> bank_next; // next free address in each bank
+    std::unordered_map<std::string, int> matrix_bank;
+    std::unordered_map<std::string, std::unordered_map<std::string, int>> operand_conflicts; // within one operation
+    std::unordered_map<std::string, std::unordered_map<std::string, int>> bank_conflicts; // by concurrent use
+    std::unordered_map<std::string, int> size_defines;
+    std::unordered_map<const ASTNode*, OpPlan> op_plans;
+    std::unordered_map<std::string, Layout::MatrixLayout> layouts;
+    Target::Description target;
+    int row_bytes = 1024; // DRAM row buffer size used by the dataflow cost model
+    int tile_bytes = 4096; // target size of one streamed tile in double-buffered mode
+    int num_cores = 4; // pPIM cores available to concurrent operations
+    CodeGenOptions options;
+    FragmentCache* fragment_cache = nullptr; // reuse unchanged functions when set
+    Autotune::Database* tuning_db = nullptr; // earlier tuning results, extended by new searches
+    std::set<std::string> streamed; // operands moved tile by tile instead of kept resident
+    std::map<std::string, std::string> pinned; // operand -> host matrix, loaded once for every call
 };
 
 #endif // CODEGEN_H
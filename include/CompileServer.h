@@ -0,0 +1,15 @@
+// CompileServer.h
+#ifndef COMPILE_SERVER_H
+#define COMPILE_SERVER_H
+
+#include <string>
+
+namespace CompileServer {
+    // Serve compile requests on a Unix domain socket, one at a time, until
+    // SIGINT or SIGTERM. Fragment caches, tuning databases and the responses
+    // to recent requests stay warm between requests. A client that stalls for
+    // longer than a few seconds is dropped. Returns the exit status.
+    int serve(const std::string& socketPath);
+}
+
+#endif // COMPILE_SERVER_H
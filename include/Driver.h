@@ -0,0 +1,59 @@
+// Driver.h
+#ifndef DRIVER_H
+#define DRIVER_H
+
+#include "CodeGen.h"
+#include "FragmentCache.h"
+#include "Autotune.h"
+#include "Partition.h"
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Driver {
+    // Everything a compile request selects on the command line
+    struct Options {
+        std::string input;
+        std::string output;
+        CodeGenOptions codegen;
+        bool incremental = false;
+        std::string targetFile;
+        std::string tuningFile = "pim_tuning.db";
+        bool writeTemplate = false;
+        int devices = 1; // PIM devices sharing every product
+        Partition::Axis partition = Partition::AUTO; // how products are divided between them
+        std::unordered_map<std::string, int> overrides; // -D NAME=value
+        bool verbose = true; // stage banners and the AST dump
+    };
+    
+    // Parse "<input> -o <output> [options]"; on failure returns false with a message
+    bool parseArguments(const std::vector<std::string>& args, Options& options, std::string& error);
+    
+    // State that outlives a single compile. A one-shot compile reads caches from
+    // disk and writes them back; a server keeps them warm in memory between requests.
+    struct Session {
+        bool persistent = true;
+        std::unordered_map<std::string, FragmentCache> fragments;   // by output path
+        std::unordered_map<std::string, Autotune::Database> tuning; // by database path
+    };
+    
+    // Compile source text, or instantiate a program template, and return the
+    // formatted ISA (or the template when requested). Throws on failure,
+    // including when the generated ISA does not verify.
+    std::string compile(const std::string& source, const Options& options, Session& session);
+    
+    // A file written by a compile
+    struct Output {
+        std::string path;
+        std::string text;
+    };
+    
+    // Compile for options.devices devices: one ISA program per device, named
+    // <output>.dev<d>.isa after "-o <output>.isa", and the host communication
+    // plan in <output>.plan, returned first. Throws like compile, and when the
+    // products cannot be divided. The chosen plan is also stored when asked for.
+    std::vector<Output> compileDevices(const std::string& source, const Options& options, Session& session,
+                                       Partition::Plan* chosen = nullptr);
+}
+
+#endif // DRIVER_H
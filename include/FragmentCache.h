@@ -0,0 +1,63 @@
+// FragmentCache.h
+#ifndef FRAGMENT_CACHE_H
+#define FRAGMENT_CACHE_H
+
+#include "LoopNest.h"
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Instructions for one function with operands referenced as @name; the link
+// step substitutes addresses, so fragments can be generated in any order
+struct Fragment {
+    std::string function;
+    std::vector<std::string> matrices; // allocation summary: operands the fragment references
+    std::vector<std::string> lines;
+    std::vector<std::string> log;
+    std::vector<std::string> conflicts; // "p q": operands of one wave, accessed at the same time
+};
+
+// Loop nests extracted from one function's products, in source order, with the
+// messages extraction logged; reused while the function's tokens are unchanged
+struct FunctionPlan {
+    std::string function;
+    std::vector<LoopNest::MatMulNest> nests;
+    std::vector<std::string> log;
+};
+
+// Persistent store of generated function fragments, keyed by function name and
+// fingerprint, so an incremental compile only regenerates functions that changed
+class FragmentCache {
+public:
+    // 64-bit FNV-1a, stable across runs and platforms
+    static uint64_t hash(const std::string& text, uint64_t seed = 14695981039346656037ULL);
+    
+    bool load(const std::string& path);
+    void save(const std::string& path) const;
+    
+    const Fragment* lookup(const std::string& function, uint64_t fingerprint) const;
+    void store(const Fragment& fragment, uint64_t fingerprint);
+    
+    const FunctionPlan* lookupPlan(const std::string& function, uint64_t fingerprint) const;
+    void storePlan(const FunctionPlan& plan, uint64_t fingerprint);
+    
+    // Drop entries for functions that no longer exist
+    void retain(const std::vector<std::string>& functions);
+    
+    size_t size() const { return entries.size(); }
+
+private:
+    struct Entry {
+        uint64_t fingerprint = 0;
+        Fragment fragment;
+    };
+    struct PlanEntry {
+        uint64_t fingerprint = 0;
+        FunctionPlan plan;
+    };
+    std::unordered_map<std::string, Entry> entries;
+    std::unordered_map<std::string, PlanEntry> plans;
+};
+
+#endif // FRAGMENT_CACHE_H
@@ -0,0 +1,45 @@
+// Layout.h
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include "LoopNest.h"
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Layout {
+    // How a matrix is stored in PIM memory
+    enum Kind {
+        ROW_MAJOR,   // host order
+        TRANSPOSED,  // stored column by column, so column walks are contiguous
+        BLOCKED      // square tiles of one device row each, so both walks stay local
+    };
+
+    struct MatrixLayout {
+        Kind kind = ROW_MAJOR;
+        int rows = 0, cols = 0;  // logical shape
+        int pitch = 0;           // bytes between stored rows (tile rows when blocked)
+        int tile = 0;            // tile edge when blocked
+        int bytes = 0;           // padded size, whole device rows unless smaller than one
+    };
+
+    // Lay out a rows x cols matrix, padding its pitch so no stored row straddles
+    // a device row and rounding an allocation of a row or more up to whole rows
+    MatrixLayout make(Kind kind, int rows, int cols, int rowBytes);
+
+    // Stride of walking the matrix along a row or down a column
+    double walkStride(const MatrixLayout& layout, bool alongRow, int rowBytes);
+
+    // Walk strides of an operation's operands under the given layouts
+    LoopNest::WalkStrides strides(const LoopNest::MatMulNest& nest,
+                                  const std::unordered_map<std::string, MatrixLayout>& layouts,
+                                  int rowBytes);
+
+    // Pick a layout for every operand from how it is accessed across all operations
+    std::unordered_map<std::string, MatrixLayout> select(const std::vector<LoopNest::MatMulNest>& nests,
+                                                         int rowBytes);
+
+    const char* kindName(Kind kind);
+}
+
+#endif // LAYOUT_H
@@ -5,6 +5,7 @@
 #include <vector>
 #include <string>
 #include <unordered_set>
+#include <unordered_map>
 
 enum TokenType {
     KEYWORD, IDENTIFIER, OPERATOR, NUMBER,
@@ -23,12 +24,18 @@ public:
     Lexer(const std::string& src);
     std::vector<Token> tokenize();
     int getMatrixSize() const { return matrix_size; }
+    const std::unordered_map<std::string, int>& getDefines() const { return defines; }
     
+    // Names whose #define sets the matrix size, and the size a set of defines implies
+    static bool isSizeDefine(const std::string& name);
+    static int matrixSize(const std::unordered_map<std::string, int>& defines);
+
 private:
     std::string source;
     size_t index = 0;
     int current_line = 1;
     int matrix_size = 0;
+    std::unordered_map<std::string, int> defines;
     
     void handlePreprocessor();
     void parseMatrixSize();
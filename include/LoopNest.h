@@ -0,0 +1,77 @@
+// LoopNest.h
+#ifndef LOOP_NEST_H
+#define LOOP_NEST_H
+
+#include "Parser.h"
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+namespace LoopNest {
+    // How the multiply is scheduled on the PIM core
+    enum Dataflow {
+        OUTPUT_STATIONARY,  // C[i][j] held in the accumulator, loop order i-j-k
+        WEIGHT_STATIONARY   // B row k held in the row buffer, loop order k-i-j
+    };
+
+    // Shape of the product, each lowered by its own routine
+    enum Kind {
+        MATMUL,   // C[i][j] += A[i][k] * B[k][j]
+        GEMV,     // y[i] += A[i][k] * x[k] (N = 1) or y[j] += x[k] * W[k][j] (M = 1)
+        BATCHED,  // C[b][i][j] += A[b][i][k] * B[b][k][j], independent small products
+        SCALAR    // C[r][c] = A[r][d] * B[d][c] at constant subscripts, or a 1x1x1 nest
+    };
+    
+    // C[i][j] += A[i][k] * B[k][j] with C of M x N and reduction depth K
+    struct MatMulNest {
+        std::string A, B, C;
+        std::string i, j, k;      // row, column and reduction index variables
+        std::string sourceOrder;  // loop order as written, e.g. "ikj"
+        int M = 0, N = 0, K = 0;  // operand extents when SCALAR
+        Kind kind = MATMUL;
+        std::string b;            // batch index variable
+        int batch = 1;            // products in a batch
+        int row = 0, col = 0, depth = 0; // SCALAR: the element of C and the reduction index
+    };
+
+    // Effective byte stride of each operand walk; a stride of a full device row
+    // or more opens a new DRAM row on every access
+    struct WalkStrides {
+        double aRow = 0, aColumn = 0;
+        double bRow = 0, bColumn = 0;
+        double cRow = 0;
+    };
+
+    // Evaluate a bound expression ("N", "ROWS", "N-1+1") against the #defines
+    bool evaluateBound(const std::string& expr, const std::unordered_map<std::string, int>& defines,
+                       int& value);
+
+    // Extract the nest from a MATRIX_OP_NODE built by the parser, telling the
+    // forms apart by operand rank; returns false for operations without loop
+    // information. Throws when a loop bound does not evaluate to a positive size.
+    bool extract(const ASTNode* op, const std::unordered_map<std::string, int>& defines,
+                 int fallbackSize, MatMulNest& nest);
+
+    // Stored rows and columns of operand 0 (A), 1 (B) or 2 (C); vectors are one
+    // row and the products of a batch are stacked one below the other
+    std::pair<int, int> operandShape(const MatMulNest& nest, int operand);
+    
+    // Strides of dense row-major operands
+    WalkStrides rowMajorStrides(const MatMulNest& nest);
+
+    // Accesses walking memory with the given stride, weighted by row activations
+    double streamCost(double accesses, double strideBytes, int rowBytes);
+
+    // Estimated data movement, in element accesses weighted by DRAM row activations
+    double movementCost(const MatMulNest& nest, Dataflow dataflow, int rowBytes,
+                        const WalkStrides& strides);
+
+    // Pick the dataflow with the least data movement
+    Dataflow chooseDataflow(const MatMulNest& nest, int rowBytes, const WalkStrides& strides);
+
+    const char* dataflowName(Dataflow dataflow);
+    const char* kindName(Kind kind);
+    const char* loopOrder(Dataflow dataflow);
+}
+
+#endif // LOOP_NEST_H
@@ -2,9 +2,11 @@
 #ifndef PARSER_H
 #define PARSER_H
 
+#include <cstdint>
 #include <vector>
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <unordered_set>
 #include "Lexer.h"
 
@@ -13,7 +15,11 @@ enum ASTNodeType {
     FUNCTION_NODE,
     MEMORY_OP_NODE,
     MATRIX_DECL_NODE,
-    MATRIX_OP_NODE
+    MATRIX_OP_NODE,
+    LOOP_NODE,      // value: index variable, child: BOUND_NODE with the trip count
+    BOUND_NODE,     // value: loop trip count expression ("N", "ROWS", "4", "N-1+1")
+    INDEX_NODE,     // value: subscript expression of a matrix reference ("i", "0")
+    CALL_NODE       // value: called kernel, children: MATRIX_DECL_NODE argument per matrix parameter
 };
 
 struct ASTNode {
@@ -21,6 +27,29 @@ struct ASTNode {
     std::string value;
     std::vector<std::unique_ptr<ASTNode>> children;
     int line = 0;
+    uint64_t fingerprint = 0; // FUNCTION_NODE: hash of the function's tokens
+};
+
+// A matrix reference such as C[i][j] seen inside a function body
+struct ArrayRef {
+    std::string name;
+    std::vector<std::string> subscripts;
+    int line = 0;
+};
+
+// An enclosing for-loop: index variable and trip count expression
+struct LoopHeader {
+    std::string var;
+    std::string bound;
+    int line = 0;
+};
+
+// A product accumulated into a scalar, e.g. sum += A[i][k] * B[k][j]
+struct PendingProduct {
+    std::string accumulator;
+    ArrayRef lhs;
+    ArrayRef rhs;
+    std::vector<LoopHeader> loops;
 };
 
 class Parser {
@@ -32,6 +61,15 @@ private:
     std::vector<Token> tokens;
     size_t index = 0;
     std::unordered_set<std::string> declared_matrices;
+    // Scalar accumulators (sum += A[i][k] * B[k][j]) awaiting their store to a matrix
+    std::vector<PendingProduct> pending_products;
+    // Scalars last assigned 0, the only accumulators a product may start from
+    std::unordered_set<std::string> zeroed_accumulators;
+    // Matrices last stored 0 through loop indices, the only results a product may accumulate into
+    std::unordered_set<std::string> zeroed_matrices;
+    // Positions of the matrix parameters of every kernel, to bind call arguments
+    std::unordered_map<std::string, std::vector<int>> kernel_params;
+    std::vector<int> param_positions; // of the function being parsed
 
     const Token& current() const;
     void advance();
@@ -42,8 +80,16 @@ private:
     std::unique_ptr<ASTNode> parseMatrixDeclaration();
     std::unique_ptr<ASTNode> parseMatrixOperation();
     std::unique_ptr<ASTNode> parseFunction();
+    std::unique_ptr<ASTNode> parseCall();
     void parseFunctionBody(ASTNode* funcNode);
-    void skipToNextFunction();
+    void parseBodyStatement(ASTNode* funcNode, std::vector<LoopHeader>& loops);
+    bool parseLoopHeader(LoopHeader& header);
+    void parseAssignment(ASTNode* funcNode, const std::vector<LoopHeader>& loops);
+    bool parseArrayRef(size_t& pos, size_t end, ArrayRef& ref) const;
+    std::unique_ptr<ASTNode> buildMatMulNode(const ArrayRef& result, const ArrayRef& lhs,
+                                             const ArrayRef& rhs,
+                                             const std::vector<LoopHeader>& loops) const;
+    uint64_t fingerprintTokens(size_t begin, size_t end) const;
 };
 
 #endif
@@ -0,0 +1,92 @@
+// Partition.h
+#ifndef PARTITION_H
+#define PARTITION_H
+
+#include "LoopNest.h"
+#include "Parser.h"
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Splitting a program's matrix multiplies across several PIM devices, each
+// running its own program on a slice of the operands, and the host-side
+// communication that feeds them and collects their results
+namespace Partition {
+    // Dimension of C[M][N] += A[M][K] * B[K][N] divided between the devices
+    enum Axis {
+        AUTO,     // the feasible axis with the least host communication
+        ROWS,     // M: slices of A and C by rows, B on every device
+        COLUMNS,  // N: slices of B and C by columns, A on every device
+        DEPTH     // K: slices of A by columns and B by rows, partial sums of C reduced on the host
+    };
+    
+    // The part of the program one device computes
+    struct Slice {
+        Axis axis = AUTO;
+        int device = 0;
+        int devices = 1; // 1 compiles the whole program
+    };
+    
+    // A block of a host matrix moved between the host and devices; rows and
+    // columns are half-open ranges of the logical matrix
+    struct Transfer {
+        enum Kind {
+            SCATTER,    // a different block to each device
+            BROADCAST,  // the same whole matrix to every device
+            GATHER,     // each device's block back into the host matrix
+            REDUCE      // every device's partial sum, added up on the host
+        };
+        Kind kind = SCATTER;
+        std::string matrix;
+        int rowBegin = 0, rowEnd = 0;
+        int colBegin = 0, colEnd = 0;
+        std::vector<int> devices;
+    };
+    
+    // Host communication plan of a partitioned program and its estimated cost
+    struct Plan {
+        Axis axis = ROWS;
+        int devices = 1;
+        std::vector<Transfer> scatter;       // host to devices, before the run
+        std::vector<Transfer> gather;        // devices to host, after it
+        std::vector<std::string> programs;   // ISA file of each device
+        std::vector<uint64_t> deviceCycles;  // estimated run time of each device program
+        uint64_t singleCycles = 0;           // whole program on one device with its transfers, 0 if it does not fit
+    };
+    
+    // [begin, end) of the device's share of an extent, split as evenly as possible
+    std::pair<int, int> range(int extent, int device, int devices);
+    
+    // Restrict an operation to the device's share of the slice axis
+    void apply(const Slice& slice, LoopNest::MatMulNest& nest);
+    
+    // Every matrix operation of the program, shaped as code generation plans them
+    std::vector<LoopNest::MatMulNest> operations(const ASTNode* root,
+                                                 const std::unordered_map<std::string, int>& defines,
+                                                 int fallbackSize);
+    
+    // Host communication of partitioning along the axis; returns false with the
+    // reason when the operations cannot be divided that way
+    bool plan(const std::vector<LoopNest::MatMulNest>& ops, Axis axis, int devices, Plan& result,
+              std::string& reason);
+    
+    // Plans along the requested axis, or for AUTO along every feasible axis
+    // with the least host communication first; throws when none is feasible
+    std::vector<Plan> candidates(const std::vector<LoopNest::MatMulNest>& ops, Axis requested, int devices);
+    
+    // Estimated cycles of a phase of host transfers, which share the host's link
+    uint64_t hostCycles(const std::vector<Transfer>& transfers);
+    
+    // Scatter, the slowest device and gather, run one after the other
+    uint64_t totalCycles(const Plan& plan);
+    
+    // Text of the plan, with the cost estimate as comments
+    std::string format(const Plan& plan);
+    
+    bool parseAxis(const std::string& name, Axis& axis);
+    const char* axisName(Axis axis);
+}
+
+#endif // PARTITION_H
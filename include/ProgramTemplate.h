@@ -0,0 +1,28 @@
+// ProgramTemplate.h
+#ifndef PROGRAM_TEMPLATE_H
+#define PROGRAM_TEMPLATE_H
+
+#include "Parser.h"
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+namespace ProgramTemplate {
+    // A parsed program with its sizes left symbolic: loop bounds stay
+    // expressions over #define names and are only resolved by code generation,
+    // so one template instantiates for any size without lexing or parsing
+    struct Template {
+        std::unique_ptr<ASTNode> ast;
+        std::unordered_map<std::string, int> defines; // values compiled with, overridable
+    };
+    
+    // Whether file contents hold a template rather than source code
+    bool isTemplate(const std::string& text);
+    
+    std::string serialize(const ASTNode* ast, const std::unordered_map<std::string, int>& defines);
+    
+    // Rebuild a template; malformed input throws
+    Template deserialize(const std::string& text);
+}
+
+#endif // PROGRAM_TEMPLATE_H
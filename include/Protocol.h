@@ -0,0 +1,35 @@
+// Protocol.h
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <string>
+#include <vector>
+
+// Wire format between the compile server and its clients over a Unix domain
+// socket, one request and one response per connection
+namespace Protocol {
+    // Command line as for a one-shot compile ("<input> -o <output> [options]")
+    // and the source text, so the server never reads the client's files
+    struct Request {
+        std::vector<std::string> args;
+        std::string source;
+    };
+    
+    // ISA (or template) text on success, the error message otherwise
+    struct Response {
+        bool ok = false;
+        std::string text;
+    };
+    
+    // Socket set-up; both throw on failure
+    int listen(const std::string& path);
+    int connect(const std::string& path);
+    
+    // Reads return false on a closed or malformed stream; writes throw
+    bool readRequest(int fd, Request& request);
+    void writeRequest(int fd, const Request& request);
+    bool readResponse(int fd, Response& response);
+    void writeResponse(int fd, const Response& response);
+}
+
+#endif // PROTOCOL_H
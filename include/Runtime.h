@@ -0,0 +1,184 @@
+// Runtime.h
+#ifndef RUNTIME_H
+#define RUNTIME_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Host runtime for compiled programs: a program is decoded once, every
+// invocation binds host buffers to the program's matrices by name, and a
+// queue runs invocations asynchronously on a pool of devices
+namespace Runtime {
+    // Address operand such as "0x8000+256" or "A+4096+t*8192": a host matrix
+    // (empty for PIM memory), a byte offset and bytes per iteration of
+    // enclosing loops, by nesting depth
+    struct Address {
+        std::string host;
+        int64_t offset = 0;
+        std::vector<std::pair<int, int64_t>> strides;
+    };
+    
+    // An instruction decoded at load time
+    struct Instruction {
+        enum Opcode { ALLOC, LAYOUT, FREE, EXE, LOAD, STORE, XFORM, SYNC, LOOP, ENDLOOP };
+        Opcode opcode = SYNC;
+        std::vector<Address> addresses; // EXE A, B, C; LOAD/STORE destination, source; the region otherwise
+        std::vector<int64_t> values;    // sizes, rows, bytes, pitch, loop count
+        std::string name;               // EXE: routine of the register; LAYOUT and XFORM: layout kind
+        int batch = 1;                  // EXE: products of a batched routine
+        size_t line = 0;                // in the program text
+        size_t partner = 0;             // LOOP: its ENDLOOP; ENDLOOP: its LOOP
+    };
+    
+    // A host matrix the program reads or writes, in 32-bit elements
+    struct Matrix {
+        std::string name;
+        size_t elements = 0;
+        bool input = false;    // read before the program writes it
+        bool output = false;   // written by the program
+        bool constant = false; // loaded once when a device loads the program
+    };
+    
+    // A compiled program. Allocations, routines and, for weight-resident
+    // programs, the one-time load phase form the setup a device runs once;
+    // every invocation runs the body; the teardown frees PIM memory.
+    class Program {
+    public:
+        static std::shared_ptr<const Program> load(const std::string& path);
+        static std::shared_ptr<const Program> parse(const std::string& text);
+        
+        const std::vector<Instruction>& instructions() const { return code; }
+        const std::vector<Matrix>& matrices() const { return host_matrices; }
+        const Matrix* matrix(const std::string& name) const;
+        size_t memoryBytes() const { return memory_bytes; }
+        size_t bodyBegin() const { return body_begin; }
+        size_t bodyEnd() const { return body_end; }
+        // Without LOAD and STORE the host moves operands: the runtime stages
+        // matrices into their allocations before the body and back after it
+        bool implicitTransfers() const { return implicit_transfers; }
+        // PIM address of each host matrix, from the program's BIND directives
+        const std::unordered_map<std::string, int64_t>& allocations() const { return allocated; }
+    
+    private:
+        std::vector<Instruction> code;
+        std::vector<Matrix> host_matrices;
+        std::unordered_map<std::string, int64_t> allocated;
+        size_t memory_bytes = 0;
+        size_t body_begin = 0;
+        size_t body_end = 0;
+        bool implicit_transfers = false;
+    };
+    
+    // Host buffers of one invocation, by matrix name. Buffers are borrowed,
+    // not copied, and must outlive the invocation; outputs may also be read.
+    class Bindings {
+    public:
+        struct Buffer {
+            const int32_t* data = nullptr;
+            int32_t* writable = nullptr; // null for inputs
+            size_t elements = 0;
+        };
+        
+        void input(const std::string& name, const int32_t* data, size_t elements);
+        void output(const std::string& name, int32_t* data, size_t elements);
+        const Buffer* find(const std::string& name) const;
+        
+        // Throw unless every input the program reads per invocation (or, for
+        // constants, at load) is bound, and every binding is large enough
+        void check(const Program& program, bool constants) const;
+    
+    private:
+        std::unordered_map<std::string, Buffer> buffers;
+    };
+    
+    // Something that runs programs
+    class Device {
+    public:
+        virtual ~Device() = default;
+        // Run the program's setup once, loading constants from their bindings
+        virtual void load(std::shared_ptr<const Program> program, const Bindings& constants) = 0;
+        // One invocation of the program's body
+        virtual void run(const Bindings& bindings) = 0;
+    };
+    
+    using DeviceFactory = std::function<std::unique_ptr<Device>()>;
+    
+    // Executes programs functionally in a private PIM memory image
+    std::unique_ptr<Device> makeSimulator();
+    
+    // Completes invocations without executing them, to measure the queue alone
+    std::unique_ptr<Device> makeStub();
+    
+    struct QueueOptions {
+        int workers = 0;        // devices running invocations side by side, 0 for one per hardware thread
+        size_t batch = 8;       // most invocations a worker takes from the queue at once
+        size_t capacity = 1024; // queued invocations before submit blocks
+        DeviceFactory device = makeSimulator;
+    };
+    
+    // Asynchronous submission queue. Every worker owns a device that loaded
+    // the program once; workers take batches of invocations so that queue
+    // traffic stays low under many concurrent submitters.
+    class Queue {
+    public:
+        struct Stats {
+            uint64_t submitted = 0;
+            uint64_t completed = 0;
+            uint64_t failed = 0;
+            uint64_t batches = 0;
+        };
+        
+        // Devices are created and load the program before the constructor
+        // returns, so a program or constant binding that cannot run throws here
+        Queue(std::shared_ptr<const Program> program, const Bindings& constants,
+              const QueueOptions& options = QueueOptions());
+        // Completes every submitted invocation, then stops the workers
+        ~Queue();
+        Queue(const Queue&) = delete;
+        Queue& operator=(const Queue&) = delete;
+        
+        // Queue an invocation; the future holds the device's exception if it
+        // fails. Bindings are checked before queueing, and a full queue blocks.
+        std::future<void> submit(Bindings bindings);
+        
+        // Until every invocation submitted so far has completed
+        void wait();
+        
+        Stats stats() const;
+        int workers() const { return static_cast<int>(threads.size()); }
+    
+    private:
+        struct Job {
+            Bindings bindings;
+            std::promise<void> done;
+        };
+        
+        void work(Device& device);
+        
+        std::shared_ptr<const Program> program;
+        QueueOptions options;
+        std::vector<std::unique_ptr<Device>> devices;
+        std::vector<std::thread> threads;
+        mutable std::mutex queue_mutex;
+        std::condition_variable ready;  // jobs queued or stopping
+        std::condition_variable space;  // room in the queue
+        std::condition_variable idle;   // nothing queued or running
+        std::deque<Job> pending;
+        size_t running = 0;
+        bool stopping = false;
+        std::atomic<uint64_t> submitted{0}, completed{0}, failed{0}, batches{0};
+    };
+}
+
+#endif // RUNTIME_H
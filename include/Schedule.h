@@ -0,0 +1,27 @@
+// Schedule.h
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+#include <string>
+#include <vector>
+
+namespace Schedule {
+    // Read and write sets of one matrix operation
+    struct OpAccess {
+        std::vector<std::string> reads;
+        std::vector<std::string> writes;
+        bool exclusive = false;  // must run alone (e.g. it owns the transfer buffers)
+        int cores = 1;           // cores the operation occupies, more when split along K
+    };
+
+    // Dependencies (read-after-write, write-after-read, write-after-write) of each
+    // operation on earlier ones, in program order
+    std::vector<std::vector<size_t>> buildDependencies(const std::vector<OpAccess>& ops);
+
+    // Group operations into topologically ordered waves of mutually independent
+    // operations, occupying at most maxWidth cores each. Every operand is
+    // allocated for the whole program, so memory never limits a wave.
+    std::vector<std::vector<size_t>> buildWaves(const std::vector<OpAccess>& ops, int maxWidth);
+}
+
+#endif // SCHEDULE_H
@@ -0,0 +1,40 @@
+// Target.h
+#ifndef TARGET_H
+#define TARGET_H
+
+#include <string>
+
+namespace Target {
+    // Memory geometry and compute resources of a PIM device. Device addresses
+    // run through one bank after another, channel by channel.
+    struct Description {
+        std::string name = "pPIM";
+        int channels = 1;
+        int banks = 4;             // per channel
+        int subarrays = 4;         // per bank
+        int row_bytes = 1024;      // DRAM row buffer
+        int bank_bytes = 16384;    // capacity of one bank
+        int cores = 4;             // pPIM cores available to concurrent operations
+        int reserved_bytes = 4096; // kept free at the bottom of bank 0
+    };
+    
+    // Read a target file of "key = value" lines; unknown keys and inconsistent
+    // geometry are errors
+    Description load(const std::string& path);
+    
+    // Throw if the geometry cannot be addressed as described
+    void validate(const Description& target);
+    
+    int totalBanks(const Description& target);
+    int subarrayBytes(const Description& target);
+    int totalBytes(const Description& target);
+    int bankOf(const Description& target, int address);
+    
+    // Compact identifier of the geometry, for keying tuning results
+    std::string key(const Description& target);
+    
+    // One-line description for the ISA header
+    std::string summary(const Description& target);
+}
+
+#endif // TARGET_H
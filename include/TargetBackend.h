@@ -2,17 +2,52 @@
 #ifndef TARGET_BACKEND_H
 #define TARGET_BACKEND_H
 
+#include <cstddef>
+#include <cstdint>
 #include <string>
 #include <vector>
 
 namespace TargetBackend {
+    // A problem found in a generated program
+    struct Diagnostic {
+        size_t line;          // 1-based line in the emitted program
+        std::string message;
+    };
+
+    // Program text with loop bodies indented, one instruction per line
+    std::string formatISA(const std::vector<std::string>& instructions);
+    
     // Emit ISA instructions to a file
     void emitISA(const std::vector<std::string>& instructions, const std::string& filename);
-    
-    // Validate ISA instruction correctness
+
+    // Check the whole program in a single pass: opcode and operand syntax,
+    // addresses inside the ALLOCATE window and inside a live region, EXE
+    // operands whose M, N, K (and batch) extents fit their region's layout,
+    // regions that do not overlap, no use after FREE and no EXE before its PROG.
+    // Stops after maxDiagnostics problems.
+    std::vector<Diagnostic> verifyISA(const std::vector<std::string>& instructions,
+                                      size_t maxDiagnostics = 20);
+
+    // Validate ISA instruction correctness, reporting problems on stderr
     bool validateISA(const std::vector<std::string>& instructions);
+    
+    // Static cost of a program, for comparing compiler versions
+    struct Stats {
+        size_t instructions = 0;    // non-comment lines, microcode included
+        uint64_t peakBytes = 0;     // most PIM memory allocated at once
+        size_t programs = 0;        // PROG blocks
+        uint64_t transferBytes = 0; // moved by LOAD and STORE, loops unrolled
+        uint64_t cycles = 0;        // estimated run time
+    };
+    
+    // Measure a verified program. Cycles count one multiply-accumulate per core
+    // per cycle; cores and DMA transfers overlap until each SYNC, and loop
+    // bodies count once per iteration.
+    Stats measureISA(const std::vector<std::string>& instructions);
+    
+    // Estimated cycles of one DMA transfer between host and PIM memory, as
+    // measureISA counts a LOAD or STORE
+    double transferCycles(double bytes);
 }
 
 #endif
-
-
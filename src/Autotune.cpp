@@ -0,0 +1,152 @@
+#include "Autotune.h"
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+using namespace std;
+
+namespace Autotune {
+
+static const char* DATABASE_HEADER = "PIMTUNE 2";
+static const int ELEMENT_BYTES = sizeof(int);
+
+vector<Config> candidates(const Problem& problem, const Target::Description& target) {
+    vector<int> heights;
+    if (problem.streamA || problem.streamC) {
+        int widest = max(problem.nest.K, problem.nest.N) * ELEMENT_BYTES;
+        // The tile being computed and the one in flight share the subarray
+        for (int rows = 1; rows < problem.nest.M && 2 * rows * widest <= Target::subarrayBytes(target); rows *= 2) {
+            heights.push_back(rows);
+        }
+        if (find(heights.begin(), heights.end(), problem.defaultTileRows) == heights.end()) {
+            heights.push_back(problem.defaultTileRows);
+        }
+    } else {
+        heights.push_back(problem.nest.M); // resident operations run as one tile
+    }
+    
+    vector<Config> configs;
+    for (LoopNest::Dataflow dataflow : {LoopNest::OUTPUT_STATIONARY, LoopNest::WEIGHT_STATIONARY}) {
+        for (int rows : heights) {
+            Config config;
+            config.dataflow = dataflow;
+            config.tileRows = rows;
+            configs.push_back(config);
+        }
+    }
+    return configs;
+}
+
+vector<Config> search(const vector<Problem>& problems, const Target::Description& target,
+                      const Measure& measure, int jobs, size_t* evaluated) {
+    // Flatten every (problem, candidate) pair so threads balance across problems
+    vector<vector<Config>> space;
+    vector<pair<size_t, size_t>> work;
+    for (size_t p = 0; p < problems.size(); p++) {
+        space.push_back(candidates(problems[p], target));
+        for (size_t c = 0; c < space.back().size(); c++) {
+            work.push_back({p, c});
+        }
+    }
+    
+    auto evaluate = [&](size_t i) {
+        const Problem& problem = problems[work[i].first];
+        Config& config = space[work[i].first][work[i].second];
+        config.cost = measure(problem, config);
+        config.movement = LoopNest::movementCost(problem.nest, config.dataflow, target.row_bytes, problem.strides);
+    };
+    int workers = min(jobs, static_cast<int>(work.size()));
+    if (workers <= 1) {
+        for (size_t i = 0; i < work.size(); i++) {
+            evaluate(i);
+        }
+    } else {
+        atomic<size_t> next{0};
+        vector<thread> pool;
+        for (int w = 0; w < workers; w++) {
+            pool.emplace_back([&]() {
+                for (size_t i = next++; i < work.size(); i = next++) {
+                    evaluate(i);
+                }
+            });
+        }
+        for (auto& worker : pool) {
+            worker.join();
+        }
+    }
+    if (evaluated) *evaluated = work.size();
+    
+    vector<Config> best;
+    for (const auto& configs : space) {
+        best.push_back(*min_element(configs.begin(), configs.end(),
+                                    [](const Config& a, const Config& b) {
+                                        return a.cost != b.cost ? a.cost < b.cost : a.movement < b.movement;
+                                    }));
+    }
+    return best;
+}
+
+string key(const Problem& problem, const Target::Description& target) {
+    const LoopNest::MatMulNest& nest = problem.nest;
+    const LoopNest::WalkStrides& s = problem.strides;
+    ostringstream out;
+    out << nest.M << "x" << nest.N << "x" << nest.K << "|" << s.aRow << "," << s.aColumn << ","
+        << s.bRow << "," << s.bColumn << "," << s.cRow << "|" << (problem.streamA ? "A" : "")
+        << (problem.streamC ? "C" : "") << "|" << Target::key(target);
+    return out.str();
+}
+
+bool Database::load(const string& path) {
+    ifstream input(path);
+    if (!input.is_open()) {
+        return false;
+    }
+    
+    string line;
+    if (!getline(input, line) || line != DATABASE_HEADER) {
+        cerr << "Warning: ignoring incompatible tuning database " << path << endl;
+        return false;
+    }
+    while (getline(input, line)) {
+        istringstream fields(line);
+        string entryKey, dataflow;
+        Config config;
+        if (!(fields >> entryKey >> dataflow >> config.tileRows >> config.cost) ||
+            (dataflow != "OS" && dataflow != "WS") || config.tileRows <= 0) {
+            cerr << "Warning: skipping malformed tuning entry: " << line << endl;
+            continue;
+        }
+        config.dataflow = dataflow == "WS" ? LoopNest::WEIGHT_STATIONARY : LoopNest::OUTPUT_STATIONARY;
+        entries[entryKey] = config;
+    }
+    return true;
+}
+
+void Database::save(const string& path) const {
+    ofstream output(path);
+    if (!output.is_open()) {
+        throw runtime_error("Could not write tuning database: " + path);
+    }
+    output << DATABASE_HEADER << "\n";
+    for (const auto& [entryKey, config] : entries) {
+        output << entryKey << " " << (config.dataflow == LoopNest::WEIGHT_STATIONARY ? "WS" : "OS")
+               << " " << config.tileRows << " " << config.cost << "\n";
+    }
+}
+
+bool Database::lookup(const string& entryKey, Config& config) const {
+    auto it = entries.find(entryKey);
+    if (it == entries.end()) return false;
+    config = it->second;
+    return true;
+}
+
+void Database::store(const string& entryKey, const Config& config) {
+    entries[entryKey] = config;
+}
+
+}
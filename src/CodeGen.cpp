@@ -1,14 +1,124 @@
 #include "CodeGen.h"
+#include "TargetBackend.h"
 #include <sstream>
 #include <stdexcept>
 #include <algorithm>
 #include <iostream>
 #include <iomanip>  // For std::setw, std::setfill
+#include <atomic>
+#include <cctype>
+#include <exception>
+#include <functional>
+#include <thread>
 
 using namespace std;
 
-CodeGen::CodeGen(unique_ptr<ASTNode> ast, int size)
-    : root(std::move(ast)), matrix_size(size) {}
+CodeGen::CodeGen(unique_ptr<ASTNode> ast, int size, unordered_map<string, int> defines)
+    : root(std::move(ast)), matrix_size(size), size_defines(std::move(defines)) {
+    setTarget(Target::Description());
+}
+
+// Largest streamed tile; smaller when a subarray cannot hold it
+static const int MAX_TILE_BYTES = 4096;
+
+// Start alignment of regions packed into a shared device row
+static const int PACK_ALIGNMENT = 16;
+
+void CodeGen::setTarget(const Target::Description& description) {
+    Target::validate(description);
+    target = description;
+    row_bytes = target.row_bytes;
+    num_cores = target.cores;
+    tile_bytes = min(MAX_TILE_BYTES, Target::subarrayBytes(target));
+}
+
+static string formatAddress(int address, bool upper = false) {
+    stringstream ss;
+    ss << "0x" << hex << (upper ? uppercase : nouppercase) << setw(4) << setfill('0') << address;
+    return ss.str();
+}
+
+// Routine each form of product runs on, and the register it is programmed into
+static const char* routineName(LoopNest::Kind kind) {
+    switch (kind) {
+        case LoopNest::GEMV: return "gemv_broadcast";
+        case LoopNest::BATCHED: return "matmul_batched";
+        case LoopNest::SCALAR: return "mac_operation";
+        default: return "matrix_multiply";
+    }
+}
+
+// Partition p of a split-K product accumulates into C itself (p = 0) or a
+// partial buffer shaped like C
+static string partialName(const string& C, int p) {
+    return p == 0 ? C : C + ".k" + to_string(p);
+}
+
+static string routineRegister(const OpPlan& plan) {
+    switch (plan.nest.kind) {
+        case LoopNest::GEMV: return "r4";
+        case LoopNest::BATCHED: return "r5";
+        case LoopNest::SCALAR: return "r0";
+        default: return plan.dataflow == LoopNest::WEIGHT_STATIONARY ? "r3" : "r2";
+    }
+}
+
+// Wait for every operation issued so far, unless the last instruction
+// already does
+static void syncOperations(vector<string>& isa) {
+    for (auto it = isa.rbegin(); it != isa.rend(); ++it) {
+        if (it->empty() || (*it)[0] == '#') continue;
+        if (*it == "SYNC") return;
+        break;
+    }
+    isa.push_back("SYNC");
+}
+
+// Wait for the operations issued since from, unless a SYNC already follows
+// the last of them
+static void syncRunning(vector<string>& isa, size_t from) {
+    for (size_t n = isa.size(); n-- > from;) {
+        if (isa[n] == "SYNC") return;
+        if (isa[n].compare(0, 4, "EXE ") == 0) {
+            isa.push_back("SYNC");
+            return;
+        }
+    }
+}
+
+// Run work for every index on up to jobs threads. Workers claim indices from a
+// shared counter and write only their own slots, so results never depend on
+// scheduling; the first failure in index order is rethrown.
+static void forEachIndex(size_t count, int jobs, const function<void(size_t)>& work) {
+    int workers = min(jobs, static_cast<int>(count));
+    if (workers <= 1) {
+        for (size_t i = 0; i < count; i++) {
+            work(i);
+        }
+        return;
+    }
+    
+    vector<exception_ptr> failures(count);
+    atomic<size_t> next{0};
+    vector<thread> pool;
+    for (int w = 0; w < workers; w++) {
+        pool.emplace_back([&]() {
+            for (size_t i = next++; i < count; i = next++) {
+                try {
+                    work(i);
+                } catch (...) {
+                    failures[i] = current_exception();
+                }
+            }
+        });
+    }
+    for (auto& worker : pool) {
+        worker.join();
+    }
+    for (const auto& failure : failures) {
+        if (failure) rethrow_exception(failure);
+    }
+}
 
 vector<string> CodeGen::generatePIM_ISA() {
     vector<string> isa;
@@ -16,44 +126,155 @@ vector<string> CodeGen::generatePIM_ISA() {
     
     // Memory configuration
     isa.push_back("# MEMORY CONFIGURATION");
-    isa.push_back("ALLOCATE 0x0000 0xFFFF");
+    isa.push_back("# Target " + Target::summary(target));
+    if (options.slice.devices > 1) {
+        isa.push_back("# Device " + to_string(options.slice.device) + " of " + to_string(options.slice.devices) +
+                      ", products split along " + Partition::axisName(options.slice.axis));
+    }
+    isa.push_back("ALLOCATE " + formatAddress(0, true) + " " +
+                  formatAddress(Target::totalBytes(target) - 1, true));
     isa.push_back("");
     
-    // Define MAC operation for programming cores
+    // Choose loop order and dataflow for every operation, then program the
+    // routines they run on
+    planOperations();
+    set<LoopNest::Kind> kinds;
+    bool weightStationary = false;
+    bool splitK = false;
+    for (const auto& [node, plan] : op_plans) {
+        kinds.insert(plan.nest.kind);
+        weightStationary |= plan.nest.kind == LoopNest::MATMUL &&
+                            plan.dataflow == LoopNest::WEIGHT_STATIONARY;
+        splitK |= plan.split > 1;
+    }
+    
+    // Define MAC operation for programming cores; single elements run on it
     generateMacOperation(isa);
     
-    // Define matrix multiplication operation
-    generateMatrixMultiplyOperation(isa);
+    // Define matrix multiplication operation, unless only specialized forms need routines
+    if (kinds.empty() || kinds.count(LoopNest::MATMUL)) {
+        generateMatrixMultiplyOperation(isa);
+    }
+    if (weightStationary) {
+        generateWeightStationaryOperation(isa);
+    }
+    if (kinds.count(LoopNest::GEMV)) {
+        generateGemvOperation(isa);
+    }
+    if (kinds.count(LoopNest::BATCHED)) {
+        generateBatchedOperation(isa);
+    }
+    if (splitK) {
+        generateMatrixAddOperation(isa);
+    }
     
-    // First pass: identify all matrices that need allocation
+    // First pass: identify all matrices that need allocation, and which of
+    // them concurrent operations use so they can be kept in separate banks
     identifyMatrices();
     
-    // Second pass: allocate all matrices
+    // Fragments are position independent, so every function is scheduled and
+    // generated before placement; their waves say which operands conflict
+    vector<const ASTNode*> functions;
+    for (const auto& node : root->children) {
+        if (node->type == FUNCTION_NODE) {
+            functions.push_back(node.get());
+        }
+    }
+    vector<Fragment> fragments = generateFragments(functions);
+    planBankConflicts(fragments);
+    if (options.weight_resident) {
+        planResidency();
+    }
+    
+    // Second pass: allocate all matrices. The largest are placed first, while
+    // whole banks are still free, and among equal sizes those with the most
+    // conflicts, while banks to keep them apart are still free. The regions
+    // are listed in name order.
+    map<string, int> weight;
+    vector<string> placement;
+    for (const auto& name : matrices_to_allocate) {
+        if (!layouts.count(name)) {
+            layouts[name] = Layout::make(Layout::ROW_MAJOR, matrix_size, matrix_size, row_bytes);
+        }
+        for (const auto* pairs : {&operand_conflicts, &bank_conflicts}) {
+            auto conflicts = pairs->find(name);
+            if (conflicts == pairs->end()) continue;
+            for (const auto& [other, count] : conflicts->second) weight[name] += count;
+        }
+        placement.push_back(name);
+    }
+    stable_sort(placement.begin(), placement.end(), [&](const string& a, const string& b) {
+        int first = layouts.at(a).bytes, second = layouts.at(b).bytes;
+        return first != second ? first > second : weight[a] > weight[b];
+    });
+    for (const auto& name : placement) {
+        allocateMatrix(name);
+    }
     isa.push_back("# MATRIX ALLOCATIONS");
     for (const auto& name : matrices_to_allocate) {
         string addr = allocateMatrix(name);
-        isa.push_back("# Matrix " + name + " allocated at " + addr);
+        const Layout::MatrixLayout& layout = layouts[name];
+        isa.push_back("# Matrix " + name + " allocated at " + addr + " in bank " +
+                      to_string(matrix_bank[name]));
+        isa.push_back("ALLOC " + addr + " " + to_string(layout.bytes));
+        string layoutLine = "LAYOUT " + addr + ", " + Layout::kindName(layout.kind) + ", " +
+                            to_string(layout.rows) + ", " + to_string(layout.cols) + ", " +
+                            to_string(layout.pitch);
+        if (layout.kind == Layout::BLOCKED) {
+            layoutLine += ", " + to_string(layout.tile);
+        }
+        isa.push_back(layoutLine);
+        
+        // Host matrices are bound to their regions by name; partial sums such
+        // as C.k1 are compiler-internal
+        if (name.find('.') == string::npos) {
+            isa.push_back("BIND " + name + ", " + addr);
+        }
     }
     isa.push_back("");
     
-    for (const auto& [name, addr] : matrix_map) {
-        cout << "[CodeGen] Matrix " << name << " mapped to " << addr << endl;
+    // In weight-resident mode every call moves and reorders its own operands
+    if (options.double_buffer) {
+        allocateTransferBuffers(isa);
+        if (!options.weight_resident) generateResidentTransfers(true, isa);
     }
     
-    // Third pass: process functions containing matrix operations
-    isa.push_back("# MATRIX OPERATIONS");
-    for (const auto& node : root->children) {
-        if (node->type == FUNCTION_NODE) {
-            processFunctionNode(node.get(), isa);
+    // Reorder inputs into their selected layouts after the host loads them
+    if (!options.weight_resident) generateLayoutTransforms(true, isa);
+    
+    for (const auto& name : allocation_order) {
+        cout << "[CodeGen] Matrix " << name << " mapped to " << matrix_map[name] << endl;
+    }
+    
+    // Third pass: link the function fragments serially in source order
+    size_t operations = isa.size();
+    if (options.weight_resident) {
+        generateCallPhases(functions, fragments, isa);
+    } else {
+        isa.push_back("# MATRIX OPERATIONS");
+        for (const auto& fragment : fragments) {
+            linkFragment(fragment, isa);
+        }
+        
+        // Return outputs to host row-major order once the operations writing
+        // them have finished
+        vector<string> results;
+        generateLayoutTransforms(false, results);
+        if (options.double_buffer) {
+            generateResidentTransfers(false, results);
+        }
+        if (!results.empty()) {
+            syncOperations(isa);
+            isa.insert(isa.end(), results.begin(), results.end());
         }
     }
     
-    // Memory cleanup
+    // Memory cleanup, once the last operations have finished with it
+    syncRunning(isa, operations);
     isa.push_back("");
     isa.push_back("# MEMORY RELEASE");
-    for (const auto& [name, addr] : matrix_map) {
-        size_t size = matrix_size * matrix_size * sizeof(int);
-        isa.push_back("FREE " + addr + " " + to_string(size));
+    for (auto it = allocation_order.rbegin(); it != allocation_order.rend(); ++it) {
+        isa.push_back("FREE " + matrix_map[*it] + " " + to_string(layouts[*it].bytes));
     }
     
     // End program
@@ -63,53 +284,138 @@ vector<string> CodeGen::generatePIM_ISA() {
     return isa;
 }
 
+// Routine microcode does not depend on the program, so each block is built
+// once per process and copied into every program that uses it
+static void appendBlock(vector<string>& isa, const vector<string>& block) {
+    isa.insert(isa.end(), block.begin(), block.end());
+}
+
 void CodeGen::generateMacOperation(std::vector<std::string>& isa) {
-    isa.push_back("# Define the MAC (Multiply-Accumulate) operation for dot product");
-    isa.push_back("# First program the MAC function into the pPIM core");
-    
-    // Program the MAC operation into a core (register r0)
-    isa.push_back("PROG r0, mac_operation");
-    isa.push_back("# MAC operation microcode");
-    isa.push_back("EXE MUL r1, ah, bh  # Multiply high bits");
-    isa.push_back("EXE MUL r2, al, bl  # Multiply low bits");
-    isa.push_back("EXE MUL r3, ah, bl  # Multiply high with low");
-    isa.push_back("EXE MUL r4, al, bh  # Multiply low with high");
-    isa.push_back("EXE ADD r5, r3, r4  # Combine cross products");
-    isa.push_back("EXE ADD r6, r1, r2  # Combine direct products");
-    isa.push_back("EXE ADD r0, r5, r6  # Final result");
-    isa.push_back("END mac_operation");
-    isa.push_back("");
+    static const vector<string> block = {
+        "# Define the MAC (Multiply-Accumulate) operation for dot product",
+        "# First program the MAC function into the pPIM core",
+        
+        // Program the MAC operation into a core (register r0)
+        "PROG r0, mac_operation",
+        "# MAC operation microcode",
+        "EXE MUL r1, ah, bh  # Multiply high bits",
+        "EXE MUL r2, al, bl  # Multiply low bits",
+        "EXE MUL r3, ah, bl  # Multiply high with low",
+        "EXE MUL r4, al, bh  # Multiply low with high",
+        "EXE ADD r5, r3, r4  # Combine cross products",
+        "EXE ADD r6, r1, r2  # Combine direct products",
+        "EXE ADD r0, r5, r6  # Final result",
+        "END mac_operation",
+        ""
+    };
+    appendBlock(isa, block);
 }
 
 void CodeGen::generateMatrixMultiplyOperation(std::vector<std::string>& isa) {
-    isa.push_back("# Define a matrix multiplication operation");
-    isa.push_back("# Program the matrix multiplication function into the pPIM core");
-    isa.push_back("PROG r2, matrix_multiply");
-    
-    // Define basic operations needed for matrix multiplication
-    isa.push_back("# Matrix multiplication microcode");
-    isa.push_back("EXE ADD r0, r1, r2  # Addition operation: r0 = r1 + r2");
-    isa.push_back("EXE MUL r0, r1, r2  # Multiplication operation: r0 = r1 * r2");
-    isa.push_back("EXE ZERO r0         # Zero register: r0 = 0");
+    static const vector<string> head = {
+        "# Define a matrix multiplication operation",
+        "# Program the matrix multiplication function into the pPIM core",
+        "PROG r2, matrix_multiply",
+        
+        // Define basic operations needed for matrix multiplication
+        "# Matrix multiplication microcode",
+        "EXE ADD r0, r1, r2  # Addition operation: r0 = r1 + r2",
+        "EXE MUL r0, r1, r2  # Multiplication operation: r0 = r1 * r2",
+        "EXE ZERO r0         # Zero register: r0 = 0"
+    };
+    static const vector<string> body = {
+        // We'll define a generic matrix multiplication pattern
+        // The actual matrix indices will be resolved during execution
+        "# For each element of the result matrix",
+        "# Z[i][j] = sum(X[i][k] * Y[k][j]) for all k",
+        
+        // Implement the core multiplication loop structure
+        "EXE ZERO acc                # Initialize accumulator to 0",
+        "EXE READ r1, X_addr[i][k]   # Load X[i][k]",
+        "EXE READ r2, Y_addr[k][j]   # Load Y[k][j]",
+        "EXE MUL r3, r1, r2          # r3 = X[i][k] * Y[k][j]",
+        "EXE ADD acc, acc, r3        # acc += r3",
+        "EXE WRITE Z_addr[i][j], acc # Store result to Z[i][j]",
+        "END matrix_multiply",
+        ""
+    };
+    appendBlock(isa, head);
     
     // Matrix multiplication implementation for NxN matrices
     isa.push_back("# Matrix multiplication implementation for " + to_string(matrix_size) + "x" + to_string(matrix_size) + " matrices");
-    
-    // We'll define a generic matrix multiplication pattern
-    // The actual matrix indices will be resolved during execution
-    isa.push_back("# For each element of the result matrix");
-    isa.push_back("# Z[i][j] = sum(X[i][k] * Y[k][j]) for all k");
-    
-    // Implement the core multiplication loop structure
-    isa.push_back("EXE ZERO acc                # Initialize accumulator to 0");
-    isa.push_back("EXE READ r1, X_addr[i][k]   # Load X[i][k]");
-    isa.push_back("EXE READ r2, Y_addr[k][j]   # Load Y[k][j]");
-    isa.push_back("EXE MUL r3, r1, r2          # r3 = X[i][k] * Y[k][j]");
-    isa.push_back("EXE ADD acc, acc, r3        # acc += r3");
-    isa.push_back("EXE WRITE Z_addr[i][j], acc # Store result to Z[i][j]");
-    
-    isa.push_back("END matrix_multiply");
-    isa.push_back("");
+    appendBlock(isa, body);
+}
+
+void CodeGen::generateWeightStationaryOperation(std::vector<std::string>& isa) {
+    static const vector<string> block = {
+        "# Define the weight-stationary matrix multiplication variant",
+        "# Row k of Y stays open in the row buffer while every row of X streams past it",
+        "PROG r3, matrix_multiply_ws",
+        "# Weight-stationary microcode, loop order k-i-j",
+        "# Z[i][j] += X[i][k] * Y[k][j], Z zeroed before the first k",
+        "EXE READ r1, X_addr[i][k]   # Load X[i][k] once per row of Z",
+        "EXE READ r2, Y_addr[k][j]   # Y[k][j] from the open row",
+        "EXE MUL r3, r1, r2          # r3 = X[i][k] * Y[k][j]",
+        "EXE READ r4, Z_addr[i][j]   # Load partial sum",
+        "EXE ADD r4, r4, r3          # r4 += r3",
+        "EXE WRITE Z_addr[i][j], r4  # Store partial sum",
+        "END matrix_multiply_ws",
+        ""
+    };
+    appendBlock(isa, block);
+}
+
+void CodeGen::generateGemvOperation(std::vector<std::string>& isa) {
+    static const vector<string> block = {
+        "# Define the matrix-vector operation",
+        "# Each vector element is read once and broadcast across a whole row of the matrix",
+        "PROG r4, gemv_broadcast",
+        "# GEMV microcode, y = X * v (N = 1) or y = v * X (M = 1)",
+        "EXE ZERO acc                # Initialize accumulator to 0",
+        "EXE READ r1, V_addr[k]      # Broadcast v[k]",
+        "EXE READ r2, X_addr[i][k]   # X[i][k] from the open row",
+        "EXE MUL r3, r1, r2          # r3 = X[i][k] * v[k]",
+        "EXE ADD acc, acc, r3        # acc += r3",
+        "EXE WRITE Y_addr[i], acc    # Store y[i]",
+        "END gemv_broadcast",
+        ""
+    };
+    appendBlock(isa, block);
+}
+
+void CodeGen::generateBatchedOperation(std::vector<std::string>& isa) {
+    static const vector<string> block = {
+        "# Define the batched matrix multiplication operation",
+        "# Every product of a batch runs in one invocation; product b starts b operand sizes past each base",
+        "PROG r5, matmul_batched",
+        "# Batched microcode",
+        "# Z[b][i][j] = sum(X[b][i][k] * Y[b][k][j]) for all k, for every b",
+        "EXE ZERO acc                  # Initialize accumulator to 0",
+        "EXE READ r1, X_addr[b][i][k]  # Load X[b][i][k]",
+        "EXE READ r2, Y_addr[b][k][j]  # Load Y[b][k][j]",
+        "EXE MUL r3, r1, r2            # r3 = X[b][i][k] * Y[b][k][j]",
+        "EXE ADD acc, acc, r3          # acc += r3",
+        "EXE WRITE Z_addr[b][i][j], acc # Store result to Z[b][i][j]",
+        "END matmul_batched",
+        ""
+    };
+    appendBlock(isa, block);
+}
+
+void CodeGen::generateMatrixAddOperation(std::vector<std::string>& isa) {
+    static const vector<string> block = {
+        "# Define the element-wise matrix addition that merges split-K partial sums",
+        "PROG r6, matrix_add",
+        "# Addition microcode",
+        "# Z[i][j] = X[i][j] + Y[i][j]",
+        "EXE READ r1, X_addr[i][j]   # Load X[i][j]",
+        "EXE READ r2, Y_addr[i][j]   # Load Y[i][j]",
+        "EXE ADD r3, r1, r2          # r3 = X[i][j] + Y[i][j]",
+        "EXE WRITE Z_addr[i][j], r3  # Store result to Z[i][j]",
+        "END matrix_add",
+        ""
+    };
+    appendBlock(isa, block);
 }
 
 void CodeGen::identifyMatrices() {
@@ -134,6 +440,20 @@ void CodeGen::identifyMatrices() {
         }
     }
     
+    // Partial sums of split-K products are stored like their result
+    for (const auto& [node, plan] : op_plans) {
+        for (int p = 1; p < plan.split; p++) {
+            string name = partialName(plan.nest.C, p);
+            matrices_to_allocate.insert(name);
+            layouts[name] = layouts[plan.nest.C];
+        }
+    }
+    
+    // Streamed operands only ever occupy the transfer buffers
+    for (const auto& name : streamed) {
+        matrices_to_allocate.erase(name);
+    }
+    
     // Debug output
     cout << "[CodeGen] Identified matrices to allocate: ";
     for (const auto& matrix : matrices_to_allocate) {
@@ -142,18 +462,642 @@ void CodeGen::identifyMatrices() {
     cout << endl;
 }
 
-void CodeGen::processFunctionNode(const ASTNode* funcNode, vector<string>& isa) {
-    cout << "[CodeGen] Processing function: " << funcNode->value << endl;
+FunctionPlan CodeGen::planFunction(const ASTNode* funcNode) const {
+    FunctionPlan result;
+    result.function = funcNode->value;
+    for (const auto& child : funcNode->children) {
+        if (child->type != MATRIX_OP_NODE || child->value != "*" || child->children.size() < 3) {
+            continue;
+        }
+        
+        LoopNest::MatMulNest nest;
+        if (LoopNest::extract(child.get(), size_defines, matrix_size, nest)) {
+            ostringstream message;
+            message << "[CodeGen] Loop nest " << nest.sourceOrder << " in " << funcNode->value
+                    << ": " << nest.M << "x" << nest.N << "x" << nest.K;
+            if (nest.kind != LoopNest::MATMUL) {
+                message << " (" << LoopNest::kindName(nest.kind);
+                if (nest.kind == LoopNest::BATCHED) message << ", " << nest.batch << " products";
+                message << ")";
+            }
+            result.log.push_back(message.str());
+        } else {
+            // No loop information: square operands of the detected size
+            nest.A = child->children[0]->value;
+            nest.B = child->children[1]->value;
+            nest.C = child->children[2]->value;
+            nest.M = nest.N = nest.K = matrix_size;
+        }
+        
+        // A device of a partitioned program computes its share of the product
+        Partition::apply(options.slice, nest);
+        result.nests.push_back(nest);
+    }
+    return result;
+}
+
+uint64_t CodeGen::planFingerprint(const ASTNode* funcNode) const {
+    // Extraction sees only the function's tokens, the #defines its bounds
+    // name, the fallback size and the device's slice
+    ostringstream key;
+    key << funcNode->value << "|" << matrix_size << "|" << options.slice.devices << ":"
+        << options.slice.device << ":" << options.slice.axis;
+    for (const auto& [name, value] : map<string, int>(size_defines.begin(), size_defines.end())) {
+        key << "|" << name << "=" << value;
+    }
+    return FragmentCache::hash(key.str(), funcNode->fingerprint);
+}
+
+void CodeGen::planOperations() {
+    // Extract every function's loop nests, reusing the cached ones of
+    // functions whose tokens did not change; the rest are planned in parallel
+    vector<const ASTNode*> functions;
+    vector<vector<const ASTNode*>> ops;
+    for (const auto& node : root->children) {
+        if (node->type != FUNCTION_NODE) continue;
+        
+        functions.push_back(node.get());
+        ops.emplace_back();
+        for (const auto& child : node->children) {
+            if (child->type == MATRIX_OP_NODE && child->value == "*" && child->children.size() >= 3) {
+                ops.back().push_back(child.get());
+            }
+        }
+    }
+    
+    vector<uint64_t> fingerprints(functions.size());
+    vector<const FunctionPlan*> plans(functions.size());
+    vector<size_t> pending;
+    for (size_t f = 0; f < functions.size(); f++) {
+        if (fragment_cache) {
+            fingerprints[f] = planFingerprint(functions[f]);
+            plans[f] = fragment_cache->lookupPlan(functions[f]->value, fingerprints[f]);
+        }
+        if (!plans[f] || plans[f]->nests.size() != ops[f].size()) {
+            pending.push_back(f);
+        }
+    }
+    vector<FunctionPlan> fresh(pending.size());
+    forEachIndex(pending.size(), options.jobs, [&](size_t p) {
+        fresh[p] = planFunction(functions[pending[p]]);
+    });
+    for (size_t p = 0; p < pending.size(); p++) {
+        plans[pending[p]] = &fresh[p];
+    }
+    
+    vector<const ASTNode*> order;
+    for (size_t f = 0; f < functions.size(); f++) {
+        for (const auto& message : plans[f]->log) {
+            cout << message << endl;
+        }
+        for (size_t n = 0; n < ops[f].size(); n++) {
+            OpPlan plan;
+            plan.nest = plans[f]->nests[n];
+            op_plans[ops[f][n]] = plan;
+            order.push_back(ops[f][n]);
+        }
+    }
+    if (fragment_cache) {
+        for (size_t p = 0; p < pending.size(); p++) {
+            fragment_cache->storePlan(fresh[p], fingerprints[pending[p]]);
+        }
+        cout << "[CodeGen] Planned " << pending.size() << " of " << functions.size() << " functions"
+             << endl;
+    }
+    
+    // Choose storage for every operand from its accesses across the whole
+    // program, then settle each operation's dataflow under those layouts
+    vector<LoopNest::MatMulNest> nests;
+    for (const ASTNode* op : order) {
+        nests.push_back(op_plans[op].nest);
+    }
+    layouts = Layout::select(nests, row_bytes);
+    
+    // Double buffering streams every operand that is never the resident B of
+    // an operation; streamed tiles travel in host row-major order. Batched and
+    // single-element products are small and keep all their operands resident.
+    if (options.double_buffer) {
+        set<string> resident;
+        for (const auto& nest : nests) {
+            resident.insert(nest.B);
+            if (nest.kind == LoopNest::BATCHED || nest.kind == LoopNest::SCALAR) {
+                resident.insert(nest.A);
+                resident.insert(nest.C);
+            }
+        }
+        for (const auto& nest : nests) {
+            for (const string& name : {nest.A, nest.C}) {
+                if (!resident.count(name)) {
+                    streamed.insert(name);
+                    const Layout::MatrixLayout& layout = layouts[name];
+                    layouts[name] = Layout::make(Layout::ROW_MAJOR, layout.rows, layout.cols, row_bytes);
+                }
+            }
+        }
+    }
     
-    // First pass: collect all matrices
+    // Only general products choose a dataflow; the other forms have a routine each
+    vector<const ASTNode*> general;
+    for (const ASTNode* op : order) {
+        OpPlan& plan = op_plans[op];
+        cout << "[CodeGen] " << plan.nest.A << " * " << plan.nest.B << " -> " << plan.nest.C << " using ";
+        if (plan.nest.kind != LoopNest::MATMUL) {
+            cout << routineName(plan.nest.kind) << endl;
+            continue;
+        }
+        plan.dataflow = LoopNest::chooseDataflow(plan.nest, row_bytes,
+                                                 Layout::strides(plan.nest, layouts, row_bytes));
+        cout << LoopNest::dataflowName(plan.dataflow) << endl;
+        general.push_back(op);
+    }
+    for (const auto& [name, layout] : layouts) {
+        if (layout.kind != Layout::ROW_MAJOR) {
+            cout << "[CodeGen] Matrix " << name << " stored " << Layout::kindName(layout.kind) << endl;
+        }
+    }
+    
+    if (options.autotune && !general.empty()) {
+        tuneOperations(general);
+    }
+    planSplitK(general);
+}
+
+void CodeGen::planSplitK(const vector<const ASTNode*>& order) {
+    // Memory left for partial sums once every operand is placed
+    int spare = memoryCapacity();
+    for (const auto& [name, layout] : layouts) {
+        spare -= layout.bytes;
+    }
+    
+    // A product much deeper than it is wide leaves cores idle: split K into up
+    // to one partition per core, each at least twice as deep as C is wide, so
+    // the tree of additions that merges them stays small next to the products.
+    // Streamed and blocked operands keep the single-core form.
+    for (const ASTNode* op : order) {
+        OpPlan& plan = op_plans[op];
+        const LoopNest::MatMulNest& nest = plan.nest;
+        if (streamed.count(nest.A) || streamed.count(nest.C) ||
+            layouts[nest.A].kind == Layout::BLOCKED || layouts[nest.B].kind == Layout::BLOCKED) {
+            continue;
+        }
+        int split = 1;
+        int partialBytes = layouts[nest.C].bytes;
+        while (split * 2 <= num_cores && nest.K / (split * 2) >= 2 * max(nest.M, nest.N) &&
+               (split * 2 - 1) * partialBytes <= spare) {
+            split *= 2;
+        }
+        if (split == 1) continue;
+        
+        plan.split = split;
+        spare -= (split - 1) * partialBytes;
+        cout << "[CodeGen] " << nest.A << " * " << nest.B << " -> " << nest.C << " split " << split
+             << " ways along K" << endl;
+    }
+}
+
+void CodeGen::tuneOperations(const vector<const ASTNode*>& order) {
+    // Reuse database entries; search every remaining shape once, in parallel
+    vector<Autotune::Problem> problems;
+    vector<string> keys;
+    unordered_map<string, size_t> searched;
+    vector<pair<OpPlan*, size_t>> pending;
+    int reused = 0;
+    for (const ASTNode* op : order) {
+        OpPlan& plan = op_plans[op];
+        Autotune::Problem problem;
+        problem.nest = plan.nest;
+        problem.strides = Layout::strides(plan.nest, layouts, row_bytes);
+        problem.streamA = streamed.count(plan.nest.A);
+        problem.streamC = streamed.count(plan.nest.C);
+        problem.defaultTileRows = tileRows(plan);
+        string key = Autotune::key(problem, target);
+        
+        Autotune::Config config;
+        if (tuning_db && tuning_db->lookup(key, config)) {
+            plan.dataflow = config.dataflow;
+            plan.tile_rows = problem.streamA || problem.streamC ? config.tileRows : 0;
+            reused++;
+            continue;
+        }
+        if (!searched.count(key)) {
+            searched[key] = problems.size();
+            problems.push_back(problem);
+            keys.push_back(key);
+        }
+        pending.push_back({&plan, searched[key]});
+    }
+    
+    // A candidate costs the cycles of the operation's own code generated with it
+    auto measure = [this](const Autotune::Problem& problem, const Autotune::Config& config) {
+        OpPlan plan;
+        plan.nest = problem.nest;
+        plan.dataflow = config.dataflow;
+        plan.tile_rows = config.tileRows;
+        vector<string> fragment;
+        generateMatrixMultiplyExecution(plan, fragment);
+        return static_cast<double>(TargetBackend::measureISA(fragment).cycles);
+    };
+    size_t evaluated = 0;
+    vector<Autotune::Config> best = Autotune::search(problems, target, measure, options.jobs, &evaluated);
+    for (const auto& [plan, index] : pending) {
+        plan->dataflow = best[index].dataflow;
+        plan->tile_rows = problems[index].streamA || problems[index].streamC ? best[index].tileRows : 0;
+    }
+    for (size_t i = 0; i < problems.size(); i++) {
+        if (tuning_db) tuning_db->store(keys[i], best[i]);
+    }
+    
+    cout << "[CodeGen] Autotuned " << order.size() << " operation(s): " << reused
+         << " from the tuning database, " << problems.size() << " shape(s) searched over "
+         << evaluated << " candidates" << endl;
+    for (const ASTNode* op : order) {
+        const OpPlan& plan = op_plans[op];
+        cout << "[CodeGen] " << plan.nest.A << " * " << plan.nest.B << " -> " << plan.nest.C
+             << " tuned to " << LoopNest::dataflowName(plan.dataflow);
+        if (plan.tile_rows > 0) cout << ", " << plan.tile_rows << "-row tiles";
+        cout << endl;
+    }
+}
+
+void CodeGen::generateLayoutTransforms(bool toDevice, vector<string>& isa) {
+    // Inputs are reordered after loading, outputs restored before the host reads them
+    set<string> targets;
+    for (const auto& [node, plan] : op_plans) {
+        if (toDevice) {
+            targets.insert(plan.nest.A);
+            targets.insert(plan.nest.B);
+        } else {
+            targets.insert(plan.nest.C);
+        }
+    }
+    
+    vector<string> lines;
+    for (const auto& name : targets) {
+        const Layout::MatrixLayout& layout = layouts[name];
+        if (layout.kind == Layout::ROW_MAJOR) continue;
+        string kind = toDevice ? Layout::kindName(layout.kind) : Layout::kindName(Layout::ROW_MAJOR);
+        lines.push_back("XFORM " + matrix_map[name] + ", " + kind);
+    }
+    if (lines.empty()) return;
+    
+    if (toDevice) {
+        isa.push_back("# LAYOUT TRANSFORMS");
+        isa.insert(isa.end(), lines.begin(), lines.end());
+        isa.push_back("");
+    } else {
+        isa.push_back("");
+        isa.push_back("# RESTORE HOST LAYOUT");
+        isa.insert(isa.end(), lines.begin(), lines.end());
+    }
+}
+
+int CodeGen::tileRows(const OpPlan& plan) const {
+    if (plan.tile_rows > 0) return plan.tile_rows;
+    
+    // As many rows of A and C as fit the tile budget, at least one
+    const LoopNest::MatMulNest& nest = plan.nest;
+    int widest = max(nest.K, nest.N) * static_cast<int>(sizeof(int));
+    return max(1, min(nest.M, tile_bytes / widest));
+}
+
+void CodeGen::allocateTransferBuffers(vector<string>& isa) {
+    if (streamed.empty()) return;
+    
+    // One pair of ping-pong buffers for incoming A tiles and one for outgoing
+    // C tiles, sized for the largest tile of any operation
+    int inBytes = 0;
+    int outBytes = 0;
+    for (const auto& [node, plan] : op_plans) {
+        int rows = tileRows(plan);
+        inBytes = max(inBytes, rows * plan.nest.K * static_cast<int>(sizeof(int)));
+        outBytes = max(outBytes, rows * plan.nest.N * static_cast<int>(sizeof(int)));
+    }
+    
+    isa.push_back("# TRANSFER BUFFERS");
+    for (const char* name : {"in.0", "in.1", "out.0", "out.1"}) {
+        int bytes = name[0] == 'i' ? inBytes : outBytes;
+        Layout::MatrixLayout buffer;
+        buffer.rows = 1;
+        buffer.cols = bytes / sizeof(int);
+        buffer.pitch = bytes;
+        buffer.bytes = (bytes + row_bytes - 1) / row_bytes * row_bytes;
+        layouts[name] = buffer;
+        string addr = allocateMatrix(name);
+        isa.push_back("# Buffer " + string(name) + " allocated at " + addr + " in bank " +
+                      to_string(matrix_bank[name]));
+        isa.push_back("ALLOC " + addr + " " + to_string(buffer.bytes));
+    }
+    isa.push_back("");
+}
+
+void CodeGen::generateResidentTransfers(bool toDevice, vector<string>& isa) {
+    // Resident operands move whole: inputs before the first operation, results
+    // after the last. Non-row-major layouts land dense and are reordered by XFORM.
+    set<string> targets;
+    for (const auto& [node, plan] : op_plans) {
+        for (const string& name : {plan.nest.A, plan.nest.B, plan.nest.C}) {
+            bool isResult = name == plan.nest.C;
+            if (!streamed.count(name) && isResult != toDevice) {
+                targets.insert(name);
+            }
+        }
+    }
+    if (targets.empty()) return;
+    
+    if (!toDevice) isa.push_back("");
+    isa.push_back(toDevice ? "# RESIDENT OPERAND LOADS" : "# RESIDENT RESULT STORES");
+    for (const auto& name : targets) {
+        isa.push_back(wholeTransfer(toDevice, name, name));
+    }
+    isa.push_back("SYNC");
+    if (toDevice) isa.push_back("");
+}
+
+string CodeGen::wholeTransfer(bool toDevice, const string& name, const string& host) const {
+    const Layout::MatrixLayout& layout = layouts.at(name);
+    int rowLength = layout.cols * static_cast<int>(sizeof(int));
+    string shape = to_string(layout.rows) + ", " + to_string(rowLength);
+    if (layout.kind == Layout::ROW_MAJOR && layout.pitch != rowLength) {
+        shape += ", " + to_string(layout.pitch);
+    }
+    if (toDevice) {
+        return "LOAD " + matrix_map.at(name) + ", " + host + "+0, " + shape;
+    }
+    return "STORE " + host + "+0, " + matrix_map.at(name) + ", " + shape;
+}
+
+// A kernel invocation: the host matrix bound to each matrix parameter
+struct CallSite {
+    const ASTNode* function;
+    vector<string> params;
+    vector<string> args;
+};
+
+// Calls made from main, in order. Without any, every kernel runs once on host
+// matrices named after its parameters.
+static vector<CallSite> callSites(const ASTNode* root) {
+    unordered_map<string, const ASTNode*> kernels;
+    vector<CallSite> calls;
+    for (const auto& node : root->children) {
+        if (node->type != FUNCTION_NODE) continue;
+        
+        CallSite call{node.get(), {}, {}};
+        for (const auto& child : node->children) {
+            if (child->type == MATRIX_DECL_NODE) call.params.push_back(child->value);
+        }
+        call.args = call.params;
+        kernels[node->value] = node.get();
+        calls.push_back(call);
+    }
+    
+    vector<CallSite> fromMain;
+    for (const auto& node : root->children) {
+        if (node->type != CALL_NODE || !kernels.count(node->value)) continue;
+        
+        auto kernel = find_if(calls.begin(), calls.end(),
+                              [&](const CallSite& c) { return c.function == kernels[node->value]; });
+        CallSite call = *kernel;
+        for (size_t p = 0; p < call.args.size() && p < node->children.size(); p++) {
+            // Arguments that are not plain matrix names keep the parameter's
+            if (!node->children[p]->value.empty()) call.args[p] = node->children[p]->value;
+        }
+        fromMain.push_back(call);
+    }
+    return fromMain.empty() ? calls : fromMain;
+}
+
+// Matrices the operations of a function read, and those they write
+static void functionAccess(const ASTNode* function, set<string>& reads, set<string>& writes) {
+    for (const auto& node : function->children) {
+        if (node->type == MATRIX_OP_NODE && node->value == "*" && node->children.size() >= 3) {
+            reads.insert(node->children[0]->value);
+            reads.insert(node->children[1]->value);
+            writes.insert(node->children[2]->value);
+        }
+    }
+}
+
+void CodeGen::planResidency() {
+    // Host matrices bound to every operand across all calls, the operands
+    // some called kernel writes, and the host matrices those calls write
+    vector<CallSite> calls = callSites(root.get());
+    map<string, set<string>> bindings;
+    set<string> read, written, hostWritten;
+    for (const auto& call : calls) {
+        set<string> reads, writes;
+        functionAccess(call.function, reads, writes);
+        read.insert(reads.begin(), reads.end());
+        written.insert(writes.begin(), writes.end());
+        for (size_t p = 0; p < call.params.size(); p++) {
+            bindings[call.params[p]].insert(call.args[p]);
+            if (writes.count(call.params[p])) hostWritten.insert(call.args[p]);
+        }
+    }
+    
+    // An operand only read, and bound to the same unmodified host matrix in
+    // every call, holds the same data throughout: it is pinned. Streamed
+    // operands only pass through the transfer buffers.
+    for (const auto& [name, hosts] : bindings) {
+        const string& host = *hosts.begin();
+        if (read.count(name) && !written.count(name) && hosts.size() == 1 && !hostWritten.count(host) &&
+            matrices_to_allocate.count(name)) {
+            pinned[name] = host;
+            cout << "[CodeGen] Pinned " << name << " (host " << host << ") across " << calls.size()
+                 << " call(s)" << endl;
+        }
+    }
+}
+
+// Host operands of streamed transfers name the kernel parameter; a call
+// moves its own arguments instead
+static string rebindHost(const string& line, const unordered_map<string, string>& hosts) {
+    bool load = line.compare(0, 5, "LOAD ") == 0;
+    if (!load && line.compare(0, 6, "STORE ") != 0) return line;
+    size_t start = load ? line.find(", ") + 2 : 6;
+    size_t end = line.find_first_of("+,", start);
+    auto host = hosts.find(line.substr(start, end - start));
+    if (host == hosts.end()) return line;
+    return line.substr(0, start) + host->second + line.substr(end);
+}
+
+void CodeGen::generateCallPhases(const vector<const ASTNode*>& functions,
+                                 const vector<Fragment>& fragments, vector<string>& isa) {
+    auto xform = [&](const string& name, Layout::Kind kind) {
+        isa.push_back("XFORM " + matrix_map[name] + ", " + Layout::kindName(kind));
+    };
+    
+    // Pinned operands are loaded and laid out once and stay for every call
+    isa.push_back("# ONE-TIME LOAD PHASE");
+    if (pinned.empty()) {
+        isa.push_back("# No operand is constant across calls");
+    } else {
+        string names;
+        for (const auto& [name, host] : pinned) {
+            names += (names.empty() ? "" : ", ") + name;
+        }
+        isa.push_back("# Constant across calls, kept in PIM memory: " + names);
+        for (const auto& [name, host] : pinned) {
+            isa.push_back(wholeTransfer(true, name, host));
+        }
+        isa.push_back("SYNC");
+        for (const auto& [name, host] : pinned) {
+            if (layouts[name].kind != Layout::ROW_MAJOR) xform(name, layouts[name].kind);
+        }
+    }
+    isa.push_back("");
+    
+    // Each call moves only its activations and results
+    isa.push_back("# PER-CALL PHASE");
+    vector<CallSite> calls = callSites(root.get());
+    for (size_t n = 0; n < calls.size(); n++) {
+        const CallSite& call = calls[n];
+        size_t index = find(functions.begin(), functions.end(), call.function) - functions.begin();
+        string args;
+        unordered_map<string, string> hosts;
+        for (size_t p = 0; p < call.params.size(); p++) {
+            args += (p ? ", " : "") + call.args[p];
+            hosts[call.params[p]] = call.args[p];
+        }
+        isa.push_back("# CALL " + to_string(n + 1) + ": " + call.function->value + "(" + args + ")");
+        
+        set<string> reads, writes;
+        functionAccess(call.function, reads, writes);
+        auto host = [&](const string& name) { return hosts.count(name) ? hosts[name] : name; };
+        auto moved = [&](const string& name) { return !pinned.count(name) && !streamed.count(name); };
+        
+        vector<string> inputs;
+        for (const auto& name : reads) {
+            if (!writes.count(name) && moved(name)) inputs.push_back(name);
+        }
+        for (const auto& name : inputs) {
+            isa.push_back(wholeTransfer(true, name, host(name)));
+        }
+        if (!inputs.empty()) isa.push_back("SYNC");
+        for (const auto& name : inputs) {
+            if (layouts[name].kind != Layout::ROW_MAJOR) xform(name, layouts[name].kind);
+        }
+        
+        vector<string> linked;
+        linkFragment(fragments[index], linked);
+        for (const auto& line : linked) {
+            isa.push_back(rebindHost(line, hosts));
+        }
+        
+        // Results return in host row-major order once the call has finished
+        bool stored = false;
+        for (const auto& name : writes) {
+            if (!moved(name)) continue;
+            if (!stored) syncOperations(isa);
+            if (layouts[name].kind != Layout::ROW_MAJOR) xform(name, Layout::ROW_MAJOR);
+            isa.push_back(wholeTransfer(false, name, host(name)));
+            stored = true;
+        }
+        if (stored) isa.push_back("SYNC");
+        if (n + 1 < calls.size()) isa.push_back("");
+    }
+}
+
+vector<Fragment> CodeGen::generateFragments(const vector<const ASTNode*>& functions) const {
+    vector<Fragment> fragments(functions.size());
+    
+    // Reuse cached fragments whose fingerprint still matches and whose operands
+    // are all still allocated; everything else is regenerated
+    vector<uint64_t> fingerprints(functions.size());
+    vector<size_t> pending;
+    for (size_t i = 0; i < functions.size(); i++) {
+        fingerprints[i] = fragmentFingerprint(functions[i]);
+        const Fragment* cached = fragment_cache ?
+            fragment_cache->lookup(functions[i]->value, fingerprints[i]) : nullptr;
+        bool usable = cached != nullptr;
+        for (size_t m = 0; usable && m < cached->matrices.size(); m++) {
+            const string& name = cached->matrices[m];
+            usable = matrices_to_allocate.count(name) || streamed.count(name);
+        }
+        if (usable) {
+            fragments[i] = *cached;
+        } else {
+            pending.push_back(i);
+        }
+    }
+    
+    // Each fragment lands in the slot of its function, so the link order
+    // never depends on scheduling
+    forEachIndex(pending.size(), options.jobs, [&](size_t p) {
+        fragments[pending[p]] = generateFunctionFragment(functions[pending[p]]);
+    });
+    
+    if (fragment_cache) {
+        vector<string> names;
+        for (size_t i = 0; i < functions.size(); i++) {
+            fragment_cache->store(fragments[i], fingerprints[i]);
+            names.push_back(functions[i]->value);
+        }
+        fragment_cache->retain(names);
+        cout << "[CodeGen] Reused " << functions.size() - pending.size() << " of "
+             << functions.size() << " function fragments" << endl;
+    }
+    return fragments;
+}
+
+uint64_t CodeGen::fragmentFingerprint(const ASTNode* funcNode) const {
+    // The function's tokens plus everything decided outside it that shapes its
+    // fragment: plans, operand layouts, streaming and the generation options
+    ostringstream key;
+    key << funcNode->value << "|" << matrix_size << "|" << options.double_buffer << "|"
+        << num_cores << "|" << tile_bytes << "|" << row_bytes << "|" << Target::summary(target);
     for (const auto& node : funcNode->children) {
-        if (node->type == MATRIX_DECL_NODE) {
-            cout << "[CodeGen] Found matrix: " << node->value << endl;
-            allocateMatrix(node->value);
+        auto it = op_plans.find(node.get());
+        if (it == op_plans.end()) continue;
+        
+        const OpPlan& plan = it->second;
+        key << "|" << plan.nest.sourceOrder << ":" << plan.nest.M << "x" << plan.nest.N << "x"
+            << plan.nest.K << ":" << plan.dataflow << ":" << plan.tile_rows << ":" << plan.nest.kind
+            << ":" << plan.nest.batch << ":" << plan.nest.row << "," << plan.nest.col << ","
+            << plan.nest.depth << ":" << plan.split;
+        for (const string& name : {plan.nest.A, plan.nest.B, plan.nest.C}) {
+            auto layout = layouts.find(name);
+            key << "|" << name << ":" << streamed.count(name) << ":" << matrices_to_allocate.count(name);
+            if (layout != layouts.end()) {
+                key << ":" << layout->second.kind << ":" << layout->second.rows << ":"
+                    << layout->second.cols << ":" << layout->second.pitch << ":"
+                    << layout->second.tile << ":" << layout->second.bytes;
+            }
         }
     }
+    return FragmentCache::hash(key.str(), funcNode->fingerprint);
+}
+
+void CodeGen::linkFragment(const Fragment& fragment, vector<string>& isa) const {
+    for (const auto& message : fragment.log) {
+        cout << message << endl;
+    }
     
-    // Second pass: process operations
+    // Replace every @name operand with the address assigned to it
+    for (const auto& line : fragment.lines) {
+        string resolved;
+        for (size_t pos = 0; pos < line.size();) {
+            if (line[pos] != '@') {
+                resolved += line[pos++];
+                continue;
+            }
+            size_t end = pos + 1;
+            while (end < line.size() && (isalnum(line[end]) || line[end] == '_' || line[end] == '.')) {
+                end++;
+            }
+            string name = line.substr(pos + 1, end - pos - 1);
+            auto addr = matrix_map.find(name);
+            if (addr == matrix_map.end()) {
+                throw runtime_error("Unresolved operand @" + name + " in " + fragment.function);
+            }
+            resolved += addr->second;
+            pos = end;
+        }
+        isa.push_back(resolved);
+    }
+}
+
+void CodeGen::collectOperations(const ASTNode* funcNode, vector<const ASTNode*>& ops,
+                                vector<Schedule::OpAccess>& access, vector<string>* log) const {
     for (const auto& node : funcNode->children) {
         if (node->type == MATRIX_OP_NODE && node->value == "*") {
             if (node->children.size() >= 3) {
@@ -161,30 +1105,407 @@ void CodeGen::processFunctionNode(const ASTNode* funcNode, vector<string>& isa)
                 const string& B = node->children[1]->value;
                 const string& C = node->children[2]->value;
                 
-                cout << "[CodeGen] Generating multiplication: "
-                     << A << " * " << B << " -> " << C << endl;
-                
                 // Validate addresses
-                if (matrix_map.find(A) == matrix_map.end() ||
-                    matrix_map.find(B) == matrix_map.end() ||
-                    matrix_map.find(C) == matrix_map.end()) {
-                    cerr << "Error: Missing matrix address\n";
+                auto placed = [this](const string& name) {
+                    return streamed.count(name) || matrices_to_allocate.count(name);
+                };
+                if (!placed(A) || !placed(B) || !placed(C)) {
+                    if (log) log->push_back("Error: Missing matrix address");
                     continue;
                 }
                 
-                generateMatrixMultiplyExecution(A, B, C, isa);
+                Schedule::OpAccess op;
+                op.reads = {A, B};
+                op.writes = {C};
+                
+                // Split-K partitions each take a core and write a partial sum
+                op.cores = op_plans.at(node.get()).split;
+                for (int p = 1; p < op.cores; p++) {
+                    op.writes.push_back(partialName(C, p));
+                }
+                // Streamed operations share one set of transfer buffers
+                op.exclusive = streamed.count(A) || streamed.count(C);
+                ops.push_back(node.get());
+                access.push_back(op);
+            }
+        }
+    }
+}
+
+int CodeGen::memoryCapacity() const {
+    return Target::totalBytes(target) - target.reserved_bytes;
+}
+
+void CodeGen::planBankConflicts(const vector<Fragment>& fragments) {
+    // An operation streams its operands and its result through one core in
+    // lockstep, so in one bank they would conflict on every access
+    for (const auto& [node, plan] : op_plans) {
+        vector<string> operands = {plan.nest.A, plan.nest.B};
+        for (int p = 0; p < plan.split; p++) {
+            operands.push_back(partialName(plan.nest.C, p));
+        }
+        for (size_t x = 0; x < operands.size(); x++) {
+            for (size_t y = x + 1; y < operands.size(); y++) {
+                if (operands[x] == operands[y]) continue;
+                operand_conflicts[operands[x]][operands[y]]++;
+                operand_conflicts[operands[y]][operands[x]]++;
+            }
+        }
+    }
+    
+    // The partitions of a split-K product write their partial sums at the same time
+    for (const auto& [node, plan] : op_plans) {
+        for (int p = 0; p < plan.split; p++) {
+            for (int q = p + 1; q < plan.split; q++) {
+                bank_conflicts[partialName(plan.nest.C, p)][partialName(plan.nest.C, q)]++;
+                bank_conflicts[partialName(plan.nest.C, q)][partialName(plan.nest.C, p)]++;
             }
         }
     }
+    
+    // Operands of operations that share a wave are accessed at the same time;
+    // every such pair in one bank would serialize on its row buffer
+    for (const auto& fragment : fragments) {
+        for (const auto& pair : fragment.conflicts) {
+            size_t space = pair.find(' ');
+            string p = pair.substr(0, space);
+            string q = pair.substr(space + 1);
+            bank_conflicts[p][q]++;
+            bank_conflicts[q][p]++;
+        }
+    }
 }
 
-void CodeGen::generateMatrixMultiplyExecution(const string& matA, const string& matB,
-                                             const string& matC, vector<string>& isa) {
-    isa.push_back("# MATRIX MULTIPLICATION " + matA + " * " + matB + " -> " + matC);
+int CodeGen::placeRegion(const string& name, int bytes) {
+    int bankBytes = target.bank_bytes;
+    int banks = Target::totalBanks(target);
+    int subarray = Target::subarrayBytes(target);
+    if (bank_next.empty()) {
+        for (int b = 0; b < banks; b++) {
+            bank_next.push_back(b * bankBytes);
+        }
+        bank_next[0] += target.reserved_bytes;
+    }
+    
+    // Candidate start in bank b: row aligned (or packed into a row when
+    // smaller than one), inside one subarray when the region fits one, inside the bank when it fits one, and otherwise
+    // continuing only into untouched banks
+    auto startIn = [&](int b, int& at) {
+        if (bytes < row_bytes) {
+            // Smaller than a row: packed after the last region, never across a row boundary
+            at = (bank_next[b] + PACK_ALIGNMENT - 1) / PACK_ALIGNMENT * PACK_ALIGNMENT;
+            if (at / row_bytes != (at + bytes - 1) / row_bytes) at = (at + row_bytes - 1) / row_bytes * row_bytes;
+        } else {
+            at = (bank_next[b] + row_bytes - 1) / row_bytes * row_bytes;
+        }
+        if (bytes <= subarray && at / subarray != (at + bytes - 1) / subarray) {
+            at = (at + subarray - 1) / subarray * subarray;
+        }
+        int last = (at + bytes - 1) / bankBytes;
+        if (last >= banks || (bytes <= bankBytes && last != b)) return false;
+        for (int n = b + 1; n <= last; n++) {
+            if (bank_next[n] != n * bankBytes) return false;
+        }
+        return true;
+    };
+    
+    // Least conflict with operands already placed: first with the other
+    // operands of its own operations, then with those of concurrent ones,
+    // then the lowest bank
+    vector<pair<int, int>> cost(banks, {0, 0});
+    auto own = operand_conflicts.find(name);
+    if (own != operand_conflicts.end()) {
+        for (const auto& [other, weight] : own->second) {
+            auto bank = matrix_bank.find(other);
+            if (bank != matrix_bank.end()) cost[bank->second].first += weight;
+        }
+    }
+    auto conflicts = bank_conflicts.find(name);
+    if (conflicts != bank_conflicts.end()) {
+        for (const auto& [other, weight] : conflicts->second) {
+            auto bank = matrix_bank.find(other);
+            if (bank != matrix_bank.end()) cost[bank->second].second += weight;
+        }
+    }
+    int best = -1;
+    int bestAt = 0;
+    for (int b = 0; b < banks; b++) {
+        int at;
+        if (startIn(b, at) && (best < 0 || cost[b] < cost[best])) {
+            best = b;
+            bestAt = at;
+        }
+    }
+    if (best < 0) {
+        throw runtime_error("PIM memory overflow");
+    }
     
-    // Use the pre-programmed matrix multiplication operation from register r2
-    isa.push_back("EXE r2, " + matrix_map[matA] + ", " + matrix_map[matB] + ", " +
-                 matrix_map[matC] + ", " + to_string(matrix_size));
+    for (int n = best; n <= (bestAt + bytes - 1) / bankBytes; n++) {
+        bank_next[n] = min(bestAt + bytes, (n + 1) * bankBytes);
+    }
+    matrix_bank[name] = best;
+    return bestAt;
+}
+
+Fragment CodeGen::generateFunctionFragment(const ASTNode* funcNode) const {
+    Fragment fragment;
+    fragment.function = funcNode->value;
+    set<string> referenced;
+    fragment.log.push_back("[CodeGen] Processing function: " + funcNode->value);
+    vector<string>& isa = fragment.lines;
+    
+    // Collect operations with their read and write sets
+    vector<const ASTNode*> ops;
+    vector<Schedule::OpAccess> access;
+    collectOperations(funcNode, ops, access, &fragment.log);
+    
+    // Allocation summary, kept with the fragment for incremental relinking
+    for (const auto& op : access) {
+        referenced.insert(op.reads.begin(), op.reads.end());
+        referenced.insert(op.writes.begin(), op.writes.end());
+    }
+    fragment.matrices.assign(referenced.begin(), referenced.end());
+    
+    // A lone operation needs no scheduling
+    if (ops.size() == 1) {
+        const OpPlan& plan = op_plans.at(ops[0]);
+        fragment.log.push_back("[CodeGen] Generating multiplication: " + plan.nest.A + " * " +
+                               plan.nest.B + " -> " + plan.nest.C);
+        generateMatrixMultiplyExecution(plan, isa);
+        return fragment;
+    }
+    
+    // Independent operations run side by side on separate cores, one wave
+    // after another in dependency order
+    auto waves = Schedule::buildWaves(access, num_cores);
+    auto deps = Schedule::buildDependencies(access);
+    
+    // Every pair of operands of two operations in one wave is accessed at the
+    // same time; placement keeps such pairs in separate banks
+    for (const auto& wave : waves) {
+        for (size_t x = 0; x < wave.size(); x++) {
+            for (size_t y = x + 1; y < wave.size(); y++) {
+                const Schedule::OpAccess& first = access[wave[x]];
+                const Schedule::OpAccess& second = access[wave[y]];
+                for (const auto* a : {&first.reads, &first.writes}) {
+                    for (const auto* b : {&second.reads, &second.writes}) {
+                        for (const string& p : *a) {
+                            for (const string& q : *b) {
+                                if (p != q) fragment.conflicts.push_back(p + " " + q);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+    for (size_t w = 0; w < waves.size(); w++) {
+        const auto& wave = waves[w];
+        isa.push_back("# WAVE " + to_string(w) + " (" + to_string(wave.size()) + " operation" +
+                      (wave.size() > 1 ? "s" : "") + ")");
+        int core = 0;
+        for (size_t slot = 0; slot < wave.size(); slot++) {
+            const OpPlan& plan = op_plans.at(ops[wave[slot]]);
+            const Schedule::OpAccess& op = access[wave[slot]];
+            string cores = op.cores > 1 ? "cores " + to_string(core) + "-" + to_string(core + op.cores - 1)
+                                        : "core " + to_string(core);
+            fragment.log.push_back("[CodeGen] Generating multiplication: " + plan.nest.A + " * " +
+                                   plan.nest.B + " -> " + plan.nest.C + " (wave " + to_string(w) +
+                                   ", " + cores + ")");
+            generateMatrixMultiplyExecution(plan, isa, op.exclusive ? -1 : core);
+            core += op.cores;
+        }
+        
+        // Wait for every core in use before the next wave reuses them. Cores
+        // overlap until the next SYNC, so a wave that depends on an earlier one
+        // (or shares the transfer buffers with this one) waits as well, however
+        // few cores this wave used.
+        if (w + 1 < waves.size()) {
+            const auto& next = waves[w + 1];
+            bool waits = core > 1 || access[wave.front()].exclusive ||
+                         any_of(next.begin(), next.end(), [&](size_t op) {
+                             return !deps[op].empty() || access[op].exclusive;
+                         });
+            if (waits) isa.push_back("SYNC");
+        }
+    }
+    return fragment;
+}
+
+void CodeGen::generateMatrixMultiplyExecution(const OpPlan& plan, vector<string>& isa,
+                                              int core) const {
+    const LoopNest::MatMulNest& nest = plan.nest;
+    isa.push_back("# MATRIX MULTIPLICATION " + nest.A + " * " + nest.B + " -> " + nest.C);
+    if (nest.kind == LoopNest::SCALAR) {
+        // One element on the MAC routine, addressed inside its operands
+        auto element = [&](const string& name, int row, int col) {
+            int offset = row * layouts.at(name).pitch + col * static_cast<int>(sizeof(int));
+            return "@" + name + (offset ? "+" + to_string(offset) : "");
+        };
+        isa.push_back("# Single element " + nest.C + "[" + to_string(nest.row) + "][" +
+                      to_string(nest.col) + "]");
+        isa.push_back("EXE " + routineRegister(plan) + ", " + element(nest.A, nest.row, nest.depth) +
+                      ", " + element(nest.B, nest.depth, nest.col) + ", " +
+                      element(nest.C, nest.row, nest.col) + ", 1" +
+                      (core >= 0 ? ", c" + to_string(core) : ""));
+        return;
+    }
+    if (nest.kind != LoopNest::MATMUL) {
+        isa.push_back("# Loop nest " + nest.sourceOrder + ", " + LoopNest::kindName(nest.kind) +
+                      " on " + routineName(nest.kind));
+    } else if (!nest.sourceOrder.empty()) {
+        isa.push_back("# Loop nest " + nest.sourceOrder + ", scheduled " +
+                      LoopNest::loopOrder(plan.dataflow) + " (" +
+                      LoopNest::dataflowName(plan.dataflow) + ")");
+    }
+    
+    // Square operands keep the single-size form; otherwise pass M, N, K. Batches
+    // always pass all three and the number of products.
+    string dims = to_string(nest.M);
+    if (nest.M != nest.N || nest.N != nest.K || nest.kind == LoopNest::BATCHED) {
+        dims += ", " + to_string(nest.N) + ", " + to_string(nest.K);
+    }
+    if (nest.kind == LoopNest::BATCHED) {
+        dims += ", b" + to_string(nest.batch);
+    }
+    
+    // Use the pre-programmed routine for the form and dataflow
+    string reg = routineRegister(plan);
+    if (streamed.count(nest.A) || streamed.count(nest.C)) {
+        generateDoubleBufferedExecution(plan, reg, isa);
+        return;
+    }
+    if (plan.split > 1) {
+        generateSplitKExecution(plan, reg, isa, max(core, 0));
+        return;
+    }
+    if (core >= 0) {
+        dims += ", c" + to_string(core);
+    }
+    isa.push_back("EXE " + reg + ", @" + nest.A + ", @" + nest.B + ", @" + nest.C + ", " + dims);
+}
+
+void CodeGen::generateDoubleBufferedExecution(const OpPlan& plan, const string& reg,
+                                              vector<string>& isa) const {
+    const LoopNest::MatMulNest& nest = plan.nest;
+    int rows = tileRows(plan);
+    int tiles = (nest.M + rows - 1) / rows;
+    int elem = sizeof(int);
+    bool prefetch = streamed.count(nest.A);
+    bool drain = streamed.count(nest.C);
+    isa.push_back("# Double-buffered: " + to_string(tiles) + " tile(s) of " + to_string(rows) +
+                  " row(s), " + nest.A + " and " + nest.C + " streamed, " + nest.B + " resident");
+    
+    // Pairs of full tiles whose prefetch is full too repeat with a fixed stride,
+    // so they become one LOOP unrolled by two for the ping-pong buffers; the
+    // remaining tiles are emitted one by one
+    int full = nest.M / rows;
+    int pairs = prefetch ? (full - 1) / 2 : full / 2;
+    if (pairs < 2) pairs = 0;
+    bool inLoop = false;
+    
+    // Byte offset of a tile; inside the loop tiles count from the start of the pair
+    auto offset = [&](int tile, int tileBytes) {
+        string text = "+" + to_string(tile * tileBytes);
+        if (inLoop) text += "+t*" + to_string(2 * tileBytes);
+        return text;
+    };
+    auto tileRowCount = [&](int tile) {
+        return inLoop ? rows : min(rows, nest.M - tile * rows);
+    };
+    // A vector is stored as one row, so each of its logical rows is one element
+    auto rowPitch = [&](const string& name) {
+        const Layout::MatrixLayout& layout = layouts.at(name);
+        return layout.rows == 1 ? elem : layout.pitch;
+    };
+    auto tileShape = [&](int tile, int cols) {
+        return to_string(tileRowCount(tile)) + ", " + to_string(cols * elem);
+    };
+    
+    auto emitTile = [&](int tile) {
+        string cur = to_string(tile % 2);
+        
+        // Prefetch tile i+1 into the other buffer while tile i computes
+        if (prefetch && (inLoop || tile + 1 < tiles)) {
+            isa.push_back("LOAD @in." + to_string((tile + 1) % 2) + ", " + nest.A +
+                          offset(tile + 1, rows * nest.K * elem) + ", " + tileShape(tile + 1, nest.K));
+        }
+        
+        // Resident A or C is addressed at the tile's row offset
+        string a = prefetch ? "@in." + cur : "@" + nest.A + offset(tile, rows * rowPitch(nest.A));
+        string c = drain ? "@out." + cur : "@" + nest.C + offset(tile, rows * rowPitch(nest.C));
+        isa.push_back("EXE " + reg + ", " + a + ", @" + nest.B + ", " + c + ", " +
+                      to_string(tileRowCount(tile)) + ", " + to_string(nest.N) + ", " + to_string(nest.K));
+        isa.push_back("SYNC");
+        
+        // Drain the finished tile; it overlaps the next tile's compute
+        if (drain) {
+            isa.push_back("STORE " + nest.C + offset(tile, rows * nest.N * elem) + ", @out." + cur +
+                          ", " + tileShape(tile, nest.N));
+        }
+    };
+    
+    // Prime the first buffer
+    if (prefetch) {
+        isa.push_back("LOAD @in.0, " + nest.A + offset(0, 0) + ", " + tileShape(0, nest.K));
+        isa.push_back("SYNC");
+    }
+    
+    if (pairs > 0) {
+        isa.push_back("LOOP t, " + to_string(pairs));
+        inLoop = true;
+        emitTile(0);
+        emitTile(1);
+        inLoop = false;
+        isa.push_back("ENDLOOP t");
+    }
+    for (int tile = 2 * pairs; tile < tiles; tile++) {
+        emitTile(tile);
+    }
+    if (drain) {
+        isa.push_back("SYNC");
+    }
+}
+
+void CodeGen::generateSplitKExecution(const OpPlan& plan, const string& reg,
+                                      vector<string>& isa, int core) const {
+    const LoopNest::MatMulNest& nest = plan.nest;
+    int depth = (nest.K + plan.split - 1) / plan.split;
+    int levels = 0;
+    while ((1 << levels) < plan.split) levels++;
+    isa.push_back("# Split-K: " + to_string(plan.split) + " partitions of " + to_string(depth) +
+                  " along K on cores " + to_string(core) + "-" + to_string(core + plan.split - 1) +
+                  ", merged by " + to_string(levels) + " level(s) of matrix_add");
+    
+    // Byte offset of reduction index k inside A (along a row) and B (down a column)
+    int elem = sizeof(int);
+    auto kOffset = [&](const string& name, bool alongRow, int k) {
+        const Layout::MatrixLayout& layout = layouts.at(name);
+        bool contiguous = alongRow == (layout.kind == Layout::ROW_MAJOR);
+        int offset = k * (contiguous ? elem : layout.pitch);
+        return "@" + name + (offset ? "+" + to_string(offset) : "");
+    };
+    
+    // Every partition writes its own partial sum of C
+    for (int p = 0; p < plan.split; p++) {
+        int k = p * depth;
+        isa.push_back("EXE " + reg + ", " + kOffset(nest.A, true, k) + ", " + kOffset(nest.B, false, k) +
+                      ", @" + partialName(nest.C, p) + ", " + to_string(nest.M) + ", " +
+                      to_string(nest.N) + ", " + to_string(min(depth, nest.K - k)) + ", c" +
+                      to_string(core + p));
+    }
+    
+    // Pairwise tree: at each level partition p absorbs partition p + stride on
+    // its own core, leaving the full sum in C
+    string shape = to_string(nest.M) + ", " + to_string(nest.N);
+    for (int stride = 1; stride < plan.split; stride *= 2) {
+        isa.push_back("SYNC");
+        for (int p = 0; p + stride < plan.split; p += 2 * stride) {
+            string sum = "@" + partialName(nest.C, p);
+            isa.push_back("EXE r6, " + sum + ", @" + partialName(nest.C, p + stride) + ", " + sum +
+                          ", " + shape + ", c" + to_string(core + p));
+        }
+    }
 }
 
 string CodeGen::allocateMatrix(const string& name) {
@@ -192,16 +1513,16 @@ string CodeGen::allocateMatrix(const string& name) {
         return matrix_map[name];
     }
     
-    size_t size_needed = matrix_size * matrix_size * sizeof(int);
-    if (current_address + size_needed > 0xFFFF) {
-        throw runtime_error("PIM memory overflow");
+    // Operands outside any operation keep a square row-major layout
+    if (layouts.find(name) == layouts.end()) {
+        layouts[name] = Layout::make(Layout::ROW_MAJOR, matrix_size, matrix_size, row_bytes);
     }
     
-    // Format address with proper hex
-    stringstream ss;
-    ss << "0x" << hex << setw(4) << setfill('0') << current_address;
-    matrix_map[name] = ss.str();
-    current_address += size_needed;
+    // Every matrix of a row or more starts on a device row boundary, in the
+    // bank that keeps it apart from operands of concurrent operations
+    int address = placeRegion(name, layouts[name].bytes);
+    matrix_map[name] = formatAddress(address);
+    allocation_order.push_back(name);
     
     return matrix_map[name];
 }
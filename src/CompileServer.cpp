@@ -0,0 +1,142 @@
+#include "CompileServer.h"
+#include "Driver.h"
+#include "Protocol.h"
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace CompileServer {
+
+// Responses kept for repeated requests; the cache starts over when full
+static const size_t RESPONSE_CACHE_ENTRIES = 256;
+
+// Requests are served one at a time, so a client that stops sending or
+// reading is dropped after this long instead of stalling every other client
+static const int CLIENT_TIMEOUT_SECONDS = 5;
+
+static volatile sig_atomic_t stopping = 0;
+
+static void requestStop(int) {
+    stopping = 1;
+}
+
+// Everything the response depends on: the source, the command line and the
+// target description, which may change between requests
+static string requestKey(const Protocol::Request& request, const Driver::Options& options) {
+    string key = request.source;
+    for (const auto& arg : request.args) {
+        key += '\0' + arg;
+    }
+    if (!options.targetFile.empty()) {
+        ifstream target(options.targetFile);
+        key += '\0' + string(istreambuf_iterator<char>(target), istreambuf_iterator<char>());
+    }
+    return key;
+}
+
+static void handle(int client, Driver::Session& session, unordered_map<string, string>& responses) {
+    Protocol::Request request;
+    if (!Protocol::readRequest(client, request)) {
+        cerr << "[Server] Ignoring malformed or timed-out request" << endl;
+        return;
+    }
+    auto start = chrono::steady_clock::now();
+    
+    Protocol::Response response;
+    Driver::Options options;
+    options.verbose = false;
+    bool cached = false;
+    if (!Driver::parseArguments(request.args, options, response.text)) {
+        response.text = "Invalid arguments: " + response.text;
+    } else if (options.devices > 1) {
+        // A response carries one file; device programs and the plan are several
+        response.text = "Multi-device compiles (--devices) are not served; run the compiler directly";
+    } else {
+        // Autotuned compiles read and extend the tuning database, so they always run
+        string key = options.codegen.autotune ? "" : requestKey(request, options);
+        auto hit = key.empty() ? responses.end() : responses.find(key);
+        if (hit != responses.end()) {
+            response.text = hit->second;
+            response.ok = true;
+            cached = true;
+        } else {
+            // Compiler logging is dropped while serving
+            streambuf* log = cout.rdbuf(nullptr);
+            try {
+                response.text = Driver::compile(request.source, options, session);
+                response.ok = true;
+            } catch (const exception& e) {
+                response.text = e.what();
+            }
+            cout.rdbuf(log);
+            
+            if (response.ok && !key.empty()) {
+                if (responses.size() >= RESPONSE_CACHE_ENTRIES) responses.clear();
+                responses[key] = response.text;
+            }
+        }
+    }
+    
+    try {
+        Protocol::writeResponse(client, response);
+    } catch (const exception& e) {
+        cerr << "[Server] " << e.what() << endl;
+    }
+    
+    auto elapsed = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start);
+    cout << "[Server] " << options.input << " -> " << options.output << ": "
+         << (response.ok ? "ok" : "error") << (cached ? " (cached)" : "") << " in "
+         << elapsed.count() << "us" << endl;
+}
+
+int serve(const string& socketPath) {
+    int listener = Protocol::listen(socketPath);
+    
+    // No SA_RESTART, so a signal interrupts accept and the loop can stop
+    struct sigaction action {};
+    action.sa_handler = requestStop;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    cout << "[Server] Listening on " << socketPath << endl;
+    
+    Driver::Session session;
+    session.persistent = false;
+    unordered_map<string, string> responses;
+    size_t served = 0;
+    while (!stopping) {
+        int client = accept(listener, nullptr, nullptr);
+        if (client < 0) {
+            if (errno == EINTR) continue;
+            cerr << "[Server] accept failed: " << strerror(errno) << endl;
+            break;
+        }
+        struct timeval timeout {};
+        timeout.tv_sec = CLIENT_TIMEOUT_SECONDS;
+        if (setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) != 0 ||
+            setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) != 0) {
+            cerr << "[Server] Could not set client timeouts: " << strerror(errno) << endl;
+            close(client);
+            continue;
+        }
+        handle(client, session, responses);
+        close(client);
+        served++;
+    }
+    
+    close(listener);
+    unlink(socketPath.c_str());
+    cout << "[Server] Stopped after " << served << " request(s)" << endl;
+    return 0;
+}
+
+}
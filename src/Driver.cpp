@@ -0,0 +1,303 @@
+#include "Driver.h"
+#include "Lexer.h"
+#include "Parser.h"
+#include "Partition.h"
+#include "ProgramTemplate.h"
+#include "Target.h"
+#include "TargetBackend.h"
+#include <algorithm>
+#include <charconv>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
+
+using namespace std;
+
+namespace Driver {
+
+static void printAST(const ASTNode* node, int depth = 0) {
+    string indent(depth * 2, ' ');
+    cout << indent << "Type: " << node->type << ", Value: " << node->value;
+    if (node->line > 0) cout << " (Line: " << node->line << ")";
+    cout << endl;
+    
+    for (const auto& child : node->children) {
+        printAST(child.get(), depth + 1);
+    }
+}
+
+bool parseArguments(const vector<string>& args, Options& options, string& error) {
+    if (args.size() < 3 || args[1] != "-o") {
+        error = "expected <input.cpp> -o <output.isa>";
+        return false;
+    }
+    options.input = args[0];
+    options.output = args[2];
+    
+    for (size_t i = 3; i < args.size(); i++) {
+        const string& arg = args[i];
+        bool hasValue = i + 1 < args.size();
+        if (arg == "--double-buffer") {
+            options.codegen.double_buffer = true;
+        } else if ((arg == "-j" || arg == "--jobs") && hasValue) {
+            options.codegen.jobs = max(1, atoi(args[++i].c_str()));
+        } else if (arg == "--incremental") {
+            options.incremental = true;
+        } else if (arg == "--target" && hasValue) {
+            options.targetFile = args[++i];
+        } else if (arg == "--autotune") {
+            options.codegen.autotune = true;
+        } else if (arg == "--tuning-db" && hasValue) {
+            options.tuningFile = args[++i];
+            options.codegen.autotune = true;
+        } else if (arg == "--resident") {
+            options.codegen.weight_resident = true;
+        } else if (arg == "--devices" && hasValue) {
+            options.devices = atoi(args[++i].c_str());
+            if (options.devices < 1) {
+                error = "expected a positive device count, got: " + args[i];
+                return false;
+            }
+        } else if (arg == "--partition" && hasValue) {
+            if (!Partition::parseAxis(args[++i], options.partition)) {
+                error = "expected --partition rows, columns, k or auto, got: " + args[i];
+                return false;
+            }
+        } else if (arg == "--template") {
+            options.writeTemplate = true;
+        } else if (arg.rfind("-D", 0) == 0) {
+            // -D NAME=value or -DNAME=value
+            string define = arg.size() > 2 ? arg.substr(2) : (hasValue ? args[++i] : "");
+            size_t eq = define.find('=');
+            int value = 0;
+            const char* end = define.data() + define.size();
+            if (eq == string::npos || eq == 0 || eq + 1 == define.size() ||
+                from_chars(define.data() + eq + 1, end, value).ptr != end) {
+                error = "expected -D NAME=value, got: " + define;
+                return false;
+            }
+            if (value <= 0) {
+                error = "expected a positive size in -D " + define;
+                return false;
+            }
+            options.overrides[define.substr(0, eq)] = value;
+        } else {
+            error = "unknown option: " + arg;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Source text or a program template to the AST, with the -D overrides applied
+static unique_ptr<ASTNode> frontEnd(const string& source, const Options& options,
+                                    unordered_map<string, int>& defines) {
+    unique_ptr<ASTNode> ast;
+    if (ProgramTemplate::isTemplate(source)) {
+        // A template already holds the parsed program with symbolic sizes,
+        // so instantiating it skips straight to code generation
+        if (options.verbose) cout << "\n=== Template ===\n";
+        auto program = ProgramTemplate::deserialize(source);
+        ast = std::move(program.ast);
+        defines = std::move(program.defines);
+        cout << "Loaded template with " << ast->children.size() << " top-level nodes\n";
+    } else {
+        if (options.verbose) cout << "\n=== Lexer ===\n";
+        Lexer lexer(source);
+        auto tokens = lexer.tokenize();
+        cout << "Generated " << tokens.size() << " tokens\n";
+        cout << "Detected matrix size: " << lexer.getMatrixSize() << "x" << lexer.getMatrixSize() << endl;
+        
+        if (options.verbose) cout << "\n=== Parser ===\n";
+        Parser parser(tokens);
+        ast = parser.parse();
+        defines = lexer.getDefines();
+        cout << "AST built with " << ast->children.size() << " top-level nodes\n";
+        
+        // Print detailed AST info for debugging
+        if (options.verbose) {
+            cout << "\nAST Structure:\n";
+            printAST(ast.get());
+        }
+    }
+    
+    for (const auto& [name, value] : options.overrides) {
+        if (!defines.count(name)) {
+            throw runtime_error("-D " + name + ": the program has no #define " + name);
+        }
+        cout << "Define " << name << " = " << value << endl;
+        defines[name] = value;
+    }
+    return ast;
+}
+
+static unique_ptr<ASTNode> cloneAST(const ASTNode* node) {
+    auto copy = make_unique<ASTNode>();
+    copy->type = node->type;
+    copy->value = node->value;
+    copy->line = node->line;
+    copy->fingerprint = node->fingerprint;
+    for (const auto& child : node->children) {
+        copy->children.push_back(cloneAST(child.get()));
+    }
+    return copy;
+}
+
+// Generate and verify the program of one device, or of the whole program;
+// caches are keyed by the program's output path
+static vector<string> backEnd(unique_ptr<ASTNode> ast, const unordered_map<string, int>& defines,
+                              const Options& options, const CodeGenOptions& codegenOptions,
+                              const string& output, Session& session) {
+    int matrixSize = Lexer::matrixSize(defines);
+    if (options.verbose) cout << "\n=== Code Generation ===\n";
+    CodeGen codegen(std::move(ast), matrixSize, defines);
+    codegen.setOptions(codegenOptions);
+    if (!options.targetFile.empty()) {
+        codegen.setTarget(Target::load(options.targetFile));
+    }
+    
+    // Caches are read from disk on first use. Tuned configurations persist
+    // across compiles, keyed by shape and target.
+    Autotune::Database* tuning = nullptr;
+    size_t tuned = 0;
+    if (options.codegen.autotune) {
+        bool loaded = session.tuning.count(options.tuningFile);
+        tuning = &session.tuning[options.tuningFile];
+        if (!loaded && tuning->load(options.tuningFile)) {
+            cout << "Loaded " << tuning->size() << " tuning results from " << options.tuningFile << endl;
+        }
+        tuned = tuning->size();
+        codegen.setTuningDatabase(tuning);
+    }
+    
+    // Fragments of unchanged functions are reused from the previous build
+    FragmentCache* cache = nullptr;
+    string cachePath = output + ".cache";
+    if (options.incremental) {
+        bool loaded = session.fragments.count(cachePath);
+        cache = &session.fragments[cachePath];
+        if (!loaded && cache->load(cachePath)) {
+            cout << "Loaded " << cache->size() << " cached fragments from " << cachePath << endl;
+        }
+        codegen.setFragmentCache(cache);
+    }
+    auto isa = codegen.generatePIM_ISA();
+    cout << "Generated " << isa.size() << " ISA instructions\n";
+    if (cache && session.persistent) {
+        cache->save(cachePath);
+    }
+    if (tuning && (session.persistent || tuning->size() != tuned)) {
+        tuning->save(options.tuningFile);
+    }
+    
+    // Verify the generated ISA; a bad address would otherwise only show up
+    // as corrupted results on the device
+    auto problems = TargetBackend::verifyISA(isa);
+    if (!problems.empty()) {
+        string message = "Generated ISA failed verification";
+        for (const auto& problem : problems) {
+            message += "\n  line " + to_string(problem.line) + ": " + problem.message;
+        }
+        throw runtime_error(message);
+    }
+    return isa;
+}
+
+string compile(const string& source, const Options& options, Session& session) {
+    unordered_map<string, int> defines;
+    auto ast = frontEnd(source, options, defines);
+    if (options.writeTemplate) {
+        return ProgramTemplate::serialize(ast.get(), defines);
+    }
+    return TargetBackend::formatISA(backEnd(std::move(ast), defines, options, options.codegen,
+                                            options.output, session));
+}
+
+static string devicePath(const string& output, int device) {
+    filesystem::path path(output);
+    string extension = path.extension().string();
+    return path.replace_extension(".dev" + to_string(device) + extension).string();
+}
+
+static string planPath(const string& output) {
+    return filesystem::path(output).replace_extension(".plan").string();
+}
+
+vector<Output> compileDevices(const string& source, const Options& options, Session& session,
+                              Partition::Plan* chosen) {
+    unordered_map<string, int> defines;
+    auto ast = frontEnd(source, options, defines);
+    if (options.writeTemplate) {
+        return {{options.output, ProgramTemplate::serialize(ast.get(), defines)}};
+    }
+    
+    auto ops = Partition::operations(ast.get(), defines, Lexer::matrixSize(defines));
+    
+    // Every device runs the same program on its own slice. An axis whose slices
+    // do not fit a device gives way to the next cheapest one.
+    Partition::Plan plan;
+    vector<Output> outputs;
+    string failures;
+    for (auto& candidate : Partition::candidates(ops, options.partition, options.devices)) {
+        cout << "[Partition] Dividing " << ops.size() << " product(s) along "
+             << Partition::axisName(candidate.axis) << " across " << candidate.devices << " devices" << endl;
+        outputs = {{planPath(options.output), ""}};
+        try {
+            for (int device = 0; device < candidate.devices; device++) {
+                CodeGenOptions codegenOptions = options.codegen;
+                codegenOptions.slice = {candidate.axis, device, candidate.devices};
+                string path = devicePath(options.output, device);
+                vector<string> isa;
+                try {
+                    isa = backEnd(cloneAST(ast.get()), defines, options, codegenOptions, path, session);
+                } catch (const exception& e) {
+                    throw runtime_error("device " + to_string(device) + ": " + e.what());
+                }
+                candidate.programs.push_back(filesystem::path(path).filename().string());
+                candidate.deviceCycles.push_back(TargetBackend::measureISA(isa).cycles);
+                outputs.push_back({path, TargetBackend::formatISA(isa)});
+            }
+        } catch (const exception& e) {
+            failures += string("\n  along ") + Partition::axisName(candidate.axis) + ", " + e.what();
+            continue;
+        }
+        plan = std::move(candidate);
+        break;
+    }
+    if (plan.programs.empty()) {
+        throw runtime_error("No partition across " + to_string(options.devices) + " devices fits:" + failures);
+    }
+    
+    // The whole program on one device, with its own transfers, for the speedup
+    // estimate; a program too large for one device is what partitioning is for.
+    // Compiler logging is dropped meanwhile.
+    streambuf* log = cout.rdbuf(nullptr);
+    string failure;
+    try {
+        Options single = options;
+        single.verbose = false;
+        single.incremental = false;
+        auto isa = backEnd(std::move(ast), defines, single, options.codegen, options.output, session);
+        Partition::Plan whole;
+        string reason;
+        Partition::plan(ops, Partition::ROWS, 1, whole, reason);
+        whole.deviceCycles.push_back(TargetBackend::measureISA(isa).cycles);
+        plan.singleCycles = Partition::totalCycles(whole);
+    } catch (const exception& e) {
+        failure = e.what();
+    }
+    cout.rdbuf(log);
+    if (!failure.empty()) {
+        cout << "[Partition] The whole program does not fit one device: "
+             << failure.substr(0, failure.find('\n')) << endl;
+    }
+    cout << "[Partition] Estimated " << Partition::totalCycles(plan) << " cycles across " << plan.devices
+         << " devices" << endl;
+    
+    outputs[0].text = Partition::format(plan);
+    if (chosen) *chosen = plan;
+    return outputs;
+}
+
+}
@@ -0,0 +1,198 @@
+#include "FragmentCache.h"
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_set>
+
+using namespace std;
+
+// Cache file layout, up to two records per function:
+//   PLAN <name> <fingerprint> <nests> <log>
+// followed by one line per loop nest and the log lines, and
+//   FUNCTION <name> <fingerprint> <matrices> <lines> <log> <conflicts>
+// followed by that many matrix names, instruction lines, log lines and
+// conflicting operand pairs
+static const char* CACHE_HEADER = "PIMCACHE 2";
+
+// Nest fields separated by spaces; "-" stands for an empty name
+static string nestLine(const LoopNest::MatMulNest& nest) {
+    auto field = [](const string& text) { return text.empty() ? string("-") : text; };
+    ostringstream line;
+    line << field(nest.A) << " " << field(nest.B) << " " << field(nest.C) << " " << field(nest.i)
+         << " " << field(nest.j) << " " << field(nest.k) << " " << field(nest.sourceOrder) << " "
+         << nest.M << " " << nest.N << " " << nest.K << " " << nest.kind << " " << field(nest.b)
+         << " " << nest.batch << " " << nest.row << " " << nest.col << " " << nest.depth;
+    return line.str();
+}
+
+static bool parseNest(const string& text, LoopNest::MatMulNest& nest) {
+    istringstream line(text);
+    int kind = 0;
+    if (!(line >> nest.A >> nest.B >> nest.C >> nest.i >> nest.j >> nest.k >> nest.sourceOrder >>
+          nest.M >> nest.N >> nest.K >> kind >> nest.b >> nest.batch >> nest.row >> nest.col >>
+          nest.depth)) {
+        return false;
+    }
+    nest.kind = static_cast<LoopNest::Kind>(kind);
+    for (string* name : {&nest.A, &nest.B, &nest.C, &nest.i, &nest.j, &nest.k, &nest.sourceOrder, &nest.b}) {
+        if (*name == "-") name->clear();
+    }
+    return true;
+}
+
+uint64_t FragmentCache::hash(const string& text, uint64_t seed) {
+    uint64_t value = seed;
+    for (unsigned char c : text) {
+        value ^= c;
+        value *= 1099511628211ULL;
+    }
+    return value;
+}
+
+bool FragmentCache::load(const string& path) {
+    ifstream input(path);
+    if (!input.is_open()) {
+        return false;
+    }
+    
+    string line;
+    if (!getline(input, line) || line != CACHE_HEADER) {
+        cerr << "Warning: ignoring incompatible fragment cache " << path << endl;
+        return false;
+    }
+    
+    entries.clear();
+    plans.clear();
+    auto corrupt = [&](const char* problem) {
+        cerr << "Warning: fragment cache " << path << " is " << problem << ", rebuilding" << endl;
+        entries.clear();
+        plans.clear();
+        return false;
+    };
+    auto readLines = [&](size_t count, vector<string>& into) {
+        for (size_t i = 0; i < count && getline(input, line); i++) {
+            into.push_back(line);
+        }
+        return into.size() == count;
+    };
+    while (getline(input, line)) {
+        istringstream header(line);
+        string tag;
+        if (!(header >> tag)) return corrupt("corrupt");
+        
+        if (tag == "PLAN") {
+            PlanEntry entry;
+            size_t nests = 0, logs = 0;
+            if (!(header >> entry.plan.function >> hex >> entry.fingerprint >> dec >> nests >> logs)) {
+                return corrupt("corrupt");
+            }
+            vector<string> nestLines;
+            if (!readLines(nests, nestLines) || !readLines(logs, entry.plan.log)) {
+                return corrupt("truncated");
+            }
+            for (const auto& text : nestLines) {
+                LoopNest::MatMulNest nest;
+                if (!parseNest(text, nest)) return corrupt("corrupt");
+                entry.plan.nests.push_back(nest);
+            }
+            plans[entry.plan.function] = std::move(entry);
+            continue;
+        }
+        
+        Entry entry;
+        size_t matrices = 0, lines = 0, logs = 0, conflicts = 0;
+        if (tag != "FUNCTION" || !(header >> entry.fragment.function >> hex >> entry.fingerprint >> dec
+                                          >> matrices >> lines >> logs >> conflicts)) {
+            return corrupt("corrupt");
+        }
+        if (!readLines(matrices, entry.fragment.matrices) ||
+            !readLines(lines, entry.fragment.lines) ||
+            !readLines(logs, entry.fragment.log) ||
+            !readLines(conflicts, entry.fragment.conflicts)) {
+            return corrupt("truncated");
+        }
+        entries[entry.fragment.function] = std::move(entry);
+    }
+    return true;
+}
+
+void FragmentCache::save(const string& path) const {
+    ofstream output(path);
+    if (!output.is_open()) {
+        throw runtime_error("Could not write fragment cache: " + path);
+    }
+    
+    // Sorted by name so the side file itself is deterministic
+    map<string, pair<const PlanEntry*, const Entry*>> ordered;
+    for (const auto& [name, entry] : plans) {
+        ordered[name].first = &entry;
+    }
+    for (const auto& [name, entry] : entries) {
+        ordered[name].second = &entry;
+    }
+    
+    output << CACHE_HEADER << "\n";
+    for (const auto& [name, records] : ordered) {
+        if (const PlanEntry* entry = records.first) {
+            const FunctionPlan& plan = entry->plan;
+            output << "PLAN " << name << " " << hex << entry->fingerprint << dec << " "
+                   << plan.nests.size() << " " << plan.log.size() << "\n";
+            for (const auto& nest : plan.nests) output << nestLine(nest) << "\n";
+            for (const auto& text : plan.log) output << text << "\n";
+        }
+        if (const Entry* entry = records.second) {
+            const Fragment& fragment = entry->fragment;
+            output << "FUNCTION " << name << " " << hex << entry->fingerprint << dec << " "
+                   << fragment.matrices.size() << " " << fragment.lines.size() << " "
+                   << fragment.log.size() << " " << fragment.conflicts.size() << "\n";
+            for (const auto& text : fragment.matrices) output << text << "\n";
+            for (const auto& text : fragment.lines) output << text << "\n";
+            for (const auto& text : fragment.log) output << text << "\n";
+            for (const auto& text : fragment.conflicts) output << text << "\n";
+        }
+    }
+}
+
+const Fragment* FragmentCache::lookup(const string& function, uint64_t fingerprint) const {
+    auto it = entries.find(function);
+    if (it == entries.end() || it->second.fingerprint != fingerprint) {
+        return nullptr;
+    }
+    return &it->second.fragment;
+}
+
+void FragmentCache::store(const Fragment& fragment, uint64_t fingerprint) {
+    entries[fragment.function] = Entry{fingerprint, fragment};
+}
+
+const FunctionPlan* FragmentCache::lookupPlan(const string& function, uint64_t fingerprint) const {
+    auto it = plans.find(function);
+    if (it == plans.end() || it->second.fingerprint != fingerprint) {
+        return nullptr;
+    }
+    return &it->second.plan;
+}
+
+void FragmentCache::storePlan(const FunctionPlan& plan, uint64_t fingerprint) {
+    plans[plan.function] = PlanEntry{fingerprint, plan};
+}
+
+void FragmentCache::retain(const vector<string>& functions) {
+    unordered_set<string> live(functions.begin(), functions.end());
+    for (auto it = entries.begin(); it != entries.end();) {
+        if (live.count(it->first)) {
+            ++it;
+        } else {
+            it = entries.erase(it);
+        }
+    }
+    for (auto it = plans.begin(); it != plans.end();) {
+        if (live.count(it->first)) {
+            ++it;
+        } else {
+            it = plans.erase(it);
+        }
+    }
+}
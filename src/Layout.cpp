@@ -0,0 +1,195 @@
+#include "Layout.h"
+#include <algorithm>
+#include <map>
+
+using namespace std;
+
+namespace Layout {
+
+static const int ELEMENT_BYTES = sizeof(int);
+
+static int roundUp(int value, int multiple) {
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+static int nextPowerOfTwo(int value) {
+    int power = 1;
+    while (power < value) power <<= 1;
+    return power;
+}
+
+// Matrices of a device row or more take whole rows; smaller ones keep their
+// size so the allocator can pack several into one row
+static int storageBytes(int bytes, int rowBytes) {
+    return bytes >= rowBytes ? roundUp(bytes, rowBytes) : bytes;
+}
+
+MatrixLayout make(Kind kind, int rows, int cols, int rowBytes) {
+    MatrixLayout layout;
+    layout.kind = kind;
+    layout.rows = rows;
+    layout.cols = cols;
+    
+    if (kind == BLOCKED) {
+        // Largest square tile that fits one device row, no larger than the matrix
+        int tile = 1;
+        while ((tile * 2) * (tile * 2) * ELEMENT_BYTES <= rowBytes) tile *= 2;
+        layout.tile = min(tile, nextPowerOfTwo(max(rows, cols)));
+        layout.pitch = layout.tile * ELEMENT_BYTES;
+        
+        int tileBytes = layout.tile * layout.tile * ELEMENT_BYTES;
+        int tiles = ((rows + layout.tile - 1) / layout.tile) * ((cols + layout.tile - 1) / layout.tile);
+        layout.bytes = storageBytes(tiles * tileBytes, rowBytes);
+        return layout;
+    }
+    
+    // A transposed matrix stores each logical column as a row
+    int storedRows = kind == TRANSPOSED ? cols : rows;
+    int storedCols = kind == TRANSPOSED ? rows : cols;
+    int rowLength = storedCols * ELEMENT_BYTES;
+    layout.pitch = rowLength <= rowBytes ? nextPowerOfTwo(rowLength) : roundUp(rowLength, rowBytes);
+    layout.bytes = storageBytes(storedRows * layout.pitch, rowBytes);
+    return layout;
+}
+
+double walkStride(const MatrixLayout& layout, bool alongRow, int rowBytes) {
+    switch (layout.kind) {
+        case TRANSPOSED:
+            return alongRow ? layout.pitch : ELEMENT_BYTES;
+        case BLOCKED:
+            // Either walk leaves its device row once every tile edge
+            return static_cast<double>(rowBytes) / layout.tile;
+        default:
+            return alongRow ? ELEMENT_BYTES : layout.pitch;
+    }
+}
+
+LoopNest::WalkStrides strides(const LoopNest::MatMulNest& nest,
+                              const unordered_map<string, MatrixLayout>& layouts,
+                              int rowBytes) {
+    LoopNest::WalkStrides result = LoopNest::rowMajorStrides(nest);
+    
+    auto a = layouts.find(nest.A);
+    if (a != layouts.end()) {
+        result.aRow = walkStride(a->second, true, rowBytes);
+        result.aColumn = walkStride(a->second, false, rowBytes);
+    }
+    auto b = layouts.find(nest.B);
+    if (b != layouts.end()) {
+        result.bRow = walkStride(b->second, true, rowBytes);
+        result.bColumn = walkStride(b->second, false, rowBytes);
+    }
+    auto c = layouts.find(nest.C);
+    if (c != layouts.end()) {
+        result.cRow = walkStride(c->second, true, rowBytes);
+    }
+    return result;
+}
+
+// Cost of converting between host row-major order and the stored layout:
+// one contiguous pass and one pass with the layout's column stride
+static double transformCost(const MatrixLayout& layout, int rowBytes) {
+    if (layout.kind == ROW_MAJOR) return 0;
+    double elements = static_cast<double>(layout.rows) * layout.cols;
+    return LoopNest::streamCost(elements, ELEMENT_BYTES, rowBytes) +
+           LoopNest::streamCost(elements, walkStride(layout, false, rowBytes), rowBytes);
+}
+
+// Movement cost of one operation under the current layouts, in its cheaper dataflow
+static double nestCost(const LoopNest::MatMulNest& nest, const unordered_map<string, MatrixLayout>& layouts,
+                       int rowBytes) {
+    LoopNest::WalkStrides walk = strides(nest, layouts, rowBytes);
+    return min(LoopNest::movementCost(nest, LoopNest::OUTPUT_STATIONARY, rowBytes, walk),
+               LoopNest::movementCost(nest, LoopNest::WEIGHT_STATIONARY, rowBytes, walk));
+}
+
+unordered_map<string, MatrixLayout> select(const vector<LoopNest::MatMulNest>& nests, int rowBytes) {
+    // Shape, accesses and using operations of every matrix over the whole program
+    struct Use {
+        int rows = 0, cols = 0;
+        bool read = false, written = false;
+        bool fixed = false;      // GEMV, batched and scalar routines walk their operands in host order
+        vector<size_t> nests;    // operations touching the matrix, each once
+    };
+    map<string, Use> uses;
+    for (size_t n = 0; n < nests.size(); n++) {
+        const LoopNest::MatMulNest& nest = nests[n];
+        const string* names[] = {&nest.A, &nest.B, &nest.C};
+        for (int operand = 0; operand < 3; operand++) {
+            Use& use = uses[*names[operand]];
+            auto [rows, cols] = LoopNest::operandShape(nest, operand);
+            use.rows = max(use.rows, rows);
+            use.cols = max(use.cols, cols);
+            if (operand == 2) {
+                use.written = true;
+            } else {
+                use.read = true;
+            }
+            if (nest.kind != LoopNest::MATMUL) use.fixed = true;
+            if (use.nests.empty() || use.nests.back() != n) use.nests.push_back(n);
+        }
+    }
+    
+    unordered_map<string, MatrixLayout> layouts;
+    for (const auto& [name, use] : uses) {
+        layouts[name] = make(ROW_MAJOR, use.rows, use.cols, rowBytes);
+    }
+    
+    // Inputs are reordered once after loading, outputs once before the host reads them
+    auto transforms = [&](const Use& use, const MatrixLayout& layout) {
+        double transform = transformCost(layout, rowBytes);
+        return (use.read ? transform : 0) + (use.written ? transform : 0);
+    };
+    vector<double> costs(nests.size());
+    double best = 0;
+    for (size_t n = 0; n < nests.size(); n++) {
+        costs[n] = nestCost(nests[n], layouts, rowBytes);
+        best += costs[n];
+    }
+    for (const auto& [name, use] : uses) {
+        best += transforms(use, layouts[name]);
+    }
+    
+    // Coordinate descent, one matrix at a time in name order, until stable.
+    // A change of one layout re-costs only the operations using the matrix.
+    vector<double> updated;
+    for (int pass = 0; pass < 4; pass++) {
+        bool changed = false;
+        for (const auto& [name, use] : uses) {
+            if (use.fixed) continue;
+            MatrixLayout& layout = layouts[name];
+            for (Kind kind : {ROW_MAJOR, TRANSPOSED, BLOCKED}) {
+                if (kind == layout.kind) continue;
+                
+                MatrixLayout previous = layout;
+                layout = make(kind, use.rows, use.cols, rowBytes);
+                double delta = transforms(use, layout) - transforms(use, previous);
+                updated.clear();
+                for (size_t n : use.nests) {
+                    updated.push_back(nestCost(nests[n], layouts, rowBytes));
+                    delta += updated.back() - costs[n];
+                }
+                if (best + delta < best * 0.999) {
+                    best += delta;
+                    for (size_t u = 0; u < use.nests.size(); u++) costs[use.nests[u]] = updated[u];
+                    changed = true;
+                } else {
+                    layout = previous;
+                }
+            }
+        }
+        if (!changed) break;
+    }
+    
+    return layouts;
+}
+
+const char* kindName(Kind kind) {
+    switch (kind) {
+        case TRANSPOSED: return "COL";
+        case BLOCKED: return "BLOCK";
+        default: return "ROW";
+    }
+}
+
+}
@@ -4,6 +4,18 @@
 
 Lexer::Lexer(const std::string& src) : source(src) {}
 
+bool Lexer::isSizeDefine(const std::string& name) {
+    return name == "N" || name == "SIZE" || name == "ROWS" || name == "COLS" || name == "INNER";
+}
+
+int Lexer::matrixSize(const std::unordered_map<std::string, int>& defines) {
+    int size = 0;
+    for (const auto& [name, value] : defines) {
+        if (isSizeDefine(name)) size = std::max(size, value);
+    }
+    return size;
+}
+
 void Lexer::handlePreprocessor() {
     std::string directive;
     while (index < source.size() && std::isalpha(source[index])) {
@@ -24,7 +36,7 @@ void Lexer::parseMatrixSize() {
     }
     
     // Only track matrix size definitions
-    if (ident == "N" || ident == "SIZE" || ident == "ROWS" || ident == "COLS" || ident == "INNER") {
+    if (isSizeDefine(ident)) {
         while (index < source.size() && !std::isdigit(source[index])) index++;
         
         std::string num;
@@ -34,6 +46,21 @@ void Lexer::parseMatrixSize() {
         
         if (!num.empty()) {
             matrix_size = std::max(matrix_size, std::stoi(num));
+            defines[ident] = std::stoi(num);
+        }
+    } else if (!ident.empty()) {
+        // Record other integer constants so loop bounds can be resolved later
+        size_t probe = index;
+        while (probe < source.size() && (source[probe] == ' ' || source[probe] == '\t')) probe++;
+        
+        std::string num;
+        while (probe < source.size() && std::isdigit(source[probe])) {
+            num += source[probe++];
+        }
+        
+        if (!num.empty()) {
+            defines[ident] = std::stoi(num);
+            index = probe;
         }
     }
 }
@@ -57,7 +84,21 @@ std::vector<Token> Lexer::tokenize() {
             continue;
         }
         
-        // In Lexer.cpp, modify the identifier handling section:
+        // Comments never carry matrix operations
+        if (c == '/' && index + 1 < source.size() && source[index + 1] == '/') {
+            while (index < source.size() && source[index] != '\n') index++;
+            continue;
+        }
+        if (c == '/' && index + 1 < source.size() && source[index + 1] == '*') {
+            index += 2;
+            while (index + 1 < source.size() && !(source[index] == '*' && source[index + 1] == '/')) {
+                if (source[index] == '\n') current_line++;
+                index++;
+            }
+            index = std::min(index + 2, source.size());
+            continue;
+        }
+        
         if (std::isalpha(c) || c == '_') {
             std::string ident;
             while (index < source.size() && (std::isalnum(c) || c == '_')) {
@@ -91,16 +132,14 @@ std::vector<Token> Lexer::tokenize() {
             continue;
         }
         
-        else if (c == '[') {
-            // Skip entire array declaration [N]
-            while (index < source.size() && c != ']') {
-                c = source[++index];
-            }
-            if (c == ']') index++; // Skip closing bracket
-            continue;
-        }
-        
         if (c == '+' || c == '-' || c == '*' || c == '/' || c == '=') {
+            // Keep compound assignments and increments as single operators
+            char next = index + 1 < source.size() ? source[index + 1] : '\0';
+            if (c != '=' && (next == '=' || ((c == '+' || c == '-') && next == c))) {
+                addToken(tokens, OPERATOR, std::string(1, c) + next);
+                index += 2;
+                continue;
+            }
             addToken(tokens, OPERATOR, std::string(1, c));
             index++;
             continue;
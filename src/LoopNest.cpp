@@ -0,0 +1,226 @@
+#include "LoopNest.h"
+#include <algorithm>
+#include <cctype>
+#include <stdexcept>
+
+using namespace std;
+
+namespace LoopNest {
+
+// Cost of opening a new DRAM row relative to a row-buffer hit
+static const double ROW_MISS_PENALTY = 8.0;
+static const int ELEMENT_BYTES = sizeof(int);
+
+bool evaluateBound(const string& expr, const unordered_map<string, int>& defines, int& value) {
+    // Sum of products of numbers and #define names, e.g. "N-1+1" or "2*N"
+    long total = 0;
+    long term = 1;
+    int sign = 1;
+    size_t pos = 0;
+    bool expectOperand = true;
+    
+    while (pos < expr.size()) {
+        char c = expr[pos];
+        if (expectOperand) {
+            long operand = 0;
+            if (isdigit(c)) {
+                while (pos < expr.size() && isdigit(expr[pos])) {
+                    operand = operand * 10 + (expr[pos++] - '0');
+                }
+            } else if (isalpha(c) || c == '_') {
+                string name;
+                while (pos < expr.size() && (isalnum(expr[pos]) || expr[pos] == '_')) {
+                    name += expr[pos++];
+                }
+                auto it = defines.find(name);
+                if (it == defines.end()) return false;
+                operand = it->second;
+            } else {
+                return false;
+            }
+            term *= operand;
+            expectOperand = false;
+        } else if (c == '*') {
+            expectOperand = true;
+            pos++;
+        } else if (c == '+' || c == '-') {
+            total += sign * term;
+            sign = c == '+' ? 1 : -1;
+            term = 1;
+            expectOperand = true;
+            pos++;
+        } else {
+            return false;
+        }
+    }
+    
+    if (expectOperand) return false;
+    total += sign * term;
+    if (total <= 0) return false;
+    value = static_cast<int>(total);
+    return true;
+}
+
+static bool isConstant(const string& text) {
+    return !text.empty() && all_of(text.begin(), text.end(), [](char ch) { return isdigit(ch); });
+}
+
+bool extract(const ASTNode* op, const unordered_map<string, int>& defines,
+             int fallbackSize, MatMulNest& nest) {
+    if (op->type != MATRIX_OP_NODE || op->children.size() < 3) {
+        return false;
+    }
+    
+    const ASTNode* a = op->children[0].get();
+    const ASTNode* b = op->children[1].get();
+    const ASTNode* c = op->children[2].get();
+    auto subscript = [](const ASTNode* ref, size_t n) { return ref->children[n]->value; };
+    
+    nest.A = a->value;
+    nest.B = b->value;
+    nest.C = c->value;
+    nest.sourceOrder.clear();
+    nest.M = nest.N = nest.K = fallbackSize;
+    
+    // The operand ranks tell the forms apart; each names the loops it needs
+    string expected;
+    size_t ra = a->children.size(), rb = b->children.size(), rc = c->children.size();
+    if (ra == 2 && rb == 2 && rc == 2) {
+        nest.kind = MATMUL;
+        nest.i = subscript(c, 0);
+        nest.j = subscript(c, 1);
+        nest.k = subscript(a, 1);
+        if (isConstant(nest.i) && isConstant(nest.j) && isConstant(nest.k)) {
+            // One element; the operands span at least the declared size
+            nest.kind = SCALAR;
+            nest.row = stoi(nest.i);
+            nest.col = stoi(nest.j);
+            nest.depth = stoi(nest.k);
+            nest.M = max(fallbackSize, nest.row + 1);
+            nest.N = max(fallbackSize, nest.col + 1);
+            nest.K = max(fallbackSize, nest.depth + 1);
+            return true;
+        }
+        expected = "ijk";
+    } else if (ra == 2 && rb == 1 && rc == 1) {
+        nest.kind = GEMV;
+        nest.i = subscript(c, 0);
+        nest.k = subscript(a, 1);
+        nest.N = 1;
+        expected = "ik";
+    } else if (ra == 1 && rb == 2 && rc == 1) {
+        nest.kind = GEMV;
+        nest.j = subscript(c, 0);
+        nest.k = subscript(a, 0);
+        nest.M = 1;
+        expected = "jk";
+    } else if (ra == 3 && rb == 3 && rc == 3) {
+        nest.kind = BATCHED;
+        nest.b = subscript(c, 0);
+        nest.i = subscript(c, 1);
+        nest.j = subscript(c, 2);
+        nest.k = subscript(a, 2);
+        expected = "bijk";
+    } else {
+        return false;
+    }
+    
+    // Loop nodes follow the operands, outermost first
+    for (size_t idx = 3; idx < op->children.size(); idx++) {
+        const ASTNode* loop = op->children[idx].get();
+        if (loop->type != LOOP_NODE || loop->children.empty()) continue;
+        
+        int trip = 0;
+        const string& bound = loop->children[0]->value;
+        if (!evaluateBound(bound, defines, trip)) {
+            throw runtime_error("Line " + to_string(loop->line) + ": cannot evaluate the bound " + bound +
+                                " of loop " + loop->value + " to a positive size");
+        }
+        if (loop->value == nest.i) {
+            nest.M = trip;
+            nest.sourceOrder += 'i';
+        } else if (loop->value == nest.j) {
+            nest.N = trip;
+            nest.sourceOrder += 'j';
+        } else if (loop->value == nest.k) {
+            nest.K = trip;
+            nest.sourceOrder += 'k';
+        } else if (loop->value == nest.b) {
+            nest.batch = trip;
+            nest.sourceOrder += 'b';
+        }
+    }
+    
+    // A nest of single trips multiplies one element
+    if (nest.kind == MATMUL && nest.M == 1 && nest.N == 1 && nest.K == 1) {
+        nest.kind = SCALAR;
+    }
+    return nest.sourceOrder.size() == expected.size();
+}
+
+pair<int, int> operandShape(const MatMulNest& nest, int operand) {
+    const int rows[] = {nest.M, nest.K, nest.M};
+    const int cols[] = {nest.K, nest.N, nest.N};
+    
+    // Vectors are stored as one row, whichever way the product reads them
+    if (nest.kind == GEMV && (rows[operand] == 1 || cols[operand] == 1)) {
+        return {1, rows[operand] * cols[operand]};
+    }
+    return {rows[operand] * nest.batch, cols[operand]};
+}
+
+WalkStrides rowMajorStrides(const MatMulNest& nest) {
+    WalkStrides strides;
+    strides.aRow = strides.bRow = strides.cRow = ELEMENT_BYTES;
+    strides.aColumn = nest.K * ELEMENT_BYTES;
+    strides.bColumn = nest.N * ELEMENT_BYTES;
+    return strides;
+}
+
+double streamCost(double accesses, double strideBytes, int rowBytes) {
+    double missRate = min(1.0, strideBytes / rowBytes);
+    return accesses * (1.0 + ROW_MISS_PENALTY * missRate);
+}
+
+double movementCost(const MatMulNest& nest, Dataflow dataflow, int rowBytes,
+                    const WalkStrides& strides) {
+    double M = nest.M, N = nest.N, K = nest.K;
+    
+    if (dataflow == OUTPUT_STATIONARY) {
+        // A walks its rows, B walks its columns, C is written once
+        return streamCost(M * N * K, strides.aRow, rowBytes) +
+               streamCost(M * N * K, strides.bColumn, rowBytes) +
+               streamCost(M * N, strides.cRow, rowBytes);
+    }
+    
+    // Weight-stationary: A[i][k] read once per (k, i) down a column, the open
+    // B row is read once, and C rows are read-modify-written per k
+    return streamCost(M * K, strides.aColumn, rowBytes) +
+           streamCost(K * N, strides.bRow, rowBytes) +
+           streamCost(2 * M * N * K, strides.cRow, rowBytes);
+}
+
+Dataflow chooseDataflow(const MatMulNest& nest, int rowBytes, const WalkStrides& strides) {
+    double os = movementCost(nest, OUTPUT_STATIONARY, rowBytes, strides);
+    double ws = movementCost(nest, WEIGHT_STATIONARY, rowBytes, strides);
+    return ws < os ? WEIGHT_STATIONARY : OUTPUT_STATIONARY;
+}
+
+const char* dataflowName(Dataflow dataflow) {
+    return dataflow == OUTPUT_STATIONARY ? "output-stationary" : "weight-stationary";
+}
+
+const char* kindName(Kind kind) {
+    switch (kind) {
+        case GEMV: return "GEMV";
+        case BATCHED: return "batched";
+        case SCALAR: return "scalar";
+        default: return "matmul";
+    }
+}
+
+const char* loopOrder(Dataflow dataflow) {
+    return dataflow == OUTPUT_STATIONARY ? "ijk" : "kij";
+}
+
+}
@@ -1,7 +1,9 @@
 #include "Parser.h"
+#include "FragmentCache.h"
+#include <algorithm>
+#include <cctype>
 #include <iostream>
 #include <stdexcept>
-#include <stack>
 
 using namespace std;
 
@@ -36,27 +38,25 @@ unique_ptr<ASTNode> Parser::parse() {
         try {
             // Look for function definitions like "void multiply(...)"
             if (match(IDENTIFIER) && current().value == "void") {
+                size_t start = index;
                 advance();
-                if (match(IDENTIFIER)) {
+                if (match(IDENTIFIER) || match(MATRIX_DECL)) {
                     string funcName = current().value;
                     advance();
                     
-                    // Check if this is a matrix multiplication function
-                    if (funcName == "multiply" || funcName == "matmul" || funcName == "matrix_multiply") {
-                        auto funcNode = parseFunction();
-                        if (funcNode) {
-                            funcNode->value = funcName;
-                            program->children.push_back(std::move(funcNode));
-                        }
-                    } else {
-                        // Skip other functions
-                        skipToNextFunction();
+                    // Kernels are recognized by their loop nests rather than by name;
+                    // keep any function with matrix parameters or matrix operations
+                    auto funcNode = parseFunction();
+                    if (funcNode && !funcNode->children.empty()) {
+                        funcNode->value = funcName;
+                        funcNode->fingerprint = fingerprintTokens(start, index);
+                        kernel_params[funcName] = param_positions;
+                        program->children.push_back(std::move(funcNode));
                     }
                 }
             } else if (auto stmt = parseStatement()) {
+                // parseStatement consumes unrecognized tokens itself
                 program->children.push_back(std::move(stmt));
-            } else {
-                advance(); // Skip unrecognized tokens
             }
         } catch (const runtime_error& e) {
             cerr << "Parse error at token " << index << " ('"
@@ -68,31 +68,12 @@ unique_ptr<ASTNode> Parser::parse() {
     return program;
 }
 
-void Parser::skipToNextFunction() {
-    // Skip until we find an opening brace
-    while (index < tokens.size() && !(match(SYMBOL) && current().value == "{")) {
-        advance();
-    }
-    
-    // Skip the function body (including nested braces)
-    if (index < tokens.size()) {
-        advance(); // Skip the opening brace
-        int braceCount = 1;
-        
-        while (index < tokens.size() && braceCount > 0) {
-            if (match(SYMBOL)) {
-                if (current().value == "{") braceCount++;
-                else if (current().value == "}") braceCount--;
-            }
-            advance();
-        }
-    }
-}
-
 unique_ptr<ASTNode> Parser::parseFunction() {
     auto funcNode = make_unique<ASTNode>();
     funcNode->type = FUNCTION_NODE;
     funcNode->line = current().line;
+    param_positions.clear();
+    int param = 0;
     
     // Skip to opening parenthesis
     while (index < tokens.size() && !(match(SYMBOL) && current().value == "(")) {
@@ -109,18 +90,29 @@ unique_ptr<ASTNode> Parser::parseFunction() {
                 (match(IDENTIFIER) && (current().value == "int" ||
                                      current().value == "float" ||
                                      current().value == "double"))) {
+                bool isMatrix = current().value == "MATRIX";
                 advance();
                 
                 if (match(IDENTIFIER) || match(MATRIX_DECL)) {
                     string matrixName = current().value;
+                    int matrixLine = current().line;
+                    advance();
                     
-                    // Add matrix declaration to the function node
-                    auto matrixNode = make_unique<ASTNode>();
-                    matrixNode->type = MATRIX_DECL_NODE;
-                    matrixNode->value = matrixName;
-                    matrixNode->line = current().line;
+                    // Array parameters are matrices; scalar parameters are skipped
+                    if (match(SYMBOL) && current().value == "[") {
+                        isMatrix = true;
+                    }
                     
-                    funcNode->children.push_back(std::move(matrixNode));
+                    if (isMatrix) {
+                        // Add matrix declaration to the function node
+                        auto matrixNode = make_unique<ASTNode>();
+                        matrixNode->type = MATRIX_DECL_NODE;
+                        matrixNode->value = matrixName;
+                        matrixNode->line = matrixLine;
+                        
+                        funcNode->children.push_back(std::move(matrixNode));
+                        param_positions.push_back(param);
+                    }
                     
                     // Skip array dimensions
                     while (index < tokens.size() &&
@@ -129,10 +121,19 @@ unique_ptr<ASTNode> Parser::parseFunction() {
                     }
                 }
             } else {
+                if (match(SYMBOL) && current().value == ",") param++;
                 advance();
             }
         }
         
+        // A prototype has no body to parse
+        if (match(SYMBOL) && current().value == ")") {
+            advance();
+        }
+        if (match(SYMBOL) && current().value == ";") {
+            return nullptr;
+        }
+        
         // Skip to function body
         while (index < tokens.size() && !(match(SYMBOL) && current().value == "{")) {
             advance();
@@ -149,125 +150,421 @@ unique_ptr<ASTNode> Parser::parseFunction() {
     return funcNode;
 }
 
+uint64_t Parser::fingerprintTokens(size_t begin, size_t end) const {
+    // Token kinds and spellings only, so moving a function does not change it
+    string text;
+    for (size_t i = begin; i < end && i < tokens.size(); i++) {
+        text += to_string(tokens[i].type) + ":" + tokens[i].value + "\x1f";
+    }
+    return FragmentCache::hash(text);
+}
+
+// Concatenate token values in [begin, end) into a single expression string
+static string joinTokens(const vector<Token>& tokens, size_t begin, size_t end) {
+    string text;
+    for (size_t i = begin; i < end && i < tokens.size(); i++) {
+        text += tokens[i].value;
+    }
+    return text;
+}
+
 void Parser::parseFunctionBody(ASTNode* funcNode) {
-    // Look for nested loops (typical matrix multiplication pattern)
-    stack<int> loopNestingLevel;
-    bool foundTripleLoop = false;
-    int currentLine = -1;
+    // Walk the body statement by statement, keeping the stack of enclosing
+    // loops so every assignment can be matched against its loop nest
+    vector<LoopHeader> loops;
+    pending_products.clear();
+    zeroed_accumulators.clear();
+    zeroed_matrices.clear();
     
-    while (index < tokens.size()) {
+    while (index < tokens.size() && !check(END)) {
         if (match(SYMBOL) && current().value == "}") {
-            if (loopNestingLevel.empty()) {
-                // End of function
+            // End of function
+            advance();
+            break;
+        }
+        parseBodyStatement(funcNode, loops);
+    }
+}
+
+void Parser::parseBodyStatement(ASTNode* funcNode, vector<LoopHeader>& loops) {
+    if (check(END) || (match(SYMBOL) && current().value == "}")) {
+        return; // The enclosing block closes here
+    }
+    
+    if (match(SYMBOL) && current().value == "{") {
+        advance();
+        while (index < tokens.size() && !check(END) &&
+               !(match(SYMBOL) && current().value == "}")) {
+            parseBodyStatement(funcNode, loops);
+        }
+        if (match(SYMBOL)) advance(); // Skip closing brace
+        return;
+    }
+    
+    if (match(IDENTIFIER) && current().value == "for") {
+        LoopHeader header;
+        header.line = current().line;
+        advance();
+        
+        // Only counted loops take part in the nest; anything else is opaque
+        bool counted = parseLoopHeader(header);
+        if (counted) loops.push_back(header);
+        parseBodyStatement(funcNode, loops);
+        if (counted) loops.pop_back();
+        return;
+    }
+    
+    if (match(IDENTIFIER) && (current().value == "if" || current().value == "while")) {
+        advance();
+        int depth = 0;
+        while (index < tokens.size() && !check(END)) {
+            if (match(SYMBOL) && current().value == "(") depth++;
+            if (match(SYMBOL) && current().value == ")" && --depth == 0) {
                 advance();
                 break;
-            } else {
-                // End of a loop
-                loopNestingLevel.pop();
-                advance();
             }
-        }
-        else if (match(IDENTIFIER) && current().value == "for") {
-            // Found a loop
-            currentLine = current().line;
-            loopNestingLevel.push(currentLine);
             advance();
-            
-            // If we've found three nested loops, this might be matrix multiplication
-            if (loopNestingLevel.size() == 3) {
-                foundTripleLoop = true;
-                
-                // Improved detection: Look ahead for matrix multiplication pattern
-                int tempIndex = index;
-                int maxLookAhead = 50; // Limit how far we look ahead
-                
-                while (maxLookAhead > 0 && tempIndex < tokens.size()) {
-                    // Look for += or = operators inside the innermost loop
-                    if ((tokens[tempIndex].type == OPERATOR &&
-                         (tokens[tempIndex].value == "+=" || tokens[tempIndex].value == "=")) ||
-                        (tokens[tempIndex].type == SYMBOL && tokens[tempIndex].value == ";")) {
-                        
-                        // This is a potential matrix multiplication statement
-                        break;
-                    }
-                    tempIndex++;
-                    maxLookAhead--;
-                }
-            }
         }
-        else if (foundTripleLoop &&
-                (match(OPERATOR) && (current().value == "+=" || current().value == "="))) {
-            // Inside triply-nested loop with += or = operation, likely matrix multiply
-            string operation = current().value;
+        parseBodyStatement(funcNode, loops);
+        if (match(IDENTIFIER) && current().value == "else") {
             advance();
-            
-            // Extract the matrices involved
-            string resultMatrix;
-            string matrixA;
-            string matrixB;
-            
-            // Find the result matrix (left side of += or =)
-            int backup = 5; // Look back a few tokens
-            for (int i = 1; i <= backup && index - i >= 0; i++) {
-                Token prevToken = tokens[index - i];
-                if ((prevToken.type == MATRIX_DECL || prevToken.type == IDENTIFIER) &&
-                    prevToken.value.length() == 1 && isupper(prevToken.value[0])) {
-                    resultMatrix = prevToken.value;
-                    break;
-                }
+            parseBodyStatement(funcNode, loops);
+        }
+        return;
+    }
+    
+    parseAssignment(funcNode, loops);
+}
+
+bool Parser::parseLoopHeader(LoopHeader& header) {
+    if (!(match(SYMBOL) && current().value == "(")) {
+        return false;
+    }
+    advance();
+    
+    // Split "init; cond; step" at top-level semicolons
+    vector<size_t> bounds = {index};
+    int depth = 0;
+    while (index < tokens.size() && !check(END)) {
+        if (match(SYMBOL) && current().value == "(") depth++;
+        if (match(SYMBOL) && current().value == ")") {
+            if (depth == 0) break;
+            depth--;
+        }
+        if (depth == 0 && match(SYMBOL) && current().value == ";") {
+            bounds.push_back(index + 1);
+        }
+        advance();
+    }
+    size_t close = index;
+    if (match(SYMBOL)) advance(); // Skip closing parenthesis
+    
+    if (bounds.size() != 3) {
+        return false;
+    }
+    
+    // Init: [type] var = lower
+    string lower;
+    for (size_t i = bounds[0]; i + 1 < bounds[1]; i++) {
+        if (tokens[i].type == OPERATOR && tokens[i].value == "=" && i > bounds[0]) {
+            header.var = tokens[i - 1].value;
+            lower = joinTokens(tokens, i + 1, bounds[1] - 1);
+            break;
+        }
+    }
+    
+    // Condition: var < bound or var <= bound
+    size_t cond = bounds[1];
+    size_t condEnd = bounds[2] - 1;
+    if (header.var.empty() || cond + 2 > condEnd || tokens[cond].value != header.var ||
+        tokens[cond + 1].value != "<") {
+        return false;
+    }
+    bool inclusive = cond + 2 < condEnd && tokens[cond + 2].value == "=";
+    header.bound = joinTokens(tokens, cond + (inclusive ? 3 : 2), condEnd);
+    if (header.bound.empty()) {
+        return false;
+    }
+    if (inclusive) header.bound += "+1";
+    if (!lower.empty() && lower != "0") header.bound += "-" + lower;
+    
+    // Step: unit increment only
+    string step = joinTokens(tokens, bounds[2], close);
+    return step == header.var + "++" || step == "++" + header.var ||
+           step == header.var + "+=1" || step == header.var + "=" + header.var + "+1";
+}
+
+bool Parser::parseArrayRef(size_t& pos, size_t end, ArrayRef& ref) const {
+    if (pos + 1 >= end ||
+        !(tokens[pos].type == IDENTIFIER || tokens[pos].type == MATRIX_DECL) ||
+        tokens[pos + 1].value != "[") {
+        return false;
+    }
+    
+    ref.name = tokens[pos].value;
+    ref.line = tokens[pos].line;
+    ref.subscripts.clear();
+    size_t cursor = pos + 1;
+    while (cursor < end && tokens[cursor].type == SYMBOL && tokens[cursor].value == "[") {
+        size_t close = cursor + 1;
+        while (close < end && tokens[close].value != "]") close++;
+        if (close >= end) return false;
+        ref.subscripts.push_back(joinTokens(tokens, cursor + 1, close));
+        cursor = close + 1;
+    }
+    pos = cursor;
+    return true;
+}
+
+static bool isConstant(const string& text) {
+    return !text.empty() && all_of(text.begin(), text.end(), [](char ch) { return isdigit(ch); });
+}
+
+void Parser::parseAssignment(ASTNode* funcNode, const vector<LoopHeader>& loops) {
+    // Gather one statement, up to a top-level semicolon
+    size_t start = index;
+    int depth = 0;
+    while (index < tokens.size() && !check(END)) {
+        if (match(SYMBOL) && current().value == "{") depth++;
+        if (match(SYMBOL) && current().value == "}") {
+            if (depth == 0) break;
+            depth--;
+        }
+        if (depth == 0 && match(SYMBOL) && current().value == ";") break;
+        advance();
+    }
+    size_t end = index;
+    if (match(SYMBOL) && current().value == ";") advance();
+    
+    // Locate the assignment operator
+    size_t op = end;
+    for (size_t i = start; i < end; i++) {
+        if (tokens[i].type == OPERATOR && (tokens[i].value == "=" || tokens[i].value == "+=")) {
+            op = i;
+            break;
+        }
+    }
+    if (op == end) {
+        return;
+    }
+    
+    // Left side: a matrix element or a scalar accumulator
+    size_t pos = start;
+    while (pos < op && tokens[pos].type == MATRIX_TYPE) pos++;
+    ArrayRef result;
+    bool storesMatrix = parseArrayRef(pos, op, result);
+    string scalar = (!storesMatrix && pos + 1 == op) ? tokens[pos].value : "";
+    
+    // Right side: matrix references, scalars and whether it is exactly one
+    // product, accumulated with += or by reading the result back
+    // (C[i][j] = C[i][j] + ..., sum = sum + ...)
+    bool accumulates = tokens[op].value == "+=";
+    vector<ArrayRef> refs;
+    vector<string> scalars;
+    int multiplies = 0;
+    bool otherTerms = false; // constants, other operators, extra factors
+    auto readsBack = [&](size_t next) {
+        return !accumulates && next < end && tokens[next].type == OPERATOR && tokens[next].value == "+";
+    };
+    for (size_t i = op + 1; i < end;) {
+        ArrayRef ref;
+        if (parseArrayRef(i, end, ref)) {
+            if (storesMatrix && ref.name == result.name && ref.subscripts == result.subscripts) {
+                if (!readsBack(i)) otherTerms = true;
+                accumulates = true;
+                i++;
+            } else {
+                refs.push_back(ref);
             }
-            
-            // Now process the right side for A*B pattern
-            bool foundMultiply = false;
-            while (index < tokens.size() && !(match(SYMBOL) && current().value == ";")) {
-                if (match(MATRIX_DECL) || match(IDENTIFIER)) {
-                    if (current().value.length() == 1 && isupper(current().value[0])) {
-                        if (matrixA.empty()) {
-                            matrixA = current().value;
-                        } else {
-                            matrixB = current().value;
-                        }
-                    }
-                } else if (match(OPERATOR) && current().value == "*") {
-                    foundMultiply = true;
+            continue;
+        }
+        if (!scalar.empty() && tokens[i].value == scalar && i == op + 1 && readsBack(i + 1)) {
+            accumulates = true;
+            i += 2;
+            continue;
+        }
+        if (tokens[i].type == OPERATOR && tokens[i].value == "*") {
+            multiplies++;
+        } else if (tokens[i].type == IDENTIFIER || tokens[i].type == MATRIX_DECL) {
+            scalars.push_back(tokens[i].value);
+        } else {
+            otherTerms = true;
+        }
+        i++;
+    }
+    bool product = multiplies == 1 && refs.size() == 2 && scalars.empty() && !otherTerms;
+    
+    // A store of 0 indexed by enclosing loops zeroes the matrix for the
+    // products accumulated into it; any other store leaves other values
+    if (storesMatrix && !product) {
+        bool sweeps = all_of(result.subscripts.begin(), result.subscripts.end(), [&](const string& index) {
+            return any_of(loops.begin(), loops.end(), [&](const LoopHeader& loop) { return loop.var == index; });
+        });
+        if (!accumulates && end == op + 2 && tokens[op + 1].value == "0" && sweeps) {
+            zeroed_matrices.insert(result.name);
+        } else {
+            zeroed_matrices.erase(result.name);
+        }
+    }
+    
+    if (storesMatrix && product) {
+        // Without accumulation only the last product survives, which is a
+        // product only when no loop index sums over anything
+        bool singleElement = all_of(refs.begin(), refs.end(), [](const ArrayRef& ref) {
+            return all_of(ref.subscripts.begin(), ref.subscripts.end(), isConstant);
+        });
+        bool zeroed = zeroed_matrices.erase(result.name) > 0; // afterwards it holds the product
+        if (!accumulates && !singleElement) return;
+        
+        // The routines overwrite the result, which computes the accumulation
+        // only when it starts from zero
+        if (accumulates && !zeroed) {
+            cerr << "Warning: line " << result.line << ": " << result.name
+                 << " accumulates a product without being set to 0 first; not lowered" << endl;
+            return;
+        }
+        if (auto node = buildMatMulNode(result, refs[0], refs[1], loops)) {
+            funcNode->children.push_back(std::move(node));
+        }
+        return;
+    }
+    
+    if (!scalar.empty()) {
+        // sum += A[i][k] * B[k][j] into a zeroed sum: remember the product
+        // until sum is stored. Any other write to sum forgets it.
+        if (product && accumulates && zeroed_accumulators.count(scalar)) {
+            pending_products.push_back({scalar, refs[0], refs[1], loops});
+            return;
+        }
+        pending_products.erase(remove_if(pending_products.begin(), pending_products.end(),
+                                         [&](const PendingProduct& pending) {
+                                             return pending.accumulator == scalar;
+                                         }),
+                               pending_products.end());
+        bool zeroes = !accumulates && end == op + 2 && tokens[op + 1].value == "0";
+        if (zeroes) {
+            zeroed_accumulators.insert(scalar);
+        } else {
+            zeroed_accumulators.erase(scalar);
+        }
+        return;
+    }
+    
+    // C[i][j] = sum: complete a pending accumulation
+    if (storesMatrix && !accumulates && refs.empty() && scalars.size() == 1 && multiplies == 0 && !otherTerms) {
+        for (const auto& pending : pending_products) {
+            if (pending.accumulator == scalars[0]) {
+                if (auto node = buildMatMulNode(result, pending.lhs, pending.rhs, pending.loops)) {
+                    funcNode->children.push_back(std::move(node));
                 }
-                advance();
+                break;
             }
-            
-            // Create a matrix multiplication node with proper structure
-            if (foundMultiply && !resultMatrix.empty() && !matrixA.empty() && !matrixB.empty()) {
-                auto matMulNode = make_unique<ASTNode>();
-                matMulNode->type = MATRIX_OP_NODE;
-                matMulNode->value = "*";
-                matMulNode->line = currentLine;
-                
-                // Add operand A
-                auto opANode = make_unique<ASTNode>();
-                opANode->type = MATRIX_DECL_NODE;
-                opANode->value = matrixA;
-                matMulNode->children.push_back(std::move(opANode));
-                
-                // Add operand B
-                auto opBNode = make_unique<ASTNode>();
-                opBNode->type = MATRIX_DECL_NODE;
-                opBNode->value = matrixB;
-                matMulNode->children.push_back(std::move(opBNode));
-                
-                // Add result matrix
-                auto resultNode = make_unique<ASTNode>();
-                resultNode->type = MATRIX_DECL_NODE;
-                resultNode->value = resultMatrix;
-                matMulNode->children.push_back(std::move(resultNode));
-                
-                funcNode->children.push_back(std::move(matMulNode));
-                
-                // Reset to prepare for next operation
-                foundTripleLoop = false;
+        }
+    }
+}
+
+unique_ptr<ASTNode> Parser::buildMatMulNode(const ArrayRef& result, const ArrayRef& lhs,
+                                            const ArrayRef& rhs,
+                                            const vector<LoopHeader>& loops) const {
+    // Each form below puts the operands in A, B order
+    const ArrayRef* a = &lhs;
+    const ArrayRef* b = &rhs;
+    size_t rank = result.subscripts.size();
+    vector<string> indices; // every index the nest must drive
+    
+    if (rank == 2 && a->subscripts.size() == 2 && b->subscripts.size() == 2) {
+        // C[x][y] += A[x][z] * B[z][y], with the operands in either order
+        const string& x = result.subscripts[0];
+        const string& y = result.subscripts[1];
+        if (a->subscripts[0] != x) swap(a, b);
+        if (a->subscripts[0] != x || b->subscripts[1] != y ||
+            a->subscripts[1] != b->subscripts[0]) {
+            return nullptr;
+        }
+        const string& z = a->subscripts[1];
+        
+        // A single element at constant subscripts needs no loops
+        if (!isConstant(x) || !isConstant(y) || !isConstant(z)) {
+            if (x == y || x == z || y == z) {
+                return nullptr;
             }
-        } else {
-            advance();
+            indices = {x, y, z};
+        }
+    } else if (rank == 1 && a->subscripts.size() + b->subscripts.size() == 3) {
+        // y[x] += A[x][z] * v[z] or y[x] += v[z] * W[z][x], either order
+        const string& x = result.subscripts[0];
+        const ArrayRef* matrix = a->subscripts.size() == 2 ? a : b;
+        const ArrayRef* vec = matrix == a ? b : a;
+        bool matrixFirst = matrix->subscripts[0] == x;
+        if (!matrixFirst && matrix->subscripts[1] != x) {
+            return nullptr;
+        }
+        const string& z = matrix->subscripts[matrixFirst ? 1 : 0];
+        if (vec->subscripts[0] != z || x == z) {
+            return nullptr;
+        }
+        a = matrixFirst ? matrix : vec;
+        b = matrixFirst ? vec : matrix;
+        indices = {x, z};
+    } else if (rank == 3 && a->subscripts.size() == 3 && b->subscripts.size() == 3) {
+        // C[s][x][y] += A[s][x][z] * B[s][z][y]: a batch of independent products
+        const string& s = result.subscripts[0];
+        const string& x = result.subscripts[1];
+        const string& y = result.subscripts[2];
+        if (a->subscripts[1] != x) swap(a, b);
+        const string& z = a->subscripts[2];
+        if (a->subscripts != vector<string>{s, x, z} || b->subscripts != vector<string>{s, z, y} ||
+            s == x || s == y || s == z || x == y || x == z || y == z) {
+            return nullptr;
+        }
+        indices = {s, x, y, z};
+    } else {
+        return nullptr;
+    }
+    
+    // Every index must be driven by an enclosing counted loop
+    vector<const LoopHeader*> nest;
+    for (const auto& loop : loops) {
+        if (find(indices.begin(), indices.end(), loop.var) != indices.end()) {
+            nest.push_back(&loop);
         }
     }
+    if (nest.size() != indices.size()) {
+        return nullptr;
+    }
+    
+    auto matMulNode = make_unique<ASTNode>();
+    matMulNode->type = MATRIX_OP_NODE;
+    matMulNode->value = "*";
+    matMulNode->line = nest.empty() ? result.line : nest.back()->line;
+    
+    // Operands A, B and the result, each carrying its subscripts
+    for (const ArrayRef* ref : {a, b, &result}) {
+        auto opNode = make_unique<ASTNode>();
+        opNode->type = MATRIX_DECL_NODE;
+        opNode->value = ref->name;
+        opNode->line = ref->line;
+        for (const auto& subscript : ref->subscripts) {
+            opNode->children.push_back(make_unique<ASTNode>(ASTNode{
+                INDEX_NODE, subscript, {}, ref->line
+            }));
+        }
+        matMulNode->children.push_back(std::move(opNode));
+    }
+    
+    // The loop nest, outermost first
+    for (const LoopHeader* loop : nest) {
+        auto loopNode = make_unique<ASTNode>();
+        loopNode->type = LOOP_NODE;
+        loopNode->value = loop->var;
+        loopNode->line = loop->line;
+        loopNode->children.push_back(make_unique<ASTNode>(ASTNode{
+            BOUND_NODE, loop->bound, {}, loop->line
+        }));
+        matMulNode->children.push_back(std::move(loopNode));
+    }
+    
+    return matMulNode;
 }
 
 unique_ptr<ASTNode> Parser::parseStatement() {
@@ -284,11 +581,59 @@ unique_ptr<ASTNode> Parser::parseStatement() {
         return parseMatrixOperation();
     }
     
+    if ((check(IDENTIFIER) || check(MATRIX_DECL)) && kernel_params.count(current().value) &&
+        index + 1 < tokens.size() && tokens[index + 1].value == "(") {
+        return parseCall();
+    }
+    
     // Default case - skip unrecognized tokens
     advance();
     return nullptr;
 }
 
+unique_ptr<ASTNode> Parser::parseCall() {
+    auto node = make_unique<ASTNode>();
+    node->type = CALL_NODE;
+    node->value = current().value;
+    node->line = current().line;
+    advance();
+    advance(); // Skip the opening parenthesis
+    
+    // Split the arguments at top-level commas; an argument that is not a
+    // plain name (an expression or a literal) is left empty
+    vector<string> args(1);
+    vector<int> tokensInArg(1, 0);
+    int depth = 0;
+    while (index < tokens.size() && !check(END)) {
+        if (match(SYMBOL) && (current().value == "(" || current().value == "[")) depth++;
+        if (match(SYMBOL) && (current().value == ")" || current().value == "]")) {
+            if (depth == 0) {
+                advance();
+                break;
+            }
+            depth--;
+        }
+        if (depth == 0 && match(SYMBOL) && current().value == ",") {
+            args.emplace_back();
+            tokensInArg.push_back(0);
+        } else {
+            if (match(IDENTIFIER) || match(MATRIX_DECL)) args.back() = current().value;
+            tokensInArg.back()++;
+        }
+        advance();
+    }
+    
+    // Keep the arguments bound to the callee's matrix parameters, in order
+    for (int position : kernel_params[node->value]) {
+        string arg;
+        if (position < static_cast<int>(args.size()) && tokensInArg[position] == 1) {
+            arg = args[position];
+        }
+        node->children.push_back(make_unique<ASTNode>(ASTNode{MATRIX_DECL_NODE, arg, {}, node->line}));
+    }
+    return node;
+}
+
 unique_ptr<ASTNode> Parser::parseMatrixDeclaration() {
     auto node = make_unique<ASTNode>();
     node->type = MATRIX_DECL_NODE;
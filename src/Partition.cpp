@@ -0,0 +1,318 @@
+#include "Partition.h"
+#include "TargetBackend.h"
+#include <algorithm>
+#include <iomanip>
+#include <numeric>
+#include <sstream>
+#include <stdexcept>
+
+using namespace std;
+
+namespace Partition {
+
+static const int ELEMENT_BYTES = sizeof(int);
+
+// The host adds partial sums one 256-bit vector of ints per cycle
+static const double HOST_ADDS_PER_CYCLE = 8;
+
+namespace {
+
+// How an operand is divided between the devices
+enum Split {
+    WHOLE,       // every device holds all of it
+    BY_ROWS,     // each device holds a band of rows
+    BY_COLUMNS,  // each device holds a band of columns
+    PARTIAL      // each device holds a partial sum of all of it
+};
+
+struct Operand {
+    int rows = 0, cols = 0;
+    Split split = WHOLE;
+    bool input = false;   // read before any operation writes it
+    bool output = false;  // written by an operation
+};
+
+}
+
+pair<int, int> range(int extent, int device, int devices) {
+    long begin = static_cast<long>(extent) * device / devices;
+    long end = static_cast<long>(extent) * (device + 1) / devices;
+    return {static_cast<int>(begin), static_cast<int>(end)};
+}
+
+void apply(const Slice& slice, LoopNest::MatMulNest& nest) {
+    if (slice.devices <= 1) return;
+    auto share = [&](int extent) {
+        auto [begin, end] = range(extent, slice.device, slice.devices);
+        return end - begin;
+    };
+    switch (slice.axis) {
+        case ROWS: nest.M = share(nest.M); break;
+        case COLUMNS: nest.N = share(nest.N); break;
+        case DEPTH: nest.K = share(nest.K); break;
+        default: break;
+    }
+}
+
+vector<LoopNest::MatMulNest> operations(const ASTNode* root, const unordered_map<string, int>& defines,
+                                        int fallbackSize) {
+    vector<LoopNest::MatMulNest> ops;
+    for (const auto& node : root->children) {
+        if (node->type != FUNCTION_NODE) continue;
+        for (const auto& child : node->children) {
+            if (child->type != MATRIX_OP_NODE || child->value != "*" || child->children.size() < 3) {
+                continue;
+            }
+            LoopNest::MatMulNest nest;
+            if (!LoopNest::extract(child.get(), defines, fallbackSize, nest)) {
+                // No loop information: square operands of the detected size
+                nest.A = child->children[0]->value;
+                nest.B = child->children[1]->value;
+                nest.C = child->children[2]->value;
+                nest.M = nest.N = nest.K = fallbackSize;
+            }
+            ops.push_back(nest);
+        }
+    }
+    return ops;
+}
+
+bool plan(const vector<LoopNest::MatMulNest>& ops, Axis axis, int devices, Plan& result, string& reason) {
+    result = Plan();
+    result.axis = axis;
+    result.devices = devices;
+    if (ops.empty()) {
+        reason = "the program has no matrix operations";
+        return false;
+    }
+    
+    // Every operand must be divided the same way by all operations using it
+    unordered_map<string, Operand> operands;
+    vector<string> order;
+    auto use = [&](const string& name, int rows, int cols, Split split, bool write) {
+        auto [it, added] = operands.try_emplace(name);
+        Operand& operand = it->second;
+        if (added) {
+            operand.rows = rows;
+            operand.cols = cols;
+            operand.split = split;
+            order.push_back(name);
+        } else if (operand.split != split ||
+                   (split != WHOLE && (operand.rows != rows || operand.cols != cols))) {
+            reason = name + " would be divided differently by two operations";
+            return false;
+        }
+        if (write) {
+            operand.output = true;
+        } else if (!operand.output) {
+            operand.input = true;
+        }
+        return true;
+    };
+    
+    for (const auto& nest : ops) {
+        Split splitA = WHOLE, splitB = WHOLE, splitC = WHOLE;
+        if (devices > 1) {
+            if (nest.kind == LoopNest::BATCHED || nest.kind == LoopNest::SCALAR) {
+                reason = string(LoopNest::kindName(nest.kind)) + " product into " + nest.C +
+                         " cannot be divided";
+                return false;
+            }
+            int extent = 0;
+            switch (axis) {
+                case ROWS: splitA = splitC = BY_ROWS; extent = nest.M; break;
+                case COLUMNS: splitB = splitC = BY_COLUMNS; extent = nest.N; break;
+                default: splitA = BY_COLUMNS; splitB = BY_ROWS; splitC = PARTIAL; extent = nest.K; break;
+            }
+            if (extent < 2 * devices) {
+                reason = nest.C + (axis == DEPTH ? " has a reduction depth of " + to_string(extent)
+                                                 : " has " + to_string(extent) + " " + axisName(axis)) +
+                         ", fewer than two per device";
+                return false;
+            }
+        }
+        int rows = nest.M * nest.batch;
+        if (!use(nest.A, rows, nest.K, splitA, false) ||
+            !use(nest.B, nest.K * nest.batch, nest.N, splitB, false) ||
+            !use(nest.C, rows, nest.N, splitC, true)) {
+            return false;
+        }
+    }
+    
+    vector<int> all(devices);
+    iota(all.begin(), all.end(), 0);
+    auto block = [&](Transfer::Kind kind, const string& name, const Operand& operand, int device) {
+        Transfer transfer{kind, name, 0, operand.rows, 0, operand.cols, {device}};
+        if (operand.split == BY_ROWS) {
+            tie(transfer.rowBegin, transfer.rowEnd) = range(operand.rows, device, devices);
+        } else if (operand.split == BY_COLUMNS) {
+            tie(transfer.colBegin, transfer.colEnd) = range(operand.cols, device, devices);
+        }
+        return transfer;
+    };
+    for (const auto& name : order) {
+        const Operand& operand = operands[name];
+        if (operand.input) {
+            if (operand.split == WHOLE && devices > 1) {
+                result.scatter.push_back({Transfer::BROADCAST, name, 0, operand.rows, 0, operand.cols, all});
+            } else {
+                for (int device = 0; device < devices; device++) {
+                    result.scatter.push_back(block(Transfer::SCATTER, name, operand, device));
+                }
+            }
+        }
+        if (operand.output) {
+            if (operand.split == PARTIAL) {
+                result.gather.push_back({Transfer::REDUCE, name, 0, operand.rows, 0, operand.cols, all});
+            } else if (operand.split == WHOLE) {
+                result.gather.push_back(block(Transfer::GATHER, name, operand, 0));
+            } else {
+                for (int device = 0; device < devices; device++) {
+                    result.gather.push_back(block(Transfer::GATHER, name, operand, device));
+                }
+            }
+        }
+    }
+    return true;
+}
+
+vector<Plan> candidates(const vector<LoopNest::MatMulNest>& ops, Axis requested, int devices) {
+    vector<Axis> axes = {ROWS, COLUMNS, DEPTH};
+    if (requested != AUTO) axes = {requested};
+    
+    vector<pair<uint64_t, Plan>> feasible;
+    string reasons;
+    for (Axis axis : axes) {
+        Plan candidate;
+        string reason;
+        if (!plan(ops, axis, devices, candidate, reason)) {
+            reasons += string("\n  along ") + axisName(axis) + ": " + reason;
+            continue;
+        }
+        feasible.push_back({hostCycles(candidate.scatter) + hostCycles(candidate.gather), candidate});
+    }
+    if (feasible.empty()) {
+        throw runtime_error("Cannot partition the program across " + to_string(devices) + " devices:" +
+                            reasons);
+    }
+    
+    // Ties keep the order rows, columns, k
+    stable_sort(feasible.begin(), feasible.end(),
+                [](const auto& a, const auto& b) { return a.first < b.first; });
+    vector<Plan> plans;
+    for (auto& [cost, candidate] : feasible) {
+        plans.push_back(std::move(candidate));
+    }
+    return plans;
+}
+
+uint64_t hostCycles(const vector<Transfer>& transfers) {
+    double cycles = 0;
+    for (const auto& transfer : transfers) {
+        double elements = static_cast<double>(transfer.rowEnd - transfer.rowBegin) *
+                          (transfer.colEnd - transfer.colBegin);
+        cycles += TargetBackend::transferCycles(elements * ELEMENT_BYTES) * transfer.devices.size();
+        if (transfer.kind == Transfer::REDUCE) {
+            cycles += elements * (transfer.devices.size() - 1) / HOST_ADDS_PER_CYCLE;
+        }
+    }
+    return static_cast<uint64_t>(cycles + 0.5);
+}
+
+uint64_t totalCycles(const Plan& plan) {
+    uint64_t slowest = 0;
+    for (uint64_t cycles : plan.deviceCycles) slowest = max(slowest, cycles);
+    return hostCycles(plan.scatter) + slowest + hostCycles(plan.gather);
+}
+
+static string deviceList(const vector<int>& devices) {
+    string list;
+    for (int device : devices) {
+        list += (list.empty() ? "" : ", ") + to_string(device);
+    }
+    return list;
+}
+
+static void formatPhase(ostringstream& text, const vector<Transfer>& transfers) {
+    static const char* kinds[] = {"SCATTER", "BROADCAST", "GATHER", "REDUCE"};
+    for (const auto& transfer : transfers) {
+        bool toDevices = transfer.kind == Transfer::SCATTER || transfer.kind == Transfer::BROADCAST;
+        text << kinds[transfer.kind] << " " << transfer.matrix << "[" << transfer.rowBegin << ":"
+             << transfer.rowEnd << ", " << transfer.colBegin << ":" << transfer.colEnd << "] "
+             << (toDevices ? "->" : "<-") << " " << deviceList(transfer.devices) << "\n";
+    }
+    text << "SYNC\n";
+}
+
+static uint64_t phaseBytes(const vector<Transfer>& transfers) {
+    uint64_t bytes = 0;
+    for (const auto& transfer : transfers) {
+        bytes += static_cast<uint64_t>(transfer.rowEnd - transfer.rowBegin) *
+                 (transfer.colEnd - transfer.colBegin) * ELEMENT_BYTES * transfer.devices.size();
+    }
+    return bytes;
+}
+
+string format(const Plan& plan) {
+    ostringstream text;
+    text << "# HOST COMMUNICATION PLAN\n"
+         << "# Matrix multiplies split along " << axisName(plan.axis) << " across " << plan.devices
+         << " devices. Each device program\n"
+         << "# addresses its block of a matrix by the matrix's name; ranges are [begin:end).\n"
+         << "DEVICES " << plan.devices << "\n"
+         << "PARTITION " << axisName(plan.axis) << "\n";
+    for (size_t device = 0; device < plan.programs.size(); device++) {
+        text << "PROGRAM " << device << " " << plan.programs[device] << "\n";
+    }
+    
+    text << "\n# SCATTER PHASE\n";
+    formatPhase(text, plan.scatter);
+    vector<int> all(plan.devices);
+    iota(all.begin(), all.end(), 0);
+    text << "\n# RUN PHASE\nRUN " << deviceList(all) << "\nSYNC\n";
+    text << "\n# GATHER PHASE\n";
+    formatPhase(text, plan.gather);
+    
+    auto row = [&](const string& label, uint64_t cycles) -> ostringstream& {
+        text << "# " << left << setw(12) << label << right << setw(12) << cycles;
+        return text;
+    };
+    text << "\n# COST ESTIMATE (cycles)\n";
+    row("scatter", hostCycles(plan.scatter)) << "  " << phaseBytes(plan.scatter) << " bytes\n";
+    for (size_t device = 0; device < plan.deviceCycles.size(); device++) {
+        row("device " + to_string(device), plan.deviceCycles[device]) << "\n";
+    }
+    row("gather", hostCycles(plan.gather)) << "  " << phaseBytes(plan.gather) << " bytes\n";
+    uint64_t total = totalCycles(plan);
+    row("total", total) << "\n";
+    if (plan.singleCycles == 0) {
+        text << "# one device: the program does not fit\n";
+    } else {
+        row("one device", plan.singleCycles) << "  speedup " << fixed << setprecision(2)
+                                            << static_cast<double>(plan.singleCycles) / max<uint64_t>(total, 1)
+                                            << "x\n";
+    }
+    text << "END\n";
+    return text.str();
+}
+
+bool parseAxis(const string& name, Axis& axis) {
+    for (Axis candidate : {AUTO, ROWS, COLUMNS, DEPTH}) {
+        if (name == axisName(candidate)) {
+            axis = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* axisName(Axis axis) {
+    switch (axis) {
+        case ROWS: return "rows";
+        case COLUMNS: return "columns";
+        case DEPTH: return "k";
+        default: return "auto";
+    }
+}
+
+}
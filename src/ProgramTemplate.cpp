@@ -0,0 +1,93 @@
+#include "ProgramTemplate.h"
+#include <map>
+#include <sstream>
+#include <stdexcept>
+
+using namespace std;
+
+namespace ProgramTemplate {
+
+// Template layout: the header, one DEFINE line per #define, then the AST in
+// preorder, one node per line:
+//   NODE <type> <line> <fingerprint> <children> <value>
+static const char* TEMPLATE_HEADER = "PIMTEMPLATE 1";
+
+bool isTemplate(const string& text) {
+    return text.compare(0, string(TEMPLATE_HEADER).size(), TEMPLATE_HEADER) == 0;
+}
+
+static void writeNode(const ASTNode* node, ostringstream& out) {
+    out << "NODE " << node->type << " " << node->line << " " << hex << node->fingerprint << dec
+        << " " << node->children.size() << " " << node->value << "\n";
+    for (const auto& child : node->children) {
+        writeNode(child.get(), out);
+    }
+}
+
+string serialize(const ASTNode* ast, const unordered_map<string, int>& defines) {
+    ostringstream out;
+    out << TEMPLATE_HEADER << "\n";
+    
+    // Sorted, so the same program always produces the same template
+    map<string, int> sorted(defines.begin(), defines.end());
+    for (const auto& [name, value] : sorted) {
+        out << "DEFINE " << name << " " << value << "\n";
+    }
+    writeNode(ast, out);
+    return out.str();
+}
+
+static unique_ptr<ASTNode> readNode(istringstream& in, int& lineNumber) {
+    string line;
+    if (!getline(in, line)) {
+        throw runtime_error("Template ends inside the AST");
+    }
+    lineNumber++;
+    
+    istringstream fields(line);
+    string tag;
+    int type = 0;
+    size_t children = 0;
+    auto node = make_unique<ASTNode>();
+    if (!(fields >> tag >> type >> node->line >> hex >> node->fingerprint >> dec >> children) ||
+        tag != "NODE" || type < PROGRAM_NODE || type > CALL_NODE) {
+        throw runtime_error("Malformed template node on line " + to_string(lineNumber));
+    }
+    node->type = static_cast<ASTNodeType>(type);
+    
+    // The value is the rest of the line after one separating space, possibly empty
+    string rest;
+    getline(fields, rest);
+    node->value = rest.empty() ? "" : rest.substr(1);
+    
+    for (size_t i = 0; i < children; i++) {
+        node->children.push_back(readNode(in, lineNumber));
+    }
+    return node;
+}
+
+Template deserialize(const string& text) {
+    istringstream in(text);
+    string line;
+    int lineNumber = 1;
+    if (!getline(in, line) || line != TEMPLATE_HEADER) {
+        throw runtime_error("Not a program template");
+    }
+    
+    Template result;
+    while (in.peek() == 'D') {
+        getline(in, line);
+        lineNumber++;
+        istringstream fields(line);
+        string tag, name;
+        int value = 0;
+        if (!(fields >> tag >> name >> value) || tag != "DEFINE") {
+            throw runtime_error("Malformed template define on line " + to_string(lineNumber));
+        }
+        result.defines[name] = value;
+    }
+    result.ast = readNode(in, lineNumber);
+    return result;
+}
+
+}
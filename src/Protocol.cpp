@@ -0,0 +1,170 @@
+#include "Protocol.h"
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace Protocol {
+
+// Request:  PIMC 1 <args> <source bytes>\n, one argument per line, the source
+// Response: OK <bytes>\n or ERROR <bytes>\n, then the text
+static const char* REQUEST_MAGIC = "PIMC";
+static const int PROTOCOL_VERSION = 1;
+static const size_t MAX_MESSAGE_BYTES = 256u << 20;
+
+static sockaddr_un socketAddress(const string& path) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+        throw runtime_error("Invalid socket path: " + path);
+    }
+    memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return address;
+}
+
+int listen(const string& path) {
+    sockaddr_un address = socketAddress(path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        throw runtime_error("Could not create socket: " + string(strerror(errno)));
+    }
+    
+    // A socket left behind by an earlier server would make bind fail
+    unlink(path.c_str());
+    if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 ||
+        ::listen(fd, 16) < 0) {
+        int error = errno;
+        close(fd);
+        throw runtime_error("Could not listen on " + path + ": " + strerror(error));
+    }
+    return fd;
+}
+
+int connect(const string& path) {
+    sockaddr_un address = socketAddress(path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        throw runtime_error("Could not create socket: " + string(strerror(errno)));
+    }
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+        int error = errno;
+        close(fd);
+        throw runtime_error("Could not connect to " + path + ": " + strerror(error));
+    }
+    return fd;
+}
+
+static void writeAll(int fd, const string& data) {
+    for (size_t sent = 0; sent < data.size();) {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            throw runtime_error("Connection lost: " + string(strerror(errno)));
+        }
+        sent += n;
+    }
+}
+
+// Buffered reads of header lines and counted payloads
+class Reader {
+public:
+    explicit Reader(int fd) : fd(fd) {}
+    
+    bool line(string& text) {
+        size_t end;
+        while ((end = buffer.find('\n', pos)) == string::npos) {
+            if (buffer.size() - pos > 4096 || !fill()) return false;
+        }
+        text.assign(buffer, pos, end - pos);
+        pos = end + 1;
+        return true;
+    }
+    
+    bool bytes(size_t count, string& text) {
+        while (buffer.size() - pos < count) {
+            if (!fill()) return false;
+        }
+        text.assign(buffer, pos, count);
+        pos += count;
+        return true;
+    }
+
+private:
+    bool fill() {
+        buffer.erase(0, pos);
+        pos = 0;
+        char chunk[65536];
+        ssize_t n;
+        do {
+            n = recv(fd, chunk, sizeof(chunk), 0);
+        } while (n < 0 && errno == EINTR);
+        if (n <= 0) return false;
+        buffer.append(chunk, n);
+        return true;
+    }
+    
+    int fd;
+    string buffer;
+    size_t pos = 0;
+};
+
+bool readRequest(int fd, Request& request) {
+    Reader reader(fd);
+    string header;
+    if (!reader.line(header)) return false;
+    
+    istringstream fields(header);
+    string magic;
+    int version = 0;
+    size_t args = 0, bytes = 0;
+    if (!(fields >> magic >> version >> args >> bytes) || magic != REQUEST_MAGIC ||
+        version != PROTOCOL_VERSION || args > 256 || bytes > MAX_MESSAGE_BYTES) {
+        return false;
+    }
+    request.args.assign(args, "");
+    for (auto& arg : request.args) {
+        if (!reader.line(arg)) return false;
+    }
+    return reader.bytes(bytes, request.source);
+}
+
+void writeRequest(int fd, const Request& request) {
+    string message = string(REQUEST_MAGIC) + " " + to_string(PROTOCOL_VERSION) + " " +
+                     to_string(request.args.size()) + " " + to_string(request.source.size()) + "\n";
+    for (const auto& arg : request.args) {
+        if (arg.find('\n') != string::npos) {
+            throw runtime_error("Arguments cannot contain newlines");
+        }
+        message += arg + "\n";
+    }
+    message += request.source;
+    writeAll(fd, message);
+}
+
+bool readResponse(int fd, Response& response) {
+    Reader reader(fd);
+    string header;
+    if (!reader.line(header)) return false;
+    
+    istringstream fields(header);
+    string status;
+    size_t bytes = 0;
+    if (!(fields >> status >> bytes) || (status != "OK" && status != "ERROR") ||
+        bytes > MAX_MESSAGE_BYTES) {
+        return false;
+    }
+    response.ok = status == "OK";
+    return reader.bytes(bytes, response.text);
+}
+
+void writeResponse(int fd, const Response& response) {
+    writeAll(fd, string(response.ok ? "OK " : "ERROR ") + to_string(response.text.size()) + "\n" +
+                 response.text);
+}
+
+}
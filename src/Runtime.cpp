@@ -0,0 +1,456 @@
+#include "Runtime.h"
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+
+using namespace std;
+
+namespace Runtime {
+
+static const int ELEMENT_BYTES = sizeof(int32_t);
+
+static string trim(const string& text) {
+    size_t begin = text.find_first_not_of(" \t\r");
+    if (begin == string::npos) return "";
+    size_t end = text.find_last_not_of(" \t\r");
+    return text.substr(begin, end - begin + 1);
+}
+
+static vector<string> splitOperands(const string& text) {
+    vector<string> operands;
+    stringstream stream(text);
+    for (string operand; getline(stream, operand, ',');) {
+        operands.push_back(trim(operand));
+    }
+    return operands;
+}
+
+static bool isNumber(const string& text) {
+    return !text.empty() && isdigit(static_cast<unsigned char>(text[0]));
+}
+
+// Decimal or 0x-prefixed hexadecimal
+static int64_t parseNumber(const string& text, size_t line) {
+    size_t used = 0;
+    int64_t value = 0;
+    try {
+        bool hex = text.size() > 2 && text[0] == '0' && (text[1] == 'x' || text[1] == 'X');
+        value = stoll(hex ? text.substr(2) : text, &used, hex ? 16 : 10);
+        used += hex ? 2 : 0;
+    } catch (const exception&) {
+        used = 0;
+    }
+    if (used == 0 || used != text.size()) {
+        throw runtime_error("line " + to_string(line) + ": expected a number, got " + text);
+    }
+    return value;
+}
+
+// "base+offset+var*stride" with loop variables resolved to their nesting depth
+static Address parseAddress(const string& text, const vector<string>& loops, size_t line) {
+    Address address;
+    stringstream stream(text);
+    for (string term; getline(stream, term, '+');) {
+        term = trim(term);
+        size_t star = term.find('*');
+        if (star != string::npos) {
+            string var = trim(term.substr(0, star));
+            string factor = trim(term.substr(star + 1));
+            if (isNumber(var)) swap(var, factor);
+            auto loop = find(loops.begin(), loops.end(), var);
+            if (loop == loops.end()) {
+                throw runtime_error("line " + to_string(line) + ": " + var + " is not a loop variable");
+            }
+            address.strides.push_back({static_cast<int>(loop - loops.begin()), parseNumber(factor, line)});
+        } else if (isNumber(term)) {
+            address.offset += parseNumber(term, line);
+        } else if (address.host.empty() && !term.empty()) {
+            address.host = term;
+        } else {
+            throw runtime_error("line " + to_string(line) + ": bad address " + text);
+        }
+    }
+    return address;
+}
+
+shared_ptr<const Program> Program::load(const string& path) {
+    ifstream input(path);
+    if (!input.is_open()) {
+        throw runtime_error("Could not open program: " + path);
+    }
+    return parse(string(istreambuf_iterator<char>(input), istreambuf_iterator<char>()));
+}
+
+shared_ptr<const Program> Program::parse(const string& text) {
+    auto program = make_shared<Program>();
+    vector<Instruction>& code = program->code;
+    unordered_map<string, string> routines; // register -> routine programmed into it
+    string routine;                         // inside the PROG block of this routine
+    vector<string> loops;                   // enclosing loop variables
+    vector<size_t> loopStarts;
+    size_t perCall = string::npos, release = string::npos;
+    
+    istringstream lines(text);
+    size_t lineNumber = 0;
+    for (string raw; getline(lines, raw);) {
+        lineNumber++;
+        string line = trim(raw);
+        
+        // Section markers are comments
+        if (!line.empty() && line[0] == '#') {
+            if (line == "# PER-CALL PHASE") {
+                perCall = code.size();
+            } else if (line == "# MEMORY RELEASE") {
+                release = code.size();
+            }
+            continue;
+        }
+        line = trim(line.substr(0, line.find('#')));
+        if (line.empty()) continue;
+        
+        size_t space = line.find_first_of(" \t");
+        string opcode = line.substr(0, space);
+        string rest = space == string::npos ? "" : trim(line.substr(space));
+        
+        // Routine microcode runs inside the device, not here
+        if (!routine.empty()) {
+            if (opcode == "END" && rest == routine) routine.clear();
+            continue;
+        }
+        if (opcode == "PROG") {
+            auto operands = splitOperands(rest);
+            if (operands.size() != 2) {
+                throw runtime_error("line " + to_string(lineNumber) + ": expected PROG reg, name");
+            }
+            routines[operands[0]] = operands[1];
+            routine = operands[1];
+            continue;
+        }
+        if (opcode == "ALLOCATE") {
+            istringstream bounds(rest);
+            string low, high;
+            bounds >> low >> high;
+            program->memory_bytes = static_cast<size_t>(parseNumber(high, lineNumber) + 1);
+            continue;
+        }
+        if (opcode == "BIND") {
+            // BIND name, addr: the region holding a host matrix
+            auto operands = splitOperands(rest);
+            if (operands.size() != 2) {
+                throw runtime_error("line " + to_string(lineNumber) + ": expected BIND name, address");
+            }
+            program->allocated[operands[0]] = parseNumber(operands[1], lineNumber);
+            continue;
+        }
+        if (opcode == "END") break;
+        
+        Instruction instruction;
+        instruction.line = lineNumber;
+        auto operands = splitOperands(rest);
+        auto expect = [&](size_t least, size_t most) {
+            if (operands.size() < least || operands.size() > most) {
+                throw runtime_error("line " + to_string(lineNumber) + ": wrong operand count for " + opcode);
+            }
+        };
+        auto values = [&](size_t from) {
+            for (size_t i = from; i < operands.size(); i++) {
+                instruction.values.push_back(parseNumber(operands[i], lineNumber));
+            }
+        };
+        
+        if (opcode == "ALLOC" || opcode == "FREE") {
+            istringstream words(rest);
+            string address, bytes;
+            words >> address >> bytes;
+            instruction.opcode = opcode == "ALLOC" ? Instruction::ALLOC : Instruction::FREE;
+            instruction.addresses.push_back(parseAddress(address, loops, lineNumber));
+            if (!bytes.empty()) instruction.values.push_back(parseNumber(bytes, lineNumber));
+        } else if (opcode == "LAYOUT") {
+            // LAYOUT addr, KIND, rows, cols, pitch[, tile]
+            expect(5, 6);
+            instruction.opcode = Instruction::LAYOUT;
+            instruction.addresses.push_back(parseAddress(operands[0], loops, lineNumber));
+            instruction.name = operands[1];
+            values(2);
+        } else if (opcode == "XFORM") {
+            expect(2, 2);
+            instruction.opcode = Instruction::XFORM;
+            instruction.addresses.push_back(parseAddress(operands[0], loops, lineNumber));
+            instruction.name = operands[1];
+        } else if (opcode == "LOAD" || opcode == "STORE") {
+            // LOAD dst, Host+off, rows, rowBytes[, pitch] / STORE Host+off, src, rows, rowBytes[, pitch]
+            expect(4, 5);
+            instruction.opcode = opcode == "LOAD" ? Instruction::LOAD : Instruction::STORE;
+            instruction.addresses.push_back(parseAddress(operands[0], loops, lineNumber));
+            instruction.addresses.push_back(parseAddress(operands[1], loops, lineNumber));
+            values(2);
+            if (instruction.values.size() == 2) instruction.values.push_back(instruction.values[1]);
+        } else if (opcode == "EXE") {
+            // EXE reg, A, B, C, sizes...[, bBATCH][, cCORE]
+            if (!operands.empty() && operands.back().size() > 1 && operands.back()[0] == 'c') operands.pop_back();
+            if (!operands.empty() && operands.back().size() > 1 && operands.back()[0] == 'b') {
+                instruction.batch = static_cast<int>(parseNumber(operands.back().substr(1), lineNumber));
+                operands.pop_back();
+            }
+            expect(5, 7);
+            auto reg = routines.find(operands[0]);
+            if (reg == routines.end()) {
+                throw runtime_error("line " + to_string(lineNumber) + ": EXE on unprogrammed " + operands[0]);
+            }
+            instruction.opcode = Instruction::EXE;
+            instruction.name = reg->second;
+            for (size_t i = 1; i <= 3; i++) {
+                instruction.addresses.push_back(parseAddress(operands[i], loops, lineNumber));
+            }
+            values(4);
+        } else if (opcode == "SYNC") {
+            instruction.opcode = Instruction::SYNC;
+        } else if (opcode == "LOOP") {
+            expect(2, 2);
+            instruction.opcode = Instruction::LOOP;
+            values(1);
+            loops.push_back(operands[0]);
+            loopStarts.push_back(code.size());
+        } else if (opcode == "ENDLOOP") {
+            if (loops.empty() || loops.back() != rest) {
+                throw runtime_error("line " + to_string(lineNumber) + ": unmatched ENDLOOP " + rest);
+            }
+            instruction.opcode = Instruction::ENDLOOP;
+            instruction.partner = loopStarts.back();
+            code[loopStarts.back()].partner = code.size();
+            loops.pop_back();
+            loopStarts.pop_back();
+        } else {
+            throw runtime_error("line " + to_string(lineNumber) + ": unknown instruction " + opcode);
+        }
+        code.push_back(std::move(instruction));
+    }
+    if (!loops.empty()) {
+        throw runtime_error("LOOP " + loops.back() + " is never closed");
+    }
+    if (program->memory_bytes == 0) {
+        throw runtime_error("Program has no ALLOCATE");
+    }
+    
+    // The body starts after the allocations, or at the per-call phase of a
+    // weight-resident program, and ends where memory is released
+    size_t begin = 0;
+    while (begin < code.size() &&
+           (code[begin].opcode == Instruction::ALLOC || code[begin].opcode == Instruction::LAYOUT)) {
+        begin++;
+    }
+    size_t end = code.size();
+    while (end > begin && code[end - 1].opcode == Instruction::FREE) end--;
+    program->body_begin = perCall != string::npos ? perCall : begin;
+    program->body_end = release != string::npos ? max(release, program->body_begin) : end;
+    
+    // Host matrices are named by LOAD and STORE, or are the allocated matrices
+    // themselves when the host moves them
+    program->implicit_transfers = none_of(code.begin(), code.end(), [](const Instruction& instruction) {
+        return instruction.opcode == Instruction::LOAD || instruction.opcode == Instruction::STORE;
+    });
+    vector<Matrix>& matrices = program->host_matrices;
+    auto use = [&](const string& name, size_t elements, bool write, bool constant) {
+        auto matrix = find_if(matrices.begin(), matrices.end(), [&](const Matrix& m) { return m.name == name; });
+        if (matrix == matrices.end()) {
+            matrices.push_back({name, 0, false, false, constant});
+            matrix = matrices.end() - 1;
+        }
+        matrix->elements = max(matrix->elements, elements);
+        if (write) {
+            matrix->output = true;
+        } else if (!matrix->output) {
+            matrix->input = true;
+        }
+    };
+    
+    if (program->implicit_transfers) {
+        map<int64_t, pair<int64_t, string>> regions; // start -> bytes, matrix
+        map<int64_t, size_t> shapes;                 // start -> elements
+        for (const auto& [name, address] : program->allocated) {
+            regions[address].second = name;
+        }
+        for (const auto& instruction : code) {
+            int64_t address = instruction.addresses.empty() ? 0 : instruction.addresses[0].offset;
+            if (instruction.opcode == Instruction::ALLOC && instruction.values.size() == 1) {
+                regions[address].first = instruction.values[0];
+            } else if (instruction.opcode == Instruction::LAYOUT) {
+                shapes[address] = static_cast<size_t>(instruction.values[0] * instruction.values[1]);
+            }
+        }
+        // Operands of EXE are read except the last; compiler-internal regions
+        // such as partial sums ("C.k1") are not host matrices
+        for (const auto& instruction : code) {
+            if (instruction.opcode != Instruction::EXE) continue;
+            for (size_t i = 0; i < instruction.addresses.size(); i++) {
+                int64_t address = instruction.addresses[i].offset;
+                auto region = regions.upper_bound(address);
+                if (region == regions.begin()) continue;
+                --region;
+                const string& name = region->second.second;
+                if (name.empty() || name.find('.') != string::npos ||
+                    address >= region->first + region->second.first) {
+                    continue;
+                }
+                use(name, shapes[region->first], i == 2, false);
+            }
+        }
+    } else {
+        vector<int64_t> counts;
+        for (size_t pc = 0; pc < code.size(); pc++) {
+            const Instruction& instruction = code[pc];
+            if (instruction.opcode == Instruction::LOOP) {
+                counts.push_back(instruction.values[0]);
+            } else if (instruction.opcode == Instruction::ENDLOOP) {
+                counts.pop_back();
+            } else if (instruction.opcode == Instruction::LOAD || instruction.opcode == Instruction::STORE) {
+                // Furthest host byte over every loop iteration
+                bool load = instruction.opcode == Instruction::LOAD;
+                const Address& host = instruction.addresses[load ? 1 : 0];
+                int64_t last = host.offset;
+                for (const auto& [depth, stride] : host.strides) {
+                    last += stride * max<int64_t>(0, counts[depth] - 1);
+                }
+                int64_t bytes = last + (instruction.values[0] - 1) * instruction.values[1] + instruction.values[1];
+                use(host.host, static_cast<size_t>((bytes + ELEMENT_BYTES - 1) / ELEMENT_BYTES), !load,
+                    pc < program->body_begin);
+            }
+        }
+    }
+    return program;
+}
+
+const Matrix* Program::matrix(const string& name) const {
+    for (const auto& matrix : host_matrices) {
+        if (matrix.name == name) return &matrix;
+    }
+    return nullptr;
+}
+
+void Bindings::input(const string& name, const int32_t* data, size_t elements) {
+    buffers[name] = {data, nullptr, elements};
+}
+
+void Bindings::output(const string& name, int32_t* data, size_t elements) {
+    buffers[name] = {data, data, elements};
+}
+
+const Bindings::Buffer* Bindings::find(const string& name) const {
+    auto buffer = buffers.find(name);
+    return buffer == buffers.end() ? nullptr : &buffer->second;
+}
+
+void Bindings::check(const Program& program, bool constants) const {
+    for (const auto& matrix : program.matrices()) {
+        if (matrix.constant != constants) continue;
+        const Buffer* buffer = find(matrix.name);
+        if (!buffer) {
+            if (matrix.input) throw runtime_error("No binding for input " + matrix.name);
+            continue;
+        }
+        if (buffer->elements < matrix.elements) {
+            throw runtime_error("Binding for " + matrix.name + " holds " + to_string(buffer->elements) +
+                                " elements, the program uses " + to_string(matrix.elements));
+        }
+        if (matrix.output && !buffer->writable) {
+            throw runtime_error(matrix.name + " is written by the program but bound as an input");
+        }
+    }
+}
+
+Queue::Queue(shared_ptr<const Program> program, const Bindings& constants, const QueueOptions& options)
+    : program(std::move(program)), options(options) {
+    constants.check(*this->program, true);
+    int count = options.workers > 0 ? options.workers : max(1, static_cast<int>(thread::hardware_concurrency()));
+    for (int i = 0; i < count; i++) {
+        devices.push_back(options.device());
+        devices.back()->load(this->program, constants);
+    }
+    for (auto& device : devices) {
+        threads.emplace_back(&Queue::work, this, std::ref(*device));
+    }
+}
+
+Queue::~Queue() {
+    {
+        lock_guard<std::mutex> lock(queue_mutex);
+        stopping = true;
+    }
+    ready.notify_all();
+    for (auto& worker : threads) {
+        worker.join();
+    }
+}
+
+future<void> Queue::submit(Bindings bindings) {
+    bindings.check(*program, false);
+    Job job{std::move(bindings), promise<void>()};
+    future<void> result = job.done.get_future();
+    {
+        unique_lock<std::mutex> lock(queue_mutex);
+        space.wait(lock, [&] { return pending.size() < options.capacity; });
+        pending.push_back(std::move(job));
+    }
+    submitted++;
+    ready.notify_one();
+    return result;
+}
+
+void Queue::wait() {
+    unique_lock<std::mutex> lock(queue_mutex);
+    idle.wait(lock, [&] { return pending.empty() && running == 0; });
+}
+
+Queue::Stats Queue::stats() const {
+    Stats stats;
+    stats.submitted = submitted;
+    stats.completed = completed;
+    stats.failed = failed;
+    stats.batches = batches;
+    return stats;
+}
+
+void Queue::work(Device& device) {
+    vector<Job> jobs;
+    while (true) {
+        {
+            unique_lock<std::mutex> lock(queue_mutex);
+            ready.wait(lock, [&] { return stopping || !pending.empty(); });
+            if (pending.empty()) return;
+            
+            // An even share of the backlog, so one worker does not take it all
+            size_t share = max<size_t>(1, pending.size() / devices.size());
+            size_t take = min({options.batch, share, pending.size()});
+            for (size_t i = 0; i < take; i++) {
+                jobs.push_back(std::move(pending.front()));
+                pending.pop_front();
+            }
+            running += take;
+        }
+        space.notify_all();
+        batches++;
+        
+        for (auto& job : jobs) {
+            try {
+                device.run(job.bindings);
+                completed++;
+                job.done.set_value();
+            } catch (...) {
+                failed++;
+                job.done.set_exception(current_exception());
+            }
+        }
+        
+        {
+            lock_guard<std::mutex> lock(queue_mutex);
+            running -= jobs.size();
+            if (pending.empty() && running == 0) idle.notify_all();
+        }
+        jobs.clear();
+    }
+}
+
+}
@@ -0,0 +1,80 @@
+#include "Schedule.h"
+#include <algorithm>
+#include <map>
+#include <unordered_map>
+
+using namespace std;
+
+namespace Schedule {
+
+vector<vector<size_t>> buildDependencies(const vector<OpAccess>& ops) {
+    vector<vector<size_t>> deps(ops.size());
+    unordered_map<string, size_t> lastWriter;
+    unordered_map<string, vector<size_t>> readersSinceWrite;
+    
+    for (size_t op = 0; op < ops.size(); op++) {
+        auto depend = [&](size_t on) {
+            if (find(deps[op].begin(), deps[op].end(), on) == deps[op].end()) {
+                deps[op].push_back(on);
+            }
+        };
+        
+        // Read-after-write
+        for (const auto& name : ops[op].reads) {
+            auto writer = lastWriter.find(name);
+            if (writer != lastWriter.end()) depend(writer->second);
+        }
+        // Write-after-write and write-after-read
+        for (const auto& name : ops[op].writes) {
+            auto writer = lastWriter.find(name);
+            if (writer != lastWriter.end()) depend(writer->second);
+            for (size_t reader : readersSinceWrite[name]) {
+                if (reader != op) depend(reader);
+            }
+        }
+        
+        for (const auto& name : ops[op].reads) {
+            readersSinceWrite[name].push_back(op);
+        }
+        for (const auto& name : ops[op].writes) {
+            lastWriter[name] = op;
+            readersSinceWrite[name].clear();
+        }
+    }
+    return deps;
+}
+
+vector<vector<size_t>> buildWaves(const vector<OpAccess>& ops, int maxWidth) {
+    // Each operation runs one level after the latest operation it depends on
+    vector<vector<size_t>> deps = buildDependencies(ops);
+    vector<int> level(ops.size(), 0);
+    map<int, vector<size_t>> byLevel;
+    for (size_t op = 0; op < ops.size(); op++) {
+        for (size_t dep : deps[op]) {
+            level[op] = max(level[op], level[dep] + 1);
+        }
+        byLevel[level[op]].push_back(op);
+    }
+    
+    // Split every level, in program order, into waves that fit the cores
+    vector<vector<size_t>> waves;
+    for (const auto& [lvl, members] : byLevel) {
+        vector<size_t> wave;
+        int waveCores = 0;
+        for (size_t op : members) {
+            bool fits = waveCores + ops[op].cores <= maxWidth;
+            if (!wave.empty() && (ops[op].exclusive || !fits ||
+                                  ops[wave.front()].exclusive)) {
+                waves.push_back(wave);
+                wave.clear();
+                waveCores = 0;
+            }
+            wave.push_back(op);
+            waveCores += ops[op].cores;
+        }
+        if (!wave.empty()) waves.push_back(wave);
+    }
+    return waves;
+}
+
+}
@@ -0,0 +1,398 @@
+#include "Runtime.h"
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+
+using namespace std;
+
+namespace Runtime {
+
+static const int ELEMENT_BYTES = sizeof(int32_t);
+
+namespace {
+
+// An ALLOC region and the LAYOUT declared for it
+struct Region {
+    int64_t bytes = 0;
+    string kind;          // ROW, COL or BLOCK; empty for transfer buffers
+    int64_t rows = 0, cols = 0;
+    int64_t pitch = 0;
+    int64_t tile = 0;
+    bool laidOut = false; // contents in the layout rather than host row-major order
+};
+
+// Element (r, c) of a matrix operand in PIM memory
+struct View {
+    uint8_t* base = nullptr;
+    char kind = 'R';      // R: rows at pitch, C: columns at pitch, B: square tiles
+    int64_t pitch = 0;
+    int64_t tile = 0;
+    int64_t tilesPerRow = 0;
+    
+    int64_t offset(int64_t r, int64_t c) const {
+        switch (kind) {
+            case 'C': return c * pitch + r * ELEMENT_BYTES;
+            case 'B': return ((r / tile) * tilesPerRow + c / tile) * tile * tile * ELEMENT_BYTES +
+                             (r % tile) * tile * ELEMENT_BYTES + (c % tile) * ELEMENT_BYTES;
+            default: return r * pitch + c * ELEMENT_BYTES;
+        }
+    }
+    uint32_t get(int64_t r, int64_t c) const {
+        uint32_t value;
+        memcpy(&value, base + offset(r, c), sizeof(value));
+        return value;
+    }
+    void set(int64_t r, int64_t c, uint32_t value) const {
+        memcpy(base + offset(r, c), &value, sizeof(value));
+    }
+};
+
+// Functional model of one PIM device: a memory image, its regions and the
+// routines of the program it loaded. Integer arithmetic wraps like the hardware.
+class Simulator : public Device {
+public:
+    void load(shared_ptr<const Program> loaded, const Bindings& constants) override {
+        program = std::move(loaded);
+        memory.assign(program->memoryBytes(), 0);
+        regions.clear();
+        execute(0, program->bodyBegin(), constants);
+    }
+    
+    void run(const Bindings& bindings) override {
+        if (!program) {
+            throw runtime_error("No program loaded");
+        }
+        if (program->implicitTransfers()) stage(bindings, true);
+        execute(program->bodyBegin(), program->bodyEnd(), bindings);
+        if (program->implicitTransfers()) stage(bindings, false);
+    }
+
+private:
+    shared_ptr<const Program> program;
+    vector<uint8_t> memory;
+    map<int64_t, Region> regions;      // by start address
+    vector<int64_t> iterations;        // of every enclosing loop
+    vector<uint32_t> lhs, rhs, result; // dense operands of the current EXE
+    
+    // Bytes an EXE writes, which the cores may still be writing until the next SYNC
+    struct Write {
+        int64_t low = 0, high = 0;
+        size_t line = 0;
+    };
+    vector<Write> unsynced;
+    
+    [[noreturn]] void fail(const Instruction& instruction, const string& message) const {
+        throw runtime_error("line " + to_string(instruction.line) + ": " + message);
+    }
+    
+    int64_t evaluate(const Address& address) const {
+        int64_t value = address.offset;
+        for (const auto& [depth, stride] : address.strides) {
+            value += stride * iterations[depth];
+        }
+        return value;
+    }
+    
+    Region& regionAt(const Instruction& instruction, int64_t address) {
+        auto region = regions.upper_bound(address);
+        if (region == regions.begin() || address >= prev(region)->first + prev(region)->second.bytes) {
+            fail(instruction, "address " + to_string(address) + " is not allocated");
+        }
+        return prev(region)->second;
+    }
+    
+    // The operand at an address, rows x cols, as stored in its region now
+    View view(const Instruction& instruction, int64_t address, int64_t rows, int64_t cols) {
+        Region& region = regionAt(instruction, address);
+        View view;
+        view.base = memory.data() + address;
+        view.pitch = cols * ELEMENT_BYTES;
+        if (!region.kind.empty() && (region.laidOut || region.kind == "ROW")) {
+            if (region.kind == "COL") {
+                view.kind = 'C';
+                view.pitch = region.pitch;
+            } else if (region.kind == "BLOCK") {
+                view.kind = 'B';
+                view.tile = region.tile;
+                view.tilesPerRow = (region.cols + region.tile - 1) / region.tile;
+            } else if (region.rows > 1) {
+                // A one-row region holds a vector, which operands walk either way
+                view.pitch = region.pitch;
+            }
+        } else if (!region.kind.empty()) {
+            view.pitch = region.cols * ELEMENT_BYTES; // loaded dense, before its XFORM
+        }
+        if (rows > 0 && cols > 0 && address + view.offset(rows - 1, cols - 1) + ELEMENT_BYTES >
+                                        static_cast<int64_t>(memory.size())) {
+            fail(instruction, "operand at " + to_string(address) + " runs past PIM memory");
+        }
+        return view;
+    }
+    
+    // Bytes from the operand's address to its last element, rows x cols
+    static int64_t extent(const View& view, int64_t rows, int64_t cols) {
+        return max({view.offset(rows - 1, cols - 1), view.offset(rows - 1, 0), view.offset(0, cols - 1)}) +
+               ELEMENT_BYTES;
+    }
+    
+    // Reading memory an earlier EXE writes is a race until a SYNC
+    void await(const Instruction& instruction, int64_t low, int64_t high, const string& what) const {
+        for (const auto& write : unsynced) {
+            if (low < write.high && write.low < high) {
+                fail(instruction, what + " at " + to_string(low) + " while the EXE on line " +
+                                  to_string(write.line) + " may still be writing it; SYNC first");
+            }
+        }
+    }
+    
+    // Host row-major view of a region with a layout
+    View hostView(const Instruction& instruction, int64_t address, const Region& region) {
+        View view;
+        view.base = memory.data() + address;
+        view.pitch = region.kind == "ROW" ? region.pitch : region.cols * ELEMENT_BYTES;
+        if (address + view.offset(region.rows - 1, region.cols - 1) + ELEMENT_BYTES >
+            static_cast<int64_t>(memory.size())) {
+            fail(instruction, "region at " + to_string(address) + " runs past PIM memory");
+        }
+        return view;
+    }
+    
+    void gather(const View& view, int64_t rowOffset, int64_t rows, int64_t cols, vector<uint32_t>& into) {
+        into.resize(rows * cols);
+        for (int64_t r = 0; r < rows; r++) {
+            for (int64_t c = 0; c < cols; c++) {
+                into[r * cols + c] = view.get(rowOffset + r, c);
+            }
+        }
+    }
+    
+    void scatter(const View& view, int64_t rowOffset, int64_t rows, int64_t cols, const vector<uint32_t>& from) {
+        for (int64_t r = 0; r < rows; r++) {
+            for (int64_t c = 0; c < cols; c++) {
+                view.set(rowOffset + r, c, from[r * cols + c]);
+            }
+        }
+    }
+    
+    const Bindings::Buffer& buffer(const Instruction& instruction, const Bindings& bindings, const string& name) {
+        const Bindings::Buffer* buffer = bindings.find(name);
+        if (!buffer) {
+            fail(instruction, "no binding for " + name);
+        }
+        return *buffer;
+    }
+    
+    void transfer(const Instruction& instruction, const Bindings& bindings) {
+        bool load = instruction.opcode == Instruction::LOAD;
+        const Address& host = instruction.addresses[load ? 1 : 0];
+        int64_t device = evaluate(instruction.addresses[load ? 0 : 1]);
+        int64_t offset = evaluate(host);
+        int64_t rows = instruction.values[0], rowBytes = instruction.values[1], pitch = instruction.values[2];
+        const Bindings::Buffer& source = buffer(instruction, bindings, host.host);
+        if (offset < 0 || offset + (rows - 1) * rowBytes + rowBytes >
+                              static_cast<int64_t>(source.elements) * ELEMENT_BYTES) {
+            fail(instruction, "transfer runs past the binding for " + host.host);
+        }
+        if (device < 0 || device + (rows - 1) * pitch + rowBytes > static_cast<int64_t>(memory.size())) {
+            fail(instruction, "transfer runs past PIM memory");
+        }
+        if (!load && !source.writable) {
+            fail(instruction, "STORE to " + host.host + ", which is bound as an input");
+        }
+        if (!load) await(instruction, device, device + (rows - 1) * pitch + rowBytes, "STORE reads");
+        
+        // Straight between the caller's buffer and PIM memory
+        for (int64_t r = 0; r < rows; r++) {
+            uint8_t* pim = memory.data() + device + r * pitch;
+            if (load) {
+                memcpy(pim, reinterpret_cast<const uint8_t*>(source.data) + offset + r * rowBytes, rowBytes);
+            } else {
+                memcpy(reinterpret_cast<uint8_t*>(source.writable) + offset + r * rowBytes, pim, rowBytes);
+            }
+        }
+        if (load) regionAt(instruction, device).laidOut = false;
+    }
+    
+    // Reorder a region between host row-major order and its layout
+    void transform(const Instruction& instruction) {
+        int64_t address = evaluate(instruction.addresses[0]);
+        Region& region = regionAt(instruction, address);
+        if (region.kind.empty()) {
+            fail(instruction, "XFORM of a region without a layout");
+        }
+        bool toLayout = instruction.name != "ROW";
+        if (toLayout && instruction.name != region.kind) {
+            fail(instruction, "XFORM to " + instruction.name + " of a " + region.kind + " region");
+        }
+        if (region.kind == "ROW" || region.laidOut == toLayout) return;
+        await(instruction, address, address + region.bytes, "XFORM reorders");
+        
+        View host = hostView(instruction, address, region);
+        View laid = (region.laidOut = true, view(instruction, address, region.rows, region.cols));
+        gather(toLayout ? host : laid, 0, region.rows, region.cols, result);
+        scatter(toLayout ? laid : host, 0, region.rows, region.cols, result);
+        region.laidOut = toLayout;
+    }
+    
+    void compute(const Instruction& instruction) {
+        const auto& sizes = instruction.values;
+        int64_t A = evaluate(instruction.addresses[0]);
+        int64_t B = evaluate(instruction.addresses[1]);
+        int64_t C = evaluate(instruction.addresses[2]);
+        if (instruction.name == "matrix_add") {
+            // Z = X + Y, M x N
+            if (sizes.size() != 2) fail(instruction, "matrix_add takes M, N");
+            int64_t M = sizes[0], N = sizes[1];
+            View x = view(instruction, A, M, N), y = view(instruction, B, M, N), z = view(instruction, C, M, N);
+            await(instruction, A, A + extent(x, M, N), "EXE reads");
+            await(instruction, B, B + extent(y, M, N), "EXE reads");
+            gather(x, 0, M, N, lhs);
+            gather(y, 0, M, N, rhs);
+            result.resize(M * N);
+            for (int64_t i = 0; i < M * N; i++) result[i] = lhs[i] + rhs[i];
+            scatter(z, 0, M, N, result);
+            unsynced.push_back({C, C + extent(z, M, N), instruction.line});
+            return;
+        }
+        
+        // C = A * B for each product of a batch, stacked one below the other
+        if (sizes.size() != 1 && sizes.size() != 3) fail(instruction, "products take M or M, N, K");
+        int64_t M = sizes[0];
+        int64_t N = sizes.size() == 3 ? sizes[1] : M;
+        int64_t K = sizes.size() == 3 ? sizes[2] : M;
+        int64_t batch = instruction.batch;
+        View a = view(instruction, A, batch * M, K);
+        View b = view(instruction, B, batch * K, N);
+        View c = view(instruction, C, batch * M, N);
+        await(instruction, A, A + extent(a, batch * M, K), "EXE reads");
+        await(instruction, B, B + extent(b, batch * K, N), "EXE reads");
+        unsynced.push_back({C, C + extent(c, batch * M, N), instruction.line});
+        for (int64_t p = 0; p < batch; p++) {
+            gather(a, p * M, M, K, lhs);
+            gather(b, p * K, K, N, rhs);
+            result.assign(M * N, 0);
+            for (int64_t i = 0; i < M; i++) {
+                for (int64_t k = 0; k < K; k++) {
+                    uint32_t scale = lhs[i * K + k];
+                    for (int64_t j = 0; j < N; j++) {
+                        result[i * N + j] += scale * rhs[k * N + j];
+                    }
+                }
+            }
+            scatter(c, p * M, M, N, result);
+        }
+    }
+    
+    // Move bound matrices into their allocations before the body, or bound
+    // outputs back after it, for programs that leave transfers to the host
+    void stage(const Bindings& bindings, bool in) {
+        Instruction context;
+        for (const auto& [name, address] : program->allocations()) {
+            const Matrix* matrix = program->matrix(name);
+            const Bindings::Buffer* buffer = bindings.find(name);
+            if (!matrix || !buffer || (!in && !matrix->output)) continue;
+            Region& region = regionAt(context, address);
+            if (region.kind.empty()) continue;
+            result.resize(region.rows * region.cols);
+            if (in) {
+                memcpy(result.data(), buffer->data, result.size() * ELEMENT_BYTES);
+                region.laidOut = false;
+                scatter(hostView(context, address, region), 0, region.rows, region.cols, result);
+            } else {
+                gather(view(context, address, region.rows, region.cols), 0, region.rows, region.cols, result);
+                memcpy(buffer->writable, result.data(), result.size() * ELEMENT_BYTES);
+            }
+        }
+    }
+    
+    void execute(size_t begin, size_t end, const Bindings& bindings) {
+        const auto& code = program->instructions();
+        iterations.clear();
+        unsynced.clear();
+        for (size_t pc = begin; pc < end; pc++) {
+            const Instruction& instruction = code[pc];
+            switch (instruction.opcode) {
+                case Instruction::ALLOC: {
+                    int64_t address = evaluate(instruction.addresses[0]);
+                    int64_t bytes = instruction.values.empty() ? 0 : instruction.values[0];
+                    if (address < 0 || address + bytes > static_cast<int64_t>(memory.size())) {
+                        fail(instruction, "ALLOC outside PIM memory");
+                    }
+                    regions[address] = Region();
+                    regions[address].bytes = bytes;
+                    fill(memory.begin() + address, memory.begin() + address + bytes, 0);
+                    break;
+                }
+                case Instruction::LAYOUT: {
+                    Region& region = regionAt(instruction, evaluate(instruction.addresses[0]));
+                    region.kind = instruction.name;
+                    region.rows = instruction.values[0];
+                    region.cols = instruction.values[1];
+                    region.pitch = instruction.values[2];
+                    region.tile = instruction.values.size() > 3 ? instruction.values[3] : 0;
+                    if (region.kind == "BLOCK" && region.tile <= 0) fail(instruction, "BLOCK layout without a tile");
+                    break;
+                }
+                case Instruction::FREE: {
+                    auto region = regions.find(evaluate(instruction.addresses[0]));
+                    if (region == regions.end()) break;
+                    await(instruction, region->first, region->first + region->second.bytes, "FREE releases");
+                    regions.erase(region);
+                    break;
+                }
+                case Instruction::EXE:
+                    compute(instruction);
+                    break;
+                case Instruction::LOAD:
+                case Instruction::STORE:
+                    transfer(instruction, bindings);
+                    break;
+                case Instruction::XFORM:
+                    transform(instruction);
+                    break;
+                case Instruction::LOOP:
+                    if (instruction.values[0] <= 0) {
+                        pc = instruction.partner;
+                    } else {
+                        iterations.push_back(0);
+                    }
+                    break;
+                case Instruction::ENDLOOP:
+                    if (++iterations.back() < code[instruction.partner].values[0]) {
+                        pc = instruction.partner;
+                    } else {
+                        iterations.pop_back();
+                    }
+                    break;
+                case Instruction::SYNC:
+                    // Every core has finished; their results are visible from here on
+                    unsynced.clear();
+                    break;
+            }
+        }
+        if (!unsynced.empty()) {
+            throw runtime_error("line " + to_string(unsynced.back().line) +
+                                ": the program ends while this EXE may still be running");
+        }
+    }
+};
+
+// Accepts every invocation and computes nothing
+class Stub : public Device {
+public:
+    void load(shared_ptr<const Program>, const Bindings&) override {}
+    void run(const Bindings&) override {}
+};
+
+}
+
+unique_ptr<Device> makeSimulator() {
+    return make_unique<Simulator>();
+}
+
+unique_ptr<Device> makeStub() {
+    return make_unique<Stub>();
+}
+
+}
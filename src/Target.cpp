@@ -0,0 +1,115 @@
+#include "Target.h"
+#include <algorithm>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+
+using namespace std;
+
+namespace Target {
+
+static string trim(const string& text) {
+    size_t begin = text.find_first_not_of(" \t\r");
+    if (begin == string::npos) return "";
+    size_t end = text.find_last_not_of(" \t\r");
+    return text.substr(begin, end - begin + 1);
+}
+
+Description load(const string& path) {
+    ifstream input(path);
+    if (!input.is_open()) {
+        throw runtime_error("Could not open target file: " + path);
+    }
+    
+    Description target;
+    string line;
+    int lineNumber = 0;
+    while (getline(input, line)) {
+        lineNumber++;
+        line = trim(line.substr(0, line.find('#')));
+        if (line.empty()) continue;
+        
+        auto fail = [&](const string& message) {
+            throw runtime_error(path + ":" + to_string(lineNumber) + ": " + message);
+        };
+        size_t equals = line.find('=');
+        if (equals == string::npos) fail("expected key = value");
+        string key = trim(line.substr(0, equals));
+        string value = trim(line.substr(equals + 1));
+        if (key == "name") {
+            target.name = value;
+            continue;
+        }
+        
+        int number = 0;
+        try {
+            size_t used = 0;
+            number = stoi(value, &used, 0);
+            if (used != value.size()) fail("malformed number '" + value + "'");
+        } catch (const logic_error&) {
+            fail("malformed number '" + value + "'");
+        }
+        
+        if (key == "channels") target.channels = number;
+        else if (key == "banks") target.banks = number;
+        else if (key == "subarrays") target.subarrays = number;
+        else if (key == "row_bytes") target.row_bytes = number;
+        else if (key == "bank_bytes") target.bank_bytes = number;
+        else if (key == "cores") target.cores = number;
+        else if (key == "reserved_bytes") target.reserved_bytes = number;
+        else fail("unknown key '" + key + "'");
+    }
+    
+    validate(target);
+    return target;
+}
+
+void validate(const Description& target) {
+    if (target.channels <= 0 || target.banks <= 0 || target.subarrays <= 0 ||
+        target.row_bytes <= 0 || target.bank_bytes <= 0 || target.cores <= 0 ||
+        target.reserved_bytes < 0) {
+        throw runtime_error("Target " + target.name + ": every size and count must be positive");
+    }
+    if (target.bank_bytes % target.subarrays != 0 || subarrayBytes(target) % target.row_bytes != 0) {
+        throw runtime_error("Target " + target.name + ": a bank must split into subarrays of whole rows");
+    }
+    if (target.reserved_bytes >= target.bank_bytes) {
+        throw runtime_error("Target " + target.name + ": reserved space fills bank 0");
+    }
+    if (static_cast<long long>(totalBanks(target)) * target.bank_bytes > numeric_limits<int>::max()) {
+        throw runtime_error("Target " + target.name + ": address space too large");
+    }
+}
+
+int totalBanks(const Description& target) {
+    return target.channels * target.banks;
+}
+
+int subarrayBytes(const Description& target) {
+    return target.bank_bytes / target.subarrays;
+}
+
+int totalBytes(const Description& target) {
+    return totalBanks(target) * target.bank_bytes;
+}
+
+int bankOf(const Description& target, int address) {
+    return address / target.bank_bytes;
+}
+
+string key(const Description& target) {
+    string name = target.name;
+    replace(name.begin(), name.end(), ' ', '_');
+    return name + "/" + to_string(target.channels) + "x" + to_string(target.banks) + "x" +
+           to_string(target.subarrays) + "/" + to_string(target.row_bytes) + "/" +
+           to_string(target.bank_bytes) + "/" + to_string(target.cores) + "c";
+}
+
+string summary(const Description& target) {
+    return target.name + ": " + to_string(target.channels) + " channel(s) x " +
+           to_string(target.banks) + " bank(s) x " + to_string(target.subarrays) + " subarray(s), " +
+           to_string(target.row_bytes) + "-byte rows, " + to_string(target.bank_bytes) +
+           " bytes per bank, " + to_string(target.cores) + " core(s)";
+}
+
+}
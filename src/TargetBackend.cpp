@@ -1,46 +1,809 @@
 #include "TargetBackend.h"
+#include <cctype>
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
 #include <fstream>
 #include <iostream>
-#include <regex>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <string_view>
 
 namespace TargetBackend {
 
+std::string formatISA(const std::vector<std::string>& instructions) {
+    // Loop bodies are indented one level per enclosing LOOP
+    std::string text;
+    size_t depth = 0;
+    for (const auto& instr : instructions) {
+        if (instr.compare(0, 7, "ENDLOOP") == 0 && depth > 0) depth--;
+        if (!instr.empty()) text.append(depth * 4, ' ');
+        text += instr;
+        text += '\n';
+        if (instr.compare(0, 5, "LOOP ") == 0) depth++;
+    }
+    return text;
+}
+
 void emitISA(const std::vector<std::string>& instructions, const std::string& filename) {
     std::ofstream output(filename);
     if (!output.is_open()) {
         throw std::runtime_error("Could not open output file: " + filename);
     }
+    output << formatISA(instructions);
+    output.close();
+    std::cout << "ISA instructions successfully written to " << filename << std::endl;
+}
+
+namespace {
+
+std::string_view trim(std::string_view text) {
+    size_t begin = text.find_first_not_of(" \t\r");
+    if (begin == std::string_view::npos) return {};
+    size_t end = text.find_last_not_of(" \t\r");
+    return text.substr(begin, end - begin + 1);
+}
+
+// Decimal or 0x-prefixed hexadecimal
+bool parseNumber(std::string_view text, uint64_t& value) {
+    int base = 10;
+    if (text.size() > 2 && text[0] == '0' && (text[1] == 'x' || text[1] == 'X')) {
+        text.remove_prefix(2);
+        base = 16;
+    }
+    if (text.empty()) return false;
+    auto result = std::from_chars(text.data(), text.data() + text.size(), value, base);
+    return result.ec == std::errc() && result.ptr == text.data() + text.size();
+}
+
+bool isIdentifier(std::string_view text) {
+    if (text.empty() || !(isalpha(static_cast<unsigned char>(text[0])) || text[0] == '_')) {
+        return false;
+    }
+    for (char c : text) {
+        if (!(isalnum(static_cast<unsigned char>(c)) || c == '_')) return false;
+    }
+    return true;
+}
+
+// A prefix letter followed by digits, e.g. r2 or c0
+bool isNumbered(std::string_view text, char prefix, uint64_t& number) {
+    return text.size() > 1 && text[0] == prefix && isdigit(static_cast<unsigned char>(text[1])) &&
+           parseNumber(text.substr(1), number);
+}
+
+std::string hexAddress(uint64_t address) {
+    std::ostringstream ss;
+    ss << "0x" << std::hex << address;
+    return ss.str();
+}
+
+class Verifier {
+public:
+    Verifier(size_t maxDiagnostics) : limit(maxDiagnostics) {}
     
-    for (const auto& instr : instructions) {
-        output << instr << std::endl;
+    std::vector<Diagnostic> run(const std::vector<std::string>& instructions) {
+        for (size_t i = 0; i < instructions.size() && diagnostics.size() < limit; i++) {
+            line = i + 1;
+            std::string_view text = instructions[i];
+            text = trim(text.substr(0, text.find('#')));
+            if (!text.empty()) {
+                check(text);
+            }
+        }
+        if (diagnostics.size() >= limit) return diagnostics;
+        
+        line = instructions.size();
+        if (!program.empty()) {
+            report("PROG " + program + " is never closed with END " + program);
+        }
+        for (const auto& loop : loops) {
+            report("LOOP " + loop.var + " on line " + std::to_string(loop.line) + " is never closed");
+        }
+        if (!ended) {
+            report("program does not finish with END");
+        }
+        for (const auto& [start, region] : live) {
+            report("region " + hexAddress(start) + " allocated on line " +
+                   std::to_string(region.line) + " is never freed");
+        }
+        return diagnostics;
     }
+
+private:
+    struct Region {
+        uint64_t bytes = 0;
+        size_t line = 0;
+        std::string kind; // of its LAYOUT; empty for transfer buffers
+        uint64_t rows = 0, cols = 0, pitch = 0, tile = 0;
+    };
     
-    output.close();
-    std::cout << "ISA instructions successfully written to " << filename << std::endl;
+    size_t limit;
+    size_t line = 0;
+    std::vector<Diagnostic> diagnostics;
+    std::vector<std::string_view> operands;
+    
+    bool windowSet = false;
+    uint64_t windowLow = 0, windowHigh = 0;
+    std::map<uint64_t, Region> live;     // start -> region, for ALLOC until FREE
+    std::map<uint64_t, uint64_t> freed;  // start -> bytes, for use-after-FREE reports
+    std::map<std::string, size_t> bound; // host matrix -> line of its BIND
+    std::vector<std::string> programmed;  // routine of each register, empty until its PROG ends
+    std::string program;                  // PROG block being defined
+    uint64_t programRegister = 0;
+    bool ended = false;
+    size_t running = 0;                   // line of an EXE no SYNC has waited for yet, 0 if none
+    
+    struct Loop {
+        std::string var;
+        uint64_t count;
+        size_t line;
+    };
+    std::vector<Loop> loops;              // enclosing LOOPs, outermost first
+    
+    void report(const std::string& message) {
+        if (diagnostics.size() < limit) {
+            diagnostics.push_back({line, message});
+        }
+    }
+    
+    // Split comma-separated operands; false if any is empty or holds a space
+    bool splitOperands(std::string_view text) {
+        operands.clear();
+        if (text.empty()) return true;
+        size_t pos = 0;
+        while (true) {
+            size_t comma = text.find(',', pos);
+            std::string_view operand = trim(text.substr(pos, comma == std::string_view::npos ?
+                                                                 std::string_view::npos : comma - pos));
+            if (operand.empty() || operand.find_first_of(" \t") != std::string_view::npos) {
+                return false;
+            }
+            operands.push_back(operand);
+            if (comma == std::string_view::npos) return true;
+            pos = comma + 1;
+        }
+    }
+    
+    // Whitespace-separated operands, as used by ALLOCATE, ALLOC and FREE
+    void splitWords(std::string_view text) {
+        operands.clear();
+        size_t pos = 0;
+        while ((pos = text.find_first_not_of(" \t", pos)) != std::string_view::npos) {
+            size_t end = text.find_first_of(" \t", pos);
+            operands.push_back(text.substr(pos, end == std::string_view::npos ? end : end - pos));
+            pos = end;
+        }
+    }
+    
+    bool expectCount(std::string_view opcode, size_t low, size_t high) {
+        if (operands.size() >= low && operands.size() <= high) return true;
+        std::string expected = low == high ? std::to_string(low) :
+                               std::to_string(low) + "-" + std::to_string(high);
+        report(std::string(opcode) + " takes " + expected + " operands, found " +
+               std::to_string(operands.size()));
+        return false;
+    }
+    
+    bool number(std::string_view text, uint64_t& value, const char* what) {
+        if (parseNumber(text, value)) return true;
+        report("malformed " + std::string(what) + " '" + std::string(text) + "'");
+        return false;
+    }
+    
+    bool positive(std::string_view text, uint64_t& value, const char* what) {
+        if (!number(text, value, what)) return false;
+        if (value > 0) return true;
+        report(std::string(what) + " must be positive");
+        return false;
+    }
+    
+    // Live region containing address, or nullptr
+    const std::pair<const uint64_t, Region>* regionAt(uint64_t address) const {
+        auto it = live.upper_bound(address);
+        if (it == live.begin()) return nullptr;
+        --it;
+        return address < it->first + it->second.bytes ? &*it : nullptr;
+    }
+    
+    // Lowest and highest value of base+offset+var*stride+... over every iteration
+    // of the enclosing loops; a host operand starts with its buffer name instead
+    bool addressRange(std::string_view text, bool host, uint64_t& low, uint64_t& high) const {
+        low = high = 0;
+        size_t pos = 0;
+        for (bool first = true; pos <= text.size(); first = false) {
+            size_t plus = text.find('+', pos);
+            std::string_view term = text.substr(pos, plus == std::string_view::npos ? plus : plus - pos);
+            pos = plus == std::string_view::npos ? text.size() + 1 : plus + 1;
+            
+            uint64_t value;
+            size_t star = term.find('*');
+            if (first && host) {
+                if (!isIdentifier(term)) return false;
+            } else if (star != std::string_view::npos) {
+                // var*stride: stride bytes per iteration of an enclosing loop
+                std::string_view var = term.substr(0, star);
+                auto loop = std::find_if(loops.begin(), loops.end(),
+                                         [&](const Loop& l) { return l.var == var; });
+                if (loop == loops.end() || !parseNumber(term.substr(star + 1), value)) return false;
+                high += value * (loop->count - 1);
+            } else {
+                if (!parseNumber(term, value)) return false;
+                low += value;
+                high += value;
+            }
+        }
+        return !(host && text.find('+') == std::string_view::npos);
+    }
+    
+    // An access of extent bytes at address must lie inside the window and one
+    // live region, on every loop iteration
+    bool access(std::string_view text, uint64_t extent, const char* role) {
+        uint64_t address, last;
+        if (!addressRange(text, false, address, last)) {
+            report("malformed " + std::string(role) + " '" + std::string(text) + "'");
+            return false;
+        }
+        if (!windowSet) {
+            report("memory access before ALLOCATE");
+            return false;
+        }
+        if (address < windowLow || last + extent - 1 > windowHigh) {
+            report(std::string(role) + " " + hexAddress(address) + " lies outside the ALLOCATE window");
+            return false;
+        }
+        
+        auto region = regionAt(address);
+        if (!region) {
+            auto it = freed.upper_bound(address);
+            if (it != freed.begin() && address < std::prev(it)->first + std::prev(it)->second) {
+                report(std::string(role) + " " + hexAddress(address) + " used after FREE");
+            } else {
+                report(std::string(role) + " " + hexAddress(address) + " is not inside any allocated region");
+            }
+            return false;
+        }
+        if (last + extent > region->first + region->second.bytes) {
+            report(std::string(role) + " " + std::string(text) + " runs " +
+                   std::to_string(last + extent - region->first - region->second.bytes) +
+                   " bytes past the region at " + hexAddress(region->first));
+            return false;
+        }
+        return true;
+    }
+    
+    // Per-region instructions must name the start of a live region
+    Region* regionStart(std::string_view text, const char* role) {
+        uint64_t address, last;
+        if (!access(text, 1, role)) return nullptr;
+        addressRange(text, false, address, last);
+        auto it = live.find(address);
+        if (it == live.end() || last != address) {
+            report(std::string(role) + " " + hexAddress(address) + " is not the start of a region");
+            return nullptr;
+        }
+        return &it->second;
+    }
+    
+    bool layoutKind(std::string_view kind) {
+        if (kind == "ROW" || kind == "COL" || kind == "BLOCK") return true;
+        report("unknown layout '" + std::string(kind) + "'");
+        return false;
+    }
+    
+    void check(std::string_view text) {
+        size_t split = text.find_first_of(" \t");
+        std::string_view opcode = text.substr(0, split);
+        std::string_view rest = split == std::string_view::npos ? std::string_view() : trim(text.substr(split));
+        
+        if (ended) {
+            report("instruction after END");
+            return;
+        }
+        
+        // Inside a PROG block only microcode and its END are allowed
+        if (!program.empty()) {
+            if (opcode == "EXE") {
+                checkMicrocode(rest);
+            } else if (opcode == "END") {
+                if (rest != program) {
+                    report("END " + std::string(rest) + " closes PROG " + program);
+                }
+                if (programmed.size() <= programRegister) programmed.resize(programRegister + 1);
+                programmed[programRegister] = program;
+                program.clear();
+            } else {
+                report(std::string(opcode) + " inside PROG " + program);
+            }
+            return;
+        }
+        
+        // Memory and program structure stay outside loops, so every region
+        // and routine has a single lifetime
+        if (!loops.empty() && (opcode == "ALLOCATE" || opcode == "ALLOC" || opcode == "FREE" ||
+                               opcode == "BIND" || opcode == "PROG" || opcode == "END")) {
+            report(std::string(opcode) + " inside LOOP " + loops.back().var);
+            return;
+        }
+        
+        if (opcode == "ALLOCATE") {
+            checkAllocate(rest);
+        } else if (opcode == "ALLOC") {
+            checkAlloc(rest);
+        } else if (opcode == "FREE") {
+            checkRunning("FREE");
+            checkFree(rest);
+        } else if (opcode == "PROG") {
+            checkProg(rest);
+        } else if (opcode == "END") {
+            if (!rest.empty()) {
+                report("END " + std::string(rest) + " without a matching PROG");
+            }
+            checkRunning("END");
+            ended = true;
+        } else if (opcode == "EXE") {
+            checkExe(rest);
+            running = line;
+        } else if (opcode == "LAYOUT") {
+            checkLayout(rest);
+        } else if (opcode == "BIND") {
+            checkBind(rest);
+        } else if (opcode == "XFORM") {
+            if (!splitOperands(rest) || !expectCount(opcode, 2, 2)) return;
+            if (regionStart(operands[0], "XFORM address")) layoutKind(operands[1]);
+        } else if (opcode == "LOAD" || opcode == "STORE") {
+            checkTransfer(opcode == "LOAD", rest);
+        } else if (opcode == "SYNC") {
+            if (!rest.empty()) report("SYNC takes no operands");
+            running = 0;
+        } else if (opcode == "LOOP") {
+            checkLoop(rest);
+        } else if (opcode == "ENDLOOP") {
+            if (loops.empty() || rest != loops.back().var) {
+                report("ENDLOOP " + std::string(rest) + " does not close the innermost LOOP");
+            } else {
+                loops.pop_back();
+            }
+        } else {
+            report("unknown opcode '" + std::string(opcode) + "'");
+        }
+    }
+    
+    // Memory is released only once every operation has finished with it
+    void checkRunning(const char* opcode) {
+        if (running) {
+            report(std::string(opcode) + " while the EXE on line " + std::to_string(running) +
+                   " may still be running; SYNC first");
+            running = 0;
+        }
+    }
+    
+    // BIND name, addr: the host matrix a live region holds, once per matrix
+    void checkBind(std::string_view rest) {
+        if (!splitOperands(rest) || !expectCount("BIND", 2, 2)) return;
+        std::string name(operands[0]);
+        if (!isIdentifier(name)) {
+            report("malformed matrix name '" + name + "'");
+        } else if (bound.count(name)) {
+            report("matrix " + name + " already bound on line " + std::to_string(bound[name]));
+        } else if (regionStart(operands[1], "BIND address")) {
+            bound[name] = line;
+        }
+    }
+    
+    // LOOP var, count: repeat the body count times with var running from 0
+    void checkLoop(std::string_view rest) {
+        if (!splitOperands(rest) || !expectCount("LOOP", 2, 2)) return;
+        Loop loop{std::string(operands[0]), 0, line};
+        if (!isIdentifier(operands[0])) {
+            report("malformed loop variable '" + loop.var + "'");
+        } else if (std::any_of(loops.begin(), loops.end(), [&](const Loop& l) { return l.var == loop.var; })) {
+            report("loop variable " + loop.var + " already in use");
+        } else if (positive(operands[1], loop.count, "trip count")) {
+            loops.push_back(loop);
+            return;
+        }
+        // Keep the nest balanced so the matching ENDLOOP is not reported too
+        loops.push_back({loop.var, 1, line});
+    }
+    
+    void checkAllocate(std::string_view rest) {
+        splitWords(rest);
+        if (!expectCount("ALLOCATE", 2, 2)) return;
+        if (windowSet) {
+            report("ALLOCATE repeated");
+            return;
+        }
+        if (!number(operands[0], windowLow, "window start") ||
+            !number(operands[1], windowHigh, "window end")) return;
+        if (windowLow > windowHigh) {
+            report("ALLOCATE window ends before it starts");
+            return;
+        }
+        windowSet = true;
+    }
+    
+    void checkAlloc(std::string_view rest) {
+        splitWords(rest);
+        if (!expectCount("ALLOC", 2, 2)) return;
+        uint64_t address, bytes;
+        if (!number(operands[0], address, "ALLOC address") ||
+            !positive(operands[1], bytes, "ALLOC size")) return;
+        if (!windowSet) {
+            report("ALLOC before ALLOCATE");
+            return;
+        }
+        if (address < windowLow || address + bytes - 1 > windowHigh) {
+            report("region " + hexAddress(address) + "+" + std::to_string(bytes) +
+                   " lies outside the ALLOCATE window");
+            return;
+        }
+        
+        // Neighbours on either side must end before and start after this region
+        auto next = live.lower_bound(address);
+        if (next != live.end() && next->first < address + bytes) {
+            report("region " + hexAddress(address) + " overlaps region " + hexAddress(next->first) +
+                   " allocated on line " + std::to_string(next->second.line));
+            return;
+        }
+        if (next != live.begin()) {
+            auto previous = std::prev(next);
+            if (previous->first + previous->second.bytes > address) {
+                report("region " + hexAddress(address) + " overlaps region " + hexAddress(previous->first) +
+                       " allocated on line " + std::to_string(previous->second.line));
+                return;
+            }
+        }
+        Region region;
+        region.bytes = bytes;
+        region.line = line;
+        live.emplace_hint(next, address, region);
+    }
+    
+    void checkFree(std::string_view rest) {
+        splitWords(rest);
+        if (!expectCount("FREE", 2, 2)) return;
+        uint64_t address, bytes;
+        if (!number(operands[0], address, "FREE address") ||
+            !positive(operands[1], bytes, "FREE size")) return;
+        
+        auto it = live.find(address);
+        if (it == live.end()) {
+            auto gone = freed.find(address);
+            report(gone != freed.end() ? "region " + hexAddress(address) + " freed twice"
+                                       : "FREE of unallocated address " + hexAddress(address));
+            return;
+        }
+        if (it->second.bytes != bytes) {
+            report("FREE " + hexAddress(address) + " releases " + std::to_string(bytes) +
+                   " bytes of a " + std::to_string(it->second.bytes) + "-byte region");
+        }
+        freed[address] = it->second.bytes;
+        live.erase(it);
+    }
+    
+    void checkProg(std::string_view rest) {
+        if (!splitOperands(rest) || !expectCount("PROG", 2, 2)) return;
+        if (!isNumbered(operands[0], 'r', programRegister)) {
+            report("malformed register '" + std::string(operands[0]) + "'");
+            return;
+        }
+        if (!isIdentifier(operands[1])) {
+            report("malformed routine name '" + std::string(operands[1]) + "'");
+            return;
+        }
+        program = std::string(operands[1]);
+    }
+    
+    void checkMicrocode(std::string_view rest) {
+        size_t split = rest.find_first_of(" \t");
+        std::string_view op = rest.substr(0, split);
+        size_t arity;
+        if (op == "ADD" || op == "SUB" || op == "MUL") {
+            arity = 3;
+        } else if (op == "READ" || op == "WRITE") {
+            arity = 2;
+        } else if (op == "ZERO") {
+            arity = 1;
+        } else {
+            report("unknown microcode operation '" + std::string(op) + "'");
+            return;
+        }
+        std::string_view args = split == std::string_view::npos ? std::string_view() : trim(rest.substr(split));
+        if (!splitOperands(args)) {
+            report("malformed operands to EXE " + std::string(op));
+            return;
+        }
+        if (operands.size() != arity) {
+            expectCount("EXE " + std::string(op), arity, arity);
+        }
+    }
+    
+    // EXE reg, A, B, C, M[, N[, K]][, bBATCH][, core]; element-wise routines pass M, N
+    void checkExe(std::string_view rest) {
+        if (!splitOperands(rest)) {
+            report("malformed EXE operands");
+            return;
+        }
+        uint64_t number;
+        if (!operands.empty() && isNumbered(operands.back(), 'c', number)) {
+            operands.pop_back();
+        }
+        
+        // A batch count follows all three dimensions
+        uint64_t batch = 1;
+        bool batched = !operands.empty() && isNumbered(operands.back(), 'b', batch);
+        if (batched) {
+            operands.pop_back();
+            if (operands.size() != 7 || batch == 0) {
+                report("batched EXE takes M, N, K and a positive batch count");
+                return;
+            }
+        }
+        if (operands.size() < 5 || operands.size() > 7) {
+            report("EXE takes a register, three addresses and M, M, N or M, N, K, found " +
+                   std::to_string(operands.size()) + " operands");
+            return;
+        }
+        
+        if (!isNumbered(operands[0], 'r', number)) {
+            report("malformed register '" + std::string(operands[0]) + "'");
+            return;
+        }
+        std::string routine;
+        if (number >= programmed.size() || programmed[number].empty()) {
+            report("EXE on " + std::string(operands[0]) + " before it is programmed with PROG");
+        } else {
+            routine = programmed[number];
+        }
+        
+        uint64_t M, N, K;
+        if (!positive(operands[4], M, "dimension")) return;
+        N = K = M;
+        if (operands.size() >= 6 && !positive(operands[5], N, "dimension")) return;
+        if (operands.size() == 7 && !positive(operands[6], K, "dimension")) return;
+        
+        // Every element the routine touches must lie in the operand's region:
+        // Z = X + Y on M x N operands, one element on the MAC routine, and
+        // otherwise C[M][N] = A[M][K] * B[K][N], stacked batch times
+        uint64_t shapes[3][2] = {{batch * M, K}, {batch * K, N}, {batch * M, N}};
+        if (routine == "matrix_add") {
+            for (auto& shape : shapes) shape[0] = M, shape[1] = N;
+        } else if (routine == "mac_operation") {
+            for (auto& shape : shapes) shape[0] = shape[1] = 1;
+        }
+        const char* roles[3] = {"EXE operand A", "EXE operand B", "EXE operand C"};
+        for (int i = 0; i < 3; i++) {
+            access(operands[i + 1], operandExtent(operands[i + 1], shapes[i][0], shapes[i][1]), roles[i]);
+        }
+    }
+    
+    // Bytes from an operand's address to its last element, rows x cols stored
+    // as the LAYOUT of its region says. Regions without a layout, such as
+    // transfer buffers, hold operands densely, and so does a one-row region
+    // holding a vector.
+    uint64_t operandExtent(std::string_view text, uint64_t rows, uint64_t cols) const {
+        const uint64_t element = sizeof(int);
+        uint64_t address, last;
+        const std::pair<const uint64_t, Region>* found = nullptr;
+        if (addressRange(text, false, address, last)) found = regionAt(address);
+        if (!found || found->second.kind.empty() || found->second.rows == 1) {
+            return rows * cols * element;
+        }
+        const Region& region = found->second;
+        if (region.kind == "COL") {
+            return (cols - 1) * region.pitch + rows * element;
+        }
+        if (region.kind == "BLOCK") {
+            // Through the end of the tile holding the last element
+            uint64_t tilesPerRow = (region.cols + region.tile - 1) / region.tile;
+            uint64_t lastTile = (rows - 1) / region.tile * tilesPerRow + (cols - 1) / region.tile;
+            return (lastTile + 1) * region.tile * region.tile * element;
+        }
+        return (rows - 1) * region.pitch + cols * element;
+    }
+    
+    // LAYOUT addr, KIND, rows, cols, pitch[, tile]
+    void checkLayout(std::string_view rest) {
+        if (!splitOperands(rest) || !expectCount("LAYOUT", 5, 6)) return;
+        Region* region = regionStart(operands[0], "LAYOUT address");
+        if (!region || !layoutKind(operands[1])) return;
+        
+        uint64_t rows, cols, pitch, tile = 0;
+        if (!positive(operands[2], rows, "rows") || !positive(operands[3], cols, "columns") ||
+            !positive(operands[4], pitch, "pitch")) return;
+        bool blocked = operands[1] == "BLOCK";
+        if (blocked != (operands.size() == 6)) {
+            report(blocked ? "BLOCK layout needs a tile edge" : "only BLOCK layouts take a tile edge");
+            return;
+        }
+        
+        uint64_t needed;
+        if (blocked) {
+            if (!positive(operands[5], tile, "tile edge")) return;
+            needed = ((rows + tile - 1) / tile) * ((cols + tile - 1) / tile) * tile * tile * sizeof(int);
+        } else {
+            uint64_t storedRows = operands[1] == "COL" ? cols : rows;
+            uint64_t storedCols = operands[1] == "COL" ? rows : cols;
+            if (pitch < storedCols * sizeof(int)) {
+                report("pitch " + std::to_string(pitch) + " is shorter than a stored row");
+                return;
+            }
+            needed = storedRows * pitch;
+        }
+        if (needed > region->bytes) {
+            report("layout needs " + std::to_string(needed) + " bytes but the region holds " +
+                   std::to_string(region->bytes));
+            return;
+        }
+        region->kind = std::string(operands[1]);
+        region->rows = rows;
+        region->cols = cols;
+        region->pitch = pitch;
+        region->tile = tile;
+    }
+    
+    // LOAD dst, Host+off, rows, rowBytes[, pitch] / STORE Host+off, src, rows, rowBytes[, pitch]
+    void checkTransfer(bool load, std::string_view rest) {
+        const char* opcode = load ? "LOAD" : "STORE";
+        if (!splitOperands(rest) || !expectCount(opcode, 4, 5)) return;
+        std::string_view device = operands[load ? 0 : 1];
+        std::string_view host = operands[load ? 1 : 0];
+        
+        uint64_t low, high;
+        if (!addressRange(host, true, low, high)) {
+            report("malformed host operand '" + std::string(host) + "'");
+            return;
+        }
+        
+        uint64_t rows, rowBytes, pitch;
+        if (!positive(operands[2], rows, "rows") || !positive(operands[3], rowBytes, "row bytes")) return;
+        pitch = rowBytes;
+        if (operands.size() == 5 && !positive(operands[4], pitch, "pitch")) return;
+        if (pitch < rowBytes) {
+            report("pitch " + std::to_string(pitch) + " is shorter than a row");
+            return;
+        }
+        access(device, (rows - 1) * pitch + rowBytes, load ? "LOAD destination" : "STORE source");
+    }
+};
+
+// Cost model of measureISA: a DMA transfer costs its setup plus one cycle per
+// this many bytes, XFORM reorders this many bytes per cycle, SYNC is a barrier
+const double TRANSFER_SETUP_CYCLES = 256;
+const double TRANSFER_BYTES_PER_CYCLE = 32;
+const double XFORM_BYTES_PER_CYCLE = 4;
+const double SYNC_CYCLES = 64;
+
+// Non-empty fields separated by any of the given characters
+std::vector<std::string_view> fields(std::string_view text, const char* separators) {
+    std::vector<std::string_view> result;
+    size_t pos = 0;
+    while ((pos = text.find_first_not_of(separators, pos)) != std::string_view::npos) {
+        size_t end = text.find_first_of(separators, pos);
+        std::string_view field = trim(text.substr(pos, end == std::string_view::npos ? end : end - pos));
+        if (!field.empty()) result.push_back(field);
+        pos = end;
+    }
+    return result;
+}
+
+}
+
+std::vector<Diagnostic> verifyISA(const std::vector<std::string>& instructions, size_t maxDiagnostics) {
+    return Verifier(maxDiagnostics).run(instructions);
 }
 
 bool validateISA(const std::vector<std::string>& instructions) {
-    int exeCount = 0;
-    int endCount = 0;
+    const size_t limit = 20;
+    std::vector<Diagnostic> diagnostics = verifyISA(instructions, limit);
+    for (const auto& diagnostic : diagnostics) {
+        std::cerr << "[TargetBackend] line " << diagnostic.line << ": " << diagnostic.message << std::endl;
+    }
+    if (diagnostics.size() >= limit) {
+        std::cerr << "[TargetBackend] further problems not shown" << std::endl;
+    }
+    return diagnostics.empty();
+}
+
+double transferCycles(double bytes) {
+    return TRANSFER_SETUP_CYCLES + bytes / TRANSFER_BYTES_PER_CYCLE;
+}
+
+Stats measureISA(const std::vector<std::string>& instructions) {
+    Stats stats;
+    std::map<uint64_t, uint64_t> live; // start -> bytes
+    uint64_t liveBytes = 0;
+    std::vector<double> trips{1};      // iterations of the innermost loop body
+    std::map<uint64_t, double> cores;  // busy cycles of each core since the last SYNC
+    double transfers = 0;              // DMA cycles since the last SYNC
+    double cycles = 0;
+    bool inProgram = false;
     
-    for (const auto& instr : instructions) {
-        // Skip comments and empty lines
-        if (instr.empty() || instr[0] == '#') {
+    // Everything issued since the last barrier overlaps; the slowest finishes last
+    auto barrier = [&]() {
+        double longest = transfers;
+        for (const auto& [core, busy] : cores) longest = std::max(longest, busy);
+        cycles += longest;
+        cores.clear();
+        transfers = 0;
+    };
+    
+    for (const auto& instruction : instructions) {
+        std::string_view text = trim(std::string_view(instruction).substr(0, instruction.find('#')));
+        if (text.empty()) continue;
+        size_t split = text.find_first_of(" \t");
+        std::string_view opcode = text.substr(0, split);
+        std::string_view rest = split == std::string_view::npos ? std::string_view() : text.substr(split);
+        double repeat = trips.back();
+        
+        // BIND only tells the host which region holds a matrix
+        if (opcode == "BIND") continue;
+        stats.instructions++;
+        
+        // Microcode runs as part of each EXE of its routine
+        if (inProgram) {
+            inProgram = opcode != "END";
             continue;
         }
         
-        // Track EXE/END pairs
-        if (instr.substr(0, 3) == "EXE") {
-            exeCount++;
-        } else if (instr.substr(0, 3) == "END") {
-            endCount++;
+        uint64_t value;
+        if (opcode == "PROG") {
+            stats.programs++;
+            inProgram = true;
+        } else if (opcode == "ALLOC" || opcode == "FREE") {
+            auto words = fields(rest, " \t");
+            uint64_t address, bytes;
+            if (words.size() != 2 || !parseNumber(words[0], address) || !parseNumber(words[1], bytes)) continue;
+            if (opcode == "ALLOC") {
+                live[address] = bytes;
+                liveBytes += bytes;
+                stats.peakBytes = std::max(stats.peakBytes, liveBytes);
+            } else if (live.count(address)) {
+                liveBytes -= live[address];
+                live.erase(address);
+            }
+        } else if (opcode == "EXE") {
+            // EXE reg, A, B, C, M[, N[, K]][, bBATCH][, cCORE]
+            auto operands = fields(rest, ",");
+            uint64_t core = 0, batch = 1;
+            if (!operands.empty() && isNumbered(operands.back(), 'c', core)) operands.pop_back();
+            if (!operands.empty() && isNumbered(operands.back(), 'b', batch)) operands.pop_back();
+            if (operands.size() < 5) continue;
+            
+            // A single size is a square product; two sizes an element-wise operation
+            double work = static_cast<double>(batch);
+            for (size_t i = 4; i < operands.size(); i++) {
+                if (parseNumber(operands[i], value)) work *= value;
+            }
+            if (operands.size() == 5 && parseNumber(operands[4], value)) work *= static_cast<double>(value) * value;
+            cores[core] += work * repeat;
+        } else if (opcode == "LOAD" || opcode == "STORE") {
+            auto operands = fields(rest, ",");
+            uint64_t rows, rowBytes;
+            if (operands.size() < 4 || !parseNumber(operands[2], rows) || !parseNumber(operands[3], rowBytes)) continue;
+            double bytes = static_cast<double>(rows) * rowBytes;
+            stats.transferBytes += static_cast<uint64_t>(bytes * repeat);
+            transfers += transferCycles(bytes) * repeat;
+        } else if (opcode == "XFORM") {
+            auto operands = fields(rest, ",");
+            if (operands.empty() || !parseNumber(operands[0], value) || !live.count(value)) continue;
+            cores[0] += live[value] / XFORM_BYTES_PER_CYCLE * repeat;
+        } else if (opcode == "SYNC") {
+            barrier();
+            cycles += SYNC_CYCLES * repeat;
+        } else if (opcode == "LOOP") {
+            auto operands = fields(rest, ",");
+            double count = operands.size() == 2 && parseNumber(operands[1], value) ? value : 1;
+            trips.push_back(trips.back() * count);
+        } else if (opcode == "ENDLOOP") {
+            if (trips.size() > 1) trips.pop_back();
         }
-        
-        // Additional checks for instruction syntax could be implemented here
     }
-    
-    // Basic check: ensure each EXE has a corresponding END
-    return exeCount == endCount;
+    barrier();
+    stats.cycles = static_cast<uint64_t>(cycles + 0.5);
+    return stats;
 }
 
 }
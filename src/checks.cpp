@@ -0,0 +1,699 @@
+#include <cstdio>
+#include <iostream>
+#include <functional>
+#include <map>
+#include <random>
+#include <sstream>
+#include "Driver.h"
+#include "Lexer.h"
+#include "Parser.h"
+#include "Runtime.h"
+#include "TargetBackend.h"
+
+using namespace std;
+
+// Behavioral checks of the compiler, one group per ctest case: each group
+// feeds small programs to a stage and reports every expectation it misses
+
+static int failures = 0;
+
+static void expect(bool condition, const string& what) {
+    if (!condition) {
+        cout << "[Checks] FAIL: " << what << endl;
+        failures++;
+    }
+}
+
+// Parse a program quietly and count the matrix operations it recognized
+static int countOperations(const string& source) {
+    streambuf* log = cout.rdbuf(nullptr);
+    Lexer lexer(source);
+    Parser parser(lexer.tokenize());
+    auto ast = parser.parse();
+    cout.rdbuf(log);
+    
+    function<int(const ASTNode*)> count = [&](const ASTNode* node) {
+        int total = node->type == MATRIX_OP_NODE ? 1 : 0;
+        for (const auto& child : node->children) total += count(child.get());
+        return total;
+    };
+    return count(ast.get());
+}
+
+// Compile a program quietly; returns the ISA, or the error as "error: ..."
+static string compileQuietly(const string& source, const vector<string>& flags = {}) {
+    vector<string> args = {"check.cpp", "-o", "check.isa"};
+    args.insert(args.end(), flags.begin(), flags.end());
+    Driver::Options options;
+    string error;
+    if (!Driver::parseArguments(args, options, error)) return "error: " + error;
+    options.verbose = false;
+    Driver::Session session;
+    session.persistent = false;
+    
+    streambuf* log = cout.rdbuf(nullptr);
+    string result;
+    try {
+        result = Driver::compile(source, options, session);
+    } catch (const exception& e) {
+        result = string("error: ") + e.what();
+    }
+    cout.rdbuf(log);
+    return result;
+}
+
+static size_t countLines(const string& text, const string& prefix) {
+    istringstream lines(text);
+    size_t count = 0;
+    for (string line; getline(lines, line);) {
+        if (line.compare(0, prefix.size(), prefix) == 0) count++;
+    }
+    return count;
+}
+
+// A kernel over int A[4][4], B[4][4], C[4][4] and vectors x[4], h[4]
+static string kernel(const string& body) {
+    return "#define N 4\n\n"
+           "void kernel(int A[N][N], int B[N][N], int C[N][N], int x[N], int h[N]) {\n" +
+           body + "}\n";
+}
+
+static const string IJK = "    for (int i = 0; i < N; i++)\n"
+                          "        for (int j = 0; j < N; j++)\n"
+                          "            for (int k = 0; k < N; k++)\n";
+
+// Sets an N x N matrix to 0, as a product accumulating into it requires
+static string zeroed(const string& matrix) {
+    return "    for (int i = 0; i < N; i++)\n"
+           "        for (int j = 0; j < N; j++)\n"
+           "            " + matrix + "[i][j] = 0;\n";
+}
+
+// Statements are lowered only when they compute exactly a product
+static void checkParser() {
+    expect(countOperations(kernel(zeroed("C") + IJK + "                C[i][j] += A[i][k] * B[k][j];\n")) == 1,
+           "C[i][j] += A[i][k] * B[k][j] into a zeroed C is a product");
+    expect(countOperations(kernel(zeroed("C") + IJK + "                C[i][j] = C[i][j] + A[i][k] * B[k][j];\n")) == 1,
+           "C[i][j] = C[i][j] + A[i][k] * B[k][j] into a zeroed C is a product");
+    expect(countOperations(kernel("    for (int i = 0; i < N; i++)\n"
+                                  "        for (int j = 0; j < N; j++) {\n"
+                                  "            C[i][j] = 0;\n"
+                                  "            for (int k = 0; k < N; k++)\n"
+                                  "                C[i][j] += A[i][k] * B[k][j];\n"
+                                  "        }\n")) == 1,
+           "C[i][j] zeroed right before the k loop is a product");
+    expect(countOperations(kernel("    C[0][0] = A[0][0] * B[0][0];\n")) == 1,
+           "a single-element product needs no accumulation");
+    expect(countOperations(kernel("    for (int i = 0; i < N; i++) {\n"
+                                  "        int sum = 0;\n"
+                                  "        for (int k = 0; k < N; k++)\n"
+                                  "            sum += A[i][k] * x[k];\n"
+                                  "        h[i] = sum;\n"
+                                  "    }\n")) == 1,
+           "a product accumulated into a zeroed scalar is a product");
+    
+    expect(countOperations(kernel(IJK + "                C[i][j] += A[i][k] * B[k][j];\n")) == 0,
+           "accumulating into a C never set to 0 is not lowered");
+    expect(countOperations(kernel(IJK + "                C[i][j] = C[i][j] + A[i][k] * B[k][j];\n")) == 0,
+           "reading back a C never set to 0 is not lowered");
+    expect(countOperations(kernel("    C[0][0] = 0;\n" + IJK + "                C[i][j] += A[i][k] * B[k][j];\n")) == 0,
+           "zeroing one element does not zero C");
+    expect(countOperations(kernel(zeroed("C") + "    C[1][2] = 3;\n" + IJK +
+                                  "                C[i][j] += A[i][k] * B[k][j];\n")) == 0,
+           "a store after the zeroing leaves C nonzero");
+    expect(countOperations(kernel(zeroed("C") + IJK + "                C[i][j] += A[i][k] * B[k][j];\n" + IJK +
+                                  "                C[i][j] += A[i][k] * B[k][j];\n")) == 1,
+           "a second product accumulating onto the first is not lowered");
+    expect(countOperations(kernel(IJK + "                C[i][j] = A[i][k] * B[k][j];\n")) == 0,
+           "C[i][j] = A[i][k] * B[k][j] keeps only the last k and is not a product");
+    expect(countOperations(kernel(zeroed("C") + IJK + "                C[i][j] += alpha * A[i][k] * B[k][j];\n")) == 0,
+           "a scaled product is not lowered");
+    expect(countOperations(kernel(zeroed("C") + IJK + "                C[i][j] += 2 * A[i][k] * B[k][j];\n")) == 0,
+           "a product scaled by a constant is not lowered");
+    expect(countOperations(kernel(zeroed("C") + IJK + "                C[i][j] += A[i][k] * B[k][j] + 1;\n")) == 0,
+           "a product with another term is not lowered");
+    expect(countOperations(kernel(zeroed("C") + IJK + "                C[i][j] = C[i][j] - A[i][k] * B[k][j];\n")) == 0,
+           "a subtracted product is not lowered");
+    expect(countOperations(kernel("    for (int i = 0; i < N; i++) {\n"
+                                  "        int sum = 5;\n"
+                                  "        for (int k = 0; k < N; k++)\n"
+                                  "            sum += A[i][k] * x[k];\n"
+                                  "        h[i] = sum;\n"
+                                  "    }\n")) == 0,
+           "a product accumulated onto a nonzero initializer is not lowered");
+    expect(countOperations(kernel("    for (int i = 0; i < N; i++) {\n"
+                                  "        int sum = 0;\n"
+                                  "        for (int k = 0; k < N; k++)\n"
+                                  "            sum += A[i][k] * x[k];\n"
+                                  "        sum = 1;\n"
+                                  "        h[i] = sum;\n"
+                                  "    }\n")) == 0,
+           "an accumulator overwritten before its store is not lowered");
+}
+
+// Sizes come from the program or from well-formed -D overrides of its own
+// #defines; anything else is an error, not a silent default
+static void checkSizes() {
+    string product = kernel(zeroed("C") + IJK + "                C[i][j] += A[i][k] * B[k][j];\n");
+    expect(compileQuietly(product, {"-D", "N=8"}).find(", 0x1000, 0x4000, 0x8000, 8\n") != string::npos,
+           "-D N=8 resizes the product");
+    for (string value : {"N=abc", "N=8x", "N=-4", "N=0", "N="}) {
+        expect(compileQuietly(product, {"-D", value}).rfind("error: ", 0) == 0, "-D " + value + " is rejected");
+    }
+    expect(compileQuietly(product, {"-D", "Q=4"}).find("no #define Q") != string::npos,
+           "-D of a name the program does not define is rejected");
+    
+    string unbounded = kernel("    for (int i = 0; i < LIMIT; i++)\n"
+                              "        for (int j = 0; j < N; j++) {\n"
+                              "            C[i][j] = 0;\n"
+                              "            for (int k = 0; k < N; k++)\n"
+                              "                C[i][j] += A[i][k] * B[k][j];\n"
+                              "        }\n");
+    expect(compileQuietly(unbounded).find("cannot evaluate the bound LIMIT") != string::npos,
+           "a loop bound that does not evaluate is an error");
+}
+
+// Matrices smaller than a device row share rows instead of taking one each
+static void checkLayout() {
+    ostringstream source;
+    source << "#define N 4\n\n";
+    const int kernels = 200;
+    for (int p = 0; p < kernels; p++) {
+        string n = to_string(p);
+        source << "void kernel" << n << "(int A" << n << "[N][N], int B" << n << "[N][N], int C" << n << "[N][N]) {\n"
+               << zeroed("C" + n) << IJK << "                C" << n << "[i][j] += A" << n << "[i][k] * B" << n << "[k][j];\n}\n";
+    }
+    string isa = compileQuietly(source.str());
+    expect(isa.rfind("error: ", 0) != 0, "600 4x4 matrices fit PIM memory (" + isa.substr(0, 80) + ")");
+    expect(countLines(isa, "ALLOC ") == 3 * kernels, "every matrix is allocated");
+    expect(isa.find(" 1024\n") == string::npos, "a 4x4 matrix takes 64 bytes, not a device row");
+    
+    // The attention block of tests/test8: every projection reads X and its
+    // weights and writes its result at once, so the three go to three banks
+    string attention = "#define N 8\n\n"
+                       "void attention(int X[N][N], int Wq[N][N], int Wk[N][N], int Wv[N][N],\n"
+                       "               int Q[N][N], int Kt[N][N], int V[N][N], int S[N][N], int O[N][N]) {\n" +
+                       zeroed("Q") + zeroed("Kt") + zeroed("V") + zeroed("S") + zeroed("O") +
+                       IJK + "                Q[i][j] += X[i][k] * Wq[k][j];\n" +
+                       IJK + "                Kt[i][j] += X[i][k] * Wk[k][j];\n" +
+                       IJK + "                V[i][j] += X[i][k] * Wv[k][j];\n" +
+                       IJK + "                S[i][j] += Q[i][k] * Kt[k][j];\n" +
+                       IJK + "                O[i][j] += S[i][k] * V[k][j];\n"
+                       "}\n";
+    map<string, string> bank; // region address -> bank, from the allocation comments
+    size_t products = 0;
+    istringstream lines(compileQuietly(attention));
+    for (string line; getline(lines, line);) {
+        size_t at = line.find(" allocated at ");
+        if (line.rfind("# Matrix ", 0) == 0 && at != string::npos) {
+            size_t in = line.find(" in bank ");
+            bank[line.substr(at + 14, in - at - 14)] = line.substr(in + 9);
+        }
+        if (line.rfind("EXE r3, ", 0) != 0) continue;
+        
+        // EXE r3, A, B, C, ...
+        vector<string> operands;
+        istringstream fields(line.substr(8));
+        for (string field; getline(fields, field, ',') && operands.size() < 3;) {
+            operands.push_back(bank[field.substr(field.find_first_not_of(' '))]);
+        }
+        products++;
+        expect(operands.size() == 3 && operands[0] != operands[1] && operands[1] != operands[2] &&
+               operands[0] != operands[2], "the operands of " + line + " lie in three banks");
+    }
+    expect(products == 5, "the attention block runs 5 weight-stationary products, found " + to_string(products));
+}
+
+// Functions are planned and generated on a pool of threads; the program must
+// not depend on how many
+static void checkJobs() {
+    const string ikj = "    for (int i = 0; i < N; i++)\n"
+                       "        for (int k = 0; k < N; k++)\n"
+                       "            for (int j = 0; j < N; j++)\n";
+    ostringstream source;
+    source << "#define N 4\n\n";
+    for (int p = 0; p < 48; p++) {
+        string n = to_string(p);
+        source << "void kernel" << n << "(int A" << n << "[N][N], int B" << n << "[N][N], int C" << n
+               << "[N][N], int D" << n << "[N][N], int E" << n << "[N][N]) {\n"
+               << zeroed("C" + n) << zeroed("E" + n) << (p % 3 ? IJK : ikj) << "                C" << n << "[i][j] += A" << n << "[i][k] * B"
+               << n << "[k][j];\n"
+               << IJK << "                E" << n << "[i][j] += C" << n << "[i][k] * D" << n << "[k][j];\n}\n";
+    }
+    for (const auto& flags : vector<vector<string>>{{}, {"--double-buffer"}, {"--resident"}}) {
+        string mode = flags.empty() ? "the default mode" : flags[0];
+        vector<string> serialFlags = flags, parallelFlags = flags;
+        serialFlags.insert(serialFlags.end(), {"-j", "1"});
+        parallelFlags.insert(parallelFlags.end(), {"-j", "8"});
+        string serial = compileQuietly(source.str(), serialFlags);
+        string parallel = compileQuietly(source.str(), parallelFlags);
+        expect(serial.rfind("error: ", 0) != 0, "48 kernels compile in " + mode + " (" + serial.substr(0, 80) + ")");
+        expect(parallel == serial, "-j 8 and -j 1 produce the same program in " + mode);
+    }
+}
+
+// An incremental rebuild plans and generates only the functions that changed,
+// also after the cache went through its file
+static void checkIncremental() {
+    auto source = [](const string& changed) {
+        ostringstream text;
+        text << "#define N 4\n\n";
+        for (int p = 0; p < 40; p++) {
+            string n = to_string(p);
+            text << "void kernel" << n << "(int A" << n << "[N][N], int B" << n << "[N][N], int C" << n
+                 << "[N][N], int D" << n << "[N][N], int E" << n << "[N][N]) {\n"
+                 << zeroed("C" + n) << zeroed("E" + n) << IJK << "                C" << n << "[i][j] += A" << n
+                 << "[i][k] * B" << n << "[k][j];\n"
+                 << (p == 7 ? changed : IJK) << "                E" << n << "[i][j] += D" << n
+                 << "[i][k] * B" << n << "[k][j];\n}\n";
+        }
+        return text.str();
+    };
+    const string output = "check_incremental.isa";
+    const string cache = output + ".cache";
+    remove(cache.c_str());
+    auto build = [&](const string& text, string& log) {
+        Driver::Options options;
+        string error;
+        Driver::parseArguments({"check.cpp", "-o", output, "--incremental"}, options, error);
+        options.verbose = false;
+        Driver::Session session; // a new session reads the cache from its file
+        ostringstream captured;
+        streambuf* previous = cout.rdbuf(captured.rdbuf());
+        string isa;
+        try {
+            isa = Driver::compile(text, options, session);
+        } catch (const exception& e) {
+            isa = string("error: ") + e.what();
+        }
+        cout.rdbuf(previous);
+        log = captured.str();
+        return isa;
+    };
+    
+    string log;
+    string full = build(source(IJK), log);
+    expect(log.find("Planned 40 of 40 functions") != string::npos, "a clean build plans every function");
+    string unchanged = build(source(IJK), log);
+    expect(unchanged == full, "an unchanged rebuild produces the same program");
+    expect(log.find("Planned 0 of 40 functions") != string::npos &&
+           log.find("Reused 40 of 40 function fragments") != string::npos,
+           "an unchanged rebuild plans and generates no function");
+    
+    const string ikj = "    for (int i = 0; i < N; i++)\n"
+                       "        for (int k = 0; k < N; k++)\n"
+                       "            for (int j = 0; j < N; j++)\n";
+    string edited = build(source(ikj), log);
+    remove(cache.c_str());
+    expect(edited.find("# Loop nest ikj") != string::npos, "the edited loop order is compiled");
+    expect(log.find("Planned 1 of 40 functions") != string::npos &&
+           log.find("Reused 39 of 40 function fragments") != string::npos,
+           "editing one function plans and generates only that function");
+}
+
+// A wave that reads results of an earlier wave starts after a SYNC, even
+// when the earlier wave ran a single operation
+static void checkSchedule() {
+    string source = "#define N 8\n\n"
+                    "void fanout(int X[N][N], int Y[N][N], int T[N][N], int W[N][N], int U[N][N],\n"
+                    "            int Z[N][N], int V[N][N]) {\n" +
+                    zeroed("T") + zeroed("U") + zeroed("V") +
+                    IJK + "                T[i][j] += X[i][k] * Y[k][j];\n" +
+                    IJK + "                U[i][j] += T[i][k] * W[k][j];\n" +
+                    IJK + "                V[i][j] += T[i][k] * Z[k][j];\n"
+                    "}\n";
+    string isa = compileQuietly(source);
+    expect(isa.find("# WAVE 0 (1 operation)") != string::npos && isa.find("# WAVE 1 (2 operations)") != string::npos,
+           "T = X * Y runs alone, then U and V side by side");
+    
+    // The last instruction before the second wave
+    size_t wave = isa.find("# WAVE 1");
+    string previous;
+    istringstream lines(isa.substr(0, wave == string::npos ? 0 : wave));
+    for (string line; getline(lines, line);) {
+        if (!line.empty() && line[0] != '#') previous = line;
+    }
+    expect(previous == "SYNC", "a SYNC separates the wave producing T from the waves reading it, got: " + previous);
+    
+    // Memory is released only after the last wave finishes
+    previous.clear();
+    istringstream released(isa.substr(0, isa.find("\nFREE ")));
+    for (string line; getline(released, line);) {
+        if (!line.empty() && line[0] != '#') previous = line;
+    }
+    expect(previous == "SYNC", "a SYNC separates the last wave from the FREEs, got: " + previous);
+    
+    // Results are read back only after the operations writing them finish
+    string layer = "#define N 8\n\n"
+                   "void layer(int X[N][N], int W[N][N], int Y[N][N]) {\n" +
+                   zeroed("Y") + IJK + "                Y[i][j] += X[i][k] * W[k][j];\n"
+                   "}\n\n"
+                   "int main() {\n"
+                   "    layer(A, W, B);\n"
+                   "    layer(B, W, C);\n"
+                   "    return 0;\n"
+                   "}\n";
+    for (const auto& flags : vector<vector<string>>{{"--resident"}, {"--double-buffer"}}) {
+        previous.clear();
+        size_t unsynced = 0;
+        istringstream resident(compileQuietly(layer, flags));
+        for (string line; getline(resident, line);) {
+            if (line.empty() || line[0] == '#') continue;
+            bool readBack = line.rfind("STORE ", 0) == 0 || line.rfind("XFORM ", 0) == 0;
+            if (readBack && previous.rfind("EXE ", 0) == 0) unsynced++;
+            previous = line;
+        }
+        expect(unsynced == 0, flags[0] + ": " + to_string(unsynced) + " result(s) read back right after an EXE");
+    }
+}
+
+// A row-major host matrix
+struct HostMatrix {
+    int rows = 0, cols = 0;
+    vector<int32_t> data;
+};
+
+// Compile a product for several devices along each axis and carry out the
+// plan: scatter blocks of the host matrices, run every device program on the
+// simulator, then gather or reduce the results and compare them with A * B
+static void checkDevices() {
+    const int M = 8, N = 12, K = 16, devices = 3;
+    string source = "#define M 8\n#define N 12\n#define K 16\n\n"
+                    "void gemm(int A[M][K], int B[K][N], int C[M][N]) {\n"
+                    "    for (int i = 0; i < M; i++)\n"
+                    "        for (int j = 0; j < N; j++) {\n"
+                    "            C[i][j] = 0;\n"
+                    "            for (int k = 0; k < K; k++)\n"
+                    "                C[i][j] += A[i][k] * B[k][j];\n"
+                    "        }\n"
+                    "}\n";
+    
+    mt19937 random(5);
+    uniform_int_distribution<int32_t> element(-8, 8);
+    map<string, HostMatrix> host = {{"A", {M, K, {}}}, {"B", {K, N, {}}}, {"C", {M, N, {}}}};
+    for (auto& [name, matrix] : host) {
+        matrix.data.resize(matrix.rows * matrix.cols);
+        for (auto& value : matrix.data) value = element(random);
+    }
+    vector<int32_t> product(M * N, 0);
+    for (int i = 0; i < M; i++) {
+        for (int j = 0; j < N; j++) {
+            for (int k = 0; k < K; k++) product[i * N + j] += host["A"].data[i * K + k] * host["B"].data[k * N + j];
+        }
+    }
+    
+    for (string axis : {"rows", "columns", "k"}) {
+        Driver::Options options;
+        string error;
+        Driver::parseArguments({"check.cpp", "-o", "check.isa", "--devices", to_string(devices), "--partition", axis},
+                               options, error);
+        options.verbose = false;
+        Driver::Session session;
+        session.persistent = false;
+        Partition::Plan plan;
+        vector<Driver::Output> outputs;
+        streambuf* log = cout.rdbuf(nullptr);
+        try {
+            outputs = Driver::compileDevices(source, options, session, &plan);
+        } catch (const exception& e) {
+            error = e.what();
+        }
+        cout.rdbuf(log);
+        if (!error.empty() || outputs.size() != devices + 1u) {
+            expect(false, axis + ": compiling for " + to_string(devices) + " devices failed: " + error);
+            continue;
+        }
+        
+        // The block of a host matrix a transfer moves, dense row-major
+        auto extent = [](const Partition::Transfer& t) { return (t.rowEnd - t.rowBegin) * (t.colEnd - t.colBegin); };
+        auto visit = [&](const Partition::Transfer& t, const function<void(int32_t&, size_t)>& each) {
+            HostMatrix& matrix = host[t.matrix];
+            size_t index = 0;
+            for (int r = t.rowBegin; r < t.rowEnd; r++) {
+                for (int c = t.colBegin; c < t.colEnd; c++) each(matrix.data[r * matrix.cols + c], index++);
+            }
+        };
+        
+        vector<map<string, vector<int32_t>>> blocks(devices);
+        for (const auto& transfer : plan.scatter) {
+            for (int device : transfer.devices) {
+                auto& block = blocks[device][transfer.matrix];
+                block.resize(extent(transfer));
+                visit(transfer, [&](int32_t& value, size_t index) { block[index] = value; });
+            }
+        }
+        for (int device = 0; device < devices; device++) {
+            auto program = Runtime::Program::parse(outputs[device + 1].text);
+            Runtime::Bindings bindings;
+            for (const auto& matrix : program->matrices()) {
+                auto& block = blocks[device][matrix.name];
+                if (matrix.output) {
+                    block.assign(matrix.elements, 0);
+                    bindings.output(matrix.name, block.data(), block.size());
+                } else {
+                    expect(block.size() == matrix.elements, axis + ": device " + to_string(device) + " reads " +
+                                                            to_string(matrix.elements) + " elements of " +
+                                                            matrix.name + ", the plan scatters " +
+                                                            to_string(block.size()));
+                    block.resize(matrix.elements);
+                    bindings.input(matrix.name, block.data(), block.size());
+                }
+            }
+            try {
+                auto simulator = Runtime::makeSimulator();
+                simulator->load(program, bindings);
+                simulator->run(bindings);
+            } catch (const exception& e) {
+                expect(false, axis + ": device " + to_string(device) + " failed: " + e.what());
+            }
+        }
+        
+        host["C"].data.assign(M * N, 0);
+        for (const auto& transfer : plan.gather) {
+            for (int device : transfer.devices) {
+                const auto& block = blocks[device][transfer.matrix];
+                if (block.size() != static_cast<size_t>(extent(transfer))) {
+                    expect(false, axis + ": device " + to_string(device) + " returns " + to_string(block.size()) +
+                                  " elements of " + transfer.matrix + ", the plan gathers " +
+                                  to_string(extent(transfer)));
+                    continue;
+                }
+                bool reduce = transfer.kind == Partition::Transfer::REDUCE;
+                visit(transfer, [&](int32_t& value, size_t index) { value = (reduce ? value : 0) + block[index]; });
+            }
+        }
+        expect(host["C"].data == product, axis + ": the gathered C is not A * B");
+    }
+}
+
+// Lines of a program, for the verifier
+static vector<string> program(const string& text) {
+    vector<string> lines;
+    istringstream stream(text);
+    for (string line; getline(stream, line);) lines.push_back(line);
+    return lines;
+}
+
+// A product too short for the default tile height to pipeline: measuring
+// shorter tiles finds one whose transfers overlap compute
+static void checkAutotune() {
+    string source = "#define M 16\n#define N 64\n\n"
+                    "void tall(int A[M][N], int B[N][N], int C[M][N]) {\n"
+                    "    for (int i = 0; i < M; i++)\n"
+                    "        for (int j = 0; j < N; j++) {\n"
+                    "            C[i][j] = 0;\n"
+                    "            for (int k = 0; k < N; k++)\n"
+                    "                C[i][j] += A[i][k] * B[k][j];\n"
+                    "        }\n"
+                    "}\n";
+    const string database = "check_autotune.db";
+    remove(database.c_str());
+    string standard = compileQuietly(source, {"--double-buffer"});
+    string tuned = compileQuietly(source, {"--double-buffer", "--autotune", "--tuning-db", database});
+    remove(database.c_str());
+    
+    expect(standard.find("1 tile(s) of 16 row(s)") != string::npos, "the default streams A in a single tile");
+    expect(tuned.find("2 tile(s) of 8 row(s)") != string::npos, "the tuner streams A in two 8-row tiles");
+    uint64_t standardCycles = TargetBackend::measureISA(program(standard)).cycles;
+    uint64_t tunedCycles = TargetBackend::measureISA(program(tuned)).cycles;
+    expect(tunedCycles < standardCycles, "the tuned program takes " + to_string(tunedCycles) +
+                                         " cycles, the default " + to_string(standardCycles));
+}
+
+// Expand every LOOP of a program into copies of its body, with each
+// "+t*stride" operand term folded into the offset of its iteration
+static string unrollLoops(const string& isa) {
+    vector<string> lines = program(isa);
+    string text;
+    for (size_t i = 0; i < lines.size(); i++) {
+        if (lines[i].rfind("LOOP ", 0) != 0) {
+            text += lines[i] + "\n";
+            continue;
+        }
+        string var = lines[i].substr(5, lines[i].find(',') - 5);
+        int count = stoi(lines[i].substr(lines[i].find(',') + 1));
+        size_t end = i + 1;
+        while (end < lines.size() && lines[end] != "ENDLOOP " + var) end++;
+        for (int iteration = 0; iteration < count; iteration++) {
+            for (size_t body = i + 1; body < end; body++) {
+                string line = lines[body];
+                string term = "+" + var + "*";
+                for (size_t at; (at = line.find(term)) != string::npos;) {
+                    size_t digits = at + term.size();
+                    size_t stop = line.find_first_not_of("0123456789", digits);
+                    if (stop == string::npos) stop = line.size();
+                    long stride = stol(line.substr(digits, stop - digits));
+                    line.replace(at, stop - at, "+" + to_string(iteration * stride));
+                }
+                text += line + "\n";
+            }
+        }
+        i = end;
+    }
+    return text;
+}
+
+// The strided LOOP of a double-buffered product must do exactly what its
+// unrolled copies do: same results on the simulator, same measured cost
+static void checkLoops() {
+    const int M = 128, N = 64;
+    string source = "#define M 128\n#define N 64\n\n"
+                    "void tall(int A[M][N], int B[N][N], int C[M][N]) {\n"
+                    "    for (int i = 0; i < M; i++)\n"
+                    "        for (int j = 0; j < N; j++) {\n"
+                    "            C[i][j] = 0;\n"
+                    "            for (int k = 0; k < N; k++)\n"
+                    "                C[i][j] += A[i][k] * B[k][j];\n"
+                    "        }\n"
+                    "}\n";
+    string looped = compileQuietly(source, {"--double-buffer"});
+    string unrolled = unrollLoops(looped);
+    expect(looped.find("\nLOOP t, ") != string::npos, "the double-buffered product streams its tiles in a LOOP");
+    expect(unrolled.find("\nLOOP ") == string::npos && unrolled.find("+t*") == string::npos,
+           "unrolling leaves no LOOP or strided operand");
+    
+    mt19937 random(7);
+    uniform_int_distribution<int32_t> element(-8, 8);
+    vector<int32_t> a(M * N), b(N * N), product(M * N, 0);
+    for (auto& value : a) value = element(random);
+    for (auto& value : b) value = element(random);
+    for (int i = 0; i < M; i++) {
+        for (int j = 0; j < N; j++) {
+            for (int k = 0; k < N; k++) product[i * N + j] += a[i * N + k] * b[k * N + j];
+        }
+    }
+    
+    for (const auto& [form, isa] : vector<pair<string, string>>{{"looped", looped}, {"unrolled", unrolled}}) {
+        vector<int32_t> c(M * N, 0);
+        try {
+            auto compiled = Runtime::Program::parse(isa);
+            Runtime::Bindings bindings;
+            bindings.input("A", a.data(), a.size());
+            bindings.input("B", b.data(), b.size());
+            bindings.output("C", c.data(), c.size());
+            auto simulator = Runtime::makeSimulator();
+            simulator->load(compiled, bindings);
+            simulator->run(bindings);
+        } catch (const exception& e) {
+            expect(false, form + ": the simulator failed: " + e.what());
+        }
+        expect(c == product, form + ": C is not A * B");
+    }
+    
+    TargetBackend::Stats loopedStats = TargetBackend::measureISA(program(looped));
+    TargetBackend::Stats unrolledStats = TargetBackend::measureISA(program(unrolled));
+    expect(loopedStats.cycles == unrolledStats.cycles,
+           "the LOOP takes " + to_string(loopedStats.cycles) + " cycles, unrolled " + to_string(unrolledStats.cycles));
+    expect(loopedStats.transferBytes == unrolledStats.transferBytes,
+           "the LOOP moves " + to_string(loopedStats.transferBytes) + " bytes, unrolled " +
+               to_string(unrolledStats.transferBytes));
+}
+
+// The verifier reports a problem on the given line whose message contains text
+static void expectDiagnostic(const string& isa, size_t line, const string& text, const string& what) {
+    auto diagnostics = TargetBackend::verifyISA(program(isa));
+    bool found = false;
+    for (const auto& diagnostic : diagnostics) {
+        found = found || (diagnostic.line == line && diagnostic.message.find(text) != string::npos);
+    }
+    string reported;
+    for (const auto& diagnostic : diagnostics) {
+        reported += "\n    line " + to_string(diagnostic.line) + ": " + diagnostic.message;
+    }
+    expect(found, what + ": expected \"" + text + "\" on line " + to_string(line) + ", got" +
+                      (reported.empty() ? " nothing" : reported));
+}
+
+// Malformed programs are rejected with a diagnostic on the offending line
+static void checkVerifier() {
+    const string header = "ALLOCATE 0x0000 0xFFFF\n"            // 1
+                          "PROG r2, matrix_multiply\n"          // 2
+                          "END matrix_multiply\n";              // 3
+    const string square = "ALLOC 0x1000 1024\n"                 // 4
+                          "LAYOUT 0x1000, ROW, 16, 16, 64\n"    // 5
+                          "ALLOC 0x1400 1024\n"                 // 6
+                          "LAYOUT 0x1400, ROW, 16, 16, 64\n"    // 7
+                          "ALLOC 0x1800 1024\n"                 // 8
+                          "LAYOUT 0x1800, ROW, 16, 16, 64\n";   // 9
+    const string release = "FREE 0x1800 1024\n"
+                           "FREE 0x1400 1024\n"
+                           "FREE 0x1000 1024\n"
+                           "END\n";
+    
+    string valid = header + square + "EXE r2, 0x1000, 0x1400, 0x1800, 16\nSYNC\n" + release;
+    expect(TargetBackend::verifyISA(program(valid)).empty(), "a well-formed 16x16 product verifies");
+    
+    expectDiagnostic(header + square + "EXE r2, 0x1000, 0x1400, 0x1800, 64\n" + release, 10,
+                     "EXE operand A 0x1000 runs", "a 64x64 product on 16x16 regions overruns them");
+    expectDiagnostic(header + square + "EXE r2, 0x1000, 0x1400, 0x1800, 16, 32, 16\n" + release, 10,
+                     "EXE operand B 0x1400 runs", "N beyond the columns of B overruns it");
+    expectDiagnostic(header + square + "EXE r2, 0x1000, 0x1400, 0x1800+64, 16\n" + release, 10,
+                     "EXE operand C 0x1800+64 runs", "an offset operand overruns its region");
+    expectDiagnostic(header + square + "EXE r2, 0x1000, 0x1400, 0x1800, 4, 4, 4, b8\n" + release, 10,
+                     "EXE operand A 0x1000 runs", "a batch beyond the rows of A overruns it");
+    
+    expectDiagnostic(header + square + "ALLOC 0x1600 1024\n" + release, 10,
+                     "overlaps region 0x1800", "overlapping regions");
+    expectDiagnostic(header + square + "FREE 0x1800 1024\nEXE r2, 0x1000, 0x1400, 0x1800, 16\n"
+                     "FREE 0x1400 1024\nFREE 0x1000 1024\nEND\n", 11,
+                     "EXE operand C 0x1800 used after FREE", "use after FREE");
+    expectDiagnostic("ALLOCATE 0x0000 0xFFFF\n" + square + "EXE r2, 0x1000, 0x1400, 0x1800, 16\n"
+                     "PROG r2, matrix_multiply\nEND matrix_multiply\n" + release, 8,
+                     "before it is programmed", "EXE before its PROG");
+    expectDiagnostic(header + square + "LOOP t, 5\nLOAD 0x1000+t*256, A+t*256, 1, 256\nENDLOOP t\n" +
+                     release, 11, "LOAD destination 0x1000+t*256 runs 256 bytes past", "a strided LOOP overrun");
+    expectDiagnostic(header + square + "BIND A, 0x1000+64\n" + release, 10,
+                     "BIND address 0x1040 is not the start of a region", "a BIND inside a region");
+    expectDiagnostic(header + square + "BIND A, 0x1000\nBIND A, 0x1400\n" + release, 11,
+                     "matrix A already bound on line 10", "a matrix bound twice");
+    expectDiagnostic(header + square + "EXE r2, 0x1000, 0x1400, 0x1800, 16\n" + release, 11,
+                     "FREE while the EXE on line 10 may still be running", "FREE without a SYNC after the last EXE");
+    expectDiagnostic(header + "EXE r2, 0x0000, 0x0400, 0x0800, 16\nEND\n", 5,
+                     "END while the EXE on line 4 may still be running", "END without a SYNC after the last EXE");
+}
+
+int main(int argc, char* argv[]) {
+    map<string, function<void()>> groups = {
+        {"autotune", checkAutotune},
+        {"devices", checkDevices},
+        {"incremental", checkIncremental},
+        {"jobs", checkJobs},
+        {"layout", checkLayout},
+        {"loops", checkLoops},
+        {"parser", checkParser},
+        {"schedule", checkSchedule},
+        {"sizes", checkSizes},
+        {"verifier", checkVerifier},
+    };
+    auto group = argc == 2 ? groups.find(argv[1]) : groups.end();
+    if (group == groups.end()) {
+        cerr << "Usage: " << argv[0] << " <group>, one of:";
+        for (const auto& [name, run] : groups) cerr << " " << name;
+        cerr << "\n";
+        return 1;
+    }
+    
+    group->second();
+    cout << "[Checks] " << group->first << ": " << (failures ? to_string(failures) + " failed" : "passed") << endl;
+    return failures ? 1 : 0;
+}
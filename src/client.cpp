@@ -0,0 +1,71 @@
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <cstdlib>
+#include <unistd.h>
+#include "Protocol.h"
+
+using namespace std;
+
+// Thin client of a running "PIM_Compiler --serve" process: same command line
+// as a one-shot compile, with the source sent over the socket and the result
+// written locally
+
+static const char* DEFAULT_SOCKET = "/tmp/pim_compiler.sock";
+
+int main(int argc, char* argv[]) {
+    vector<string> args(argv + 1, argv + argc);
+    string socketPath = DEFAULT_SOCKET;
+    if (const char* env = getenv("PIM_COMPILER_SOCKET")) socketPath = env;
+    for (size_t i = 0; i + 1 < args.size(); i++) {
+        if (args[i] == "--socket") {
+            socketPath = args[i + 1];
+            args.erase(args.begin() + i, args.begin() + i + 2);
+            break;
+        }
+    }
+    if (args.size() < 3 || args[1] != "-o") {
+        cerr << "Usage: " << argv[0] << " <input.cpp> -o <output.isa> [--socket <path>] [compiler options]\n";
+        return 1;
+    }
+    
+    try {
+        ifstream input(args[0]);
+        if (!input.is_open()) {
+            cerr << "Error: Could not open input file\n";
+            return 1;
+        }
+        Protocol::Request request;
+        request.source.assign(istreambuf_iterator<char>(input), istreambuf_iterator<char>());
+        
+        // The server resolves paths from its own working directory
+        for (size_t i = 0; i < args.size(); i++) {
+            bool path = i == 2 || (i > 0 && (args[i - 1] == "--target" || args[i - 1] == "--tuning-db"));
+            request.args.push_back(path ? filesystem::absolute(args[i]).string() : args[i]);
+        }
+        
+        int fd = Protocol::connect(socketPath);
+        Protocol::writeRequest(fd, request);
+        Protocol::Response response;
+        bool received = Protocol::readResponse(fd, response);
+        close(fd);
+        if (!received) {
+            throw runtime_error("No response from " + socketPath);
+        }
+        if (!response.ok) {
+            cerr << "Error: " << response.text << endl;
+            return 1;
+        }
+        
+        ofstream output(args[2]);
+        if (!output.is_open()) {
+            throw runtime_error("Could not open output file: " + args[2]);
+        }
+        output << response.text;
+    } catch (const exception& e) {
+        cerr << "Error: " << e.what() << endl;
+        return 1;
+    }
+    
+    return 0;
+}
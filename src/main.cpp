@@ -1,36 +1,37 @@
 #include <iostream>
 #include <fstream>
 #include <chrono>
-#include "Lexer.h"
-#include "Parser.h"
-#include "CodeGen.h"
-#include "TargetBackend.h"
+#include "CompileServer.h"
+#include "Driver.h"
 
 using namespace std;
 
-void printAST(const ASTNode* node, int depth = 0) {
-    string indent(depth * 2, ' ');
-    cout << indent << "Type: " << node->type << ", Value: " << node->value;
-    if (node->line > 0) cout << " (Line: " << node->line << ")";
-    cout << endl;
-    
-    for (const auto& child : node->children) {
-        printAST(child.get(), depth + 1);
+int main(int argc, char* argv[]) {
+    vector<string> args(argv + 1, argv + argc);
+    if (args.size() == 2 && args[0] == "--serve") {
+        try {
+            return CompileServer::serve(args[1]);
+        } catch (const exception& e) {
+            cerr << "Error: " << e.what() << endl;
+            return 1;
+        }
     }
-}
 
-int main(int argc, char* argv[]) {
-    if (argc != 4 || string(argv[2]) != "-o") {
-        cerr << "Usage: " << argv[0] << " <input.cpp> -o <output.isa>\n";
+    Driver::Options options;
+    string error;
+    if (!Driver::parseArguments(args, options, error)) {
+        if (args.size() >= 3) cerr << "Error: " << error << "\n";
+        cerr << "Usage: " << argv[0] << " <input.cpp> -o <output.isa> [--double-buffer] [-j <threads>] [--incremental] [--target <file>] [--autotune] [--tuning-db <file>] [--resident] [--devices <count>] [--partition rows|columns|k] [--template] [-D NAME=value]\n"
+             << "       " << argv[0] << " --serve <socket>\n";
         return 1;
     }
-
+    
     try {
         auto start_time = chrono::high_resolution_clock::now();
         
         cout << "=== PIM Compiler ===\n";
-        cout << "Reading input file: " << argv[1] << endl;
-        ifstream input(argv[1]);
+        cout << "Reading input file: " << options.input << endl;
+        ifstream input(options.input);
         if (!input.is_open()) {
             cerr << "Error: Could not open input file\n";
             return 1;
@@ -40,36 +41,24 @@ int main(int argc, char* argv[]) {
                      istreambuf_iterator<char>());
         cout << "File read successfully (" << source.size() << " bytes)\n";
 
-        cout << "\n=== Lexer ===\n";
-        Lexer lexer(source);
-        auto tokens = lexer.tokenize();
-        cout << "Generated " << tokens.size() << " tokens\n";
-        cout << "Detected matrix size: " << lexer.getMatrixSize() << "x" << lexer.getMatrixSize() << endl;
-
-        cout << "\n=== Parser ===\n";
-        Parser parser(tokens);
-        auto ast = parser.parse();
-        cout << "AST built with " << ast->children.size() << " top-level nodes\n";
-        
-        // Print detailed AST info for debugging
-        cout << "\nAST Structure:\n";
-        printAST(ast.get());
-        
-        cout << "\n=== Code Generation ===\n";
-        CodeGen codegen(std::move(ast), lexer.getMatrixSize());
-        auto isa = codegen.generatePIM_ISA();
-        cout << "Generated " << isa.size() << " ISA instructions\n";
-
-        // Validate the generated ISA
-        bool valid = TargetBackend::validateISA(isa);
-        if (!valid) {
-            cerr << "Warning: Generated ISA might have structural issues\n";
+        Driver::Session session;
+        vector<Driver::Output> outputs;
+        if (options.devices > 1) {
+            outputs = Driver::compileDevices(source, options, session);
+        } else {
+            outputs.push_back({options.output, Driver::compile(source, options, session)});
         }
 
         cout << "\n=== Output ===\n";
-        cout << "Writing output to " << argv[3] << endl;
-        TargetBackend::emitISA(isa, argv[3]);
-        
+        for (const auto& file : outputs) {
+            cout << "Writing " << (options.writeTemplate ? "template" : "output") << " to " << file.path << endl;
+            ofstream output(file.path);
+            if (!output.is_open()) {
+                throw runtime_error("Could not open output file: " + file.path);
+            }
+            output << file.text;
+        }
+
         auto end_time = chrono::high_resolution_clock::now();
         auto duration = chrono::duration_cast<chrono::milliseconds>(end_time - start_time);
         cout << "Compilation completed in " << duration.count() << "ms\n";
@@ -0,0 +1,294 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <filesystem>
+#include <algorithm>
+#include <map>
+#include <cstdlib>
+#include "Driver.h"
+#include "TargetBackend.h"
+
+using namespace std;
+
+// Performance regression harness: compiles a corpus of kernels (the programs
+// in tests/ plus generated large shapes), measures every generated program
+// and compares the measurements against a stored baseline
+
+static const vector<string> METRICS = {"instructions", "peak_bytes", "progs", "transfer_bytes", "cycles"};
+static const double DEFAULT_TOLERANCE = 5; // percent a metric may grow before it is a regression
+
+struct Kernel {
+    string name;
+    string source;
+    vector<string> options; // compiler command-line options
+};
+
+static vector<uint64_t> metricValues(const TargetBackend::Stats& stats) {
+    return {stats.instructions, stats.peakBytes, stats.programs, stats.transferBytes, stats.cycles};
+}
+
+// C[M][N] += A[M][K] * B[K][N]
+static string matmulSource(int M, int N, int K) {
+    ostringstream src;
+    src << "#define M " << M << "\n#define N " << N << "\n#define K " << K << "\n\n"
+        << "void kernel(int A[M][K], int B[K][N], int C[M][N]) {\n"
+        << "    for (int i = 0; i < M; i++)\n"
+        << "        for (int j = 0; j < N; j++) {\n"
+        << "            C[i][j] = 0;\n"
+        << "            for (int k = 0; k < K; k++)\n"
+        << "                C[i][j] += A[i][k] * B[k][j];\n"
+        << "        }\n"
+        << "}\n";
+    return src.str();
+}
+
+// y[N] += W[N][K] * x[K]
+static string gemvSource(int N, int K) {
+    ostringstream src;
+    src << "#define N " << N << "\n#define K " << K << "\n\n"
+        << "void kernel(int W[N][K], int x[K], int y[N]) {\n"
+        << "    for (int i = 0; i < N; i++) {\n"
+        << "        y[i] = 0;\n"
+        << "        for (int k = 0; k < K; k++)\n"
+        << "            y[i] += W[i][k] * x[k];\n"
+        << "    }\n"
+        << "}\n";
+    return src.str();
+}
+
+// S[B][N][N] += Q[B][N][N] * Kt[B][N][N]
+static string batchedSource(int B, int N) {
+    ostringstream src;
+    src << "#define B " << B << "\n#define N " << N << "\n\n"
+        << "void kernel(int Q[B][N][N], int Kt[B][N][N], int S[B][N][N]) {\n"
+        << "    for (int b = 0; b < B; b++)\n"
+        << "        for (int i = 0; i < N; i++)\n"
+        << "            for (int j = 0; j < N; j++) {\n"
+        << "                S[b][i][j] = 0;\n"
+        << "                for (int k = 0; k < N; k++)\n"
+        << "                    S[b][i][j] += Q[b][i][k] * Kt[b][k][j];\n"
+        << "            }\n"
+        << "}\n";
+    return src.str();
+}
+
+// Y = X * W applied to a chain of activations by repeated calls from main
+static string layerCallsSource(int N, int calls) {
+    ostringstream src;
+    src << "#define N " << N << "\n\n"
+        << "void layer(int X[N][N], int W[N][N], int Y[N][N]) {\n"
+        << "    for (int i = 0; i < N; i++)\n"
+        << "        for (int j = 0; j < N; j++) {\n"
+        << "            Y[i][j] = 0;\n"
+        << "            for (int k = 0; k < N; k++)\n"
+        << "                Y[i][j] += X[i][k] * W[k][j];\n"
+        << "        }\n"
+        << "}\n\n"
+        << "int main() {\n";
+    for (int c = 0; c < calls; c++) {
+        src << "    layer(act" << c << ", W, act" << c + 1 << ");\n";
+    }
+    src << "    return 0;\n}\n";
+    return src.str();
+}
+
+// Shapes larger than the sample programs, sized for the default target
+static vector<Kernel> generatedKernels() {
+    return {
+        {"gen_square_64", matmulSource(64, 64, 64), {}},
+        {"gen_square_64_double_buffer", matmulSource(64, 64, 64), {"--double-buffer"}},
+        {"gen_tall_m_1024_double_buffer", matmulSource(1024, 64, 64), {"--double-buffer"}},
+        {"gen_wide_n_16x128x64", matmulSource(16, 128, 64), {}},
+        {"gen_tall_k_8x8x512", matmulSource(8, 8, 512), {}},
+        {"gen_gemv_128x64", gemvSource(128, 64), {}},
+        {"gen_batched_16x16", batchedSource(16, 16), {}},
+        {"gen_layer_8_calls_resident", layerCallsSource(64, 8), {"--resident", "--double-buffer"}},
+        {"gen_tall_m_512_8_devices", matmulSource(512, 64, 64), {"--devices", "8"}},
+        {"gen_tall_k_32x32x2048_16_devices", matmulSource(32, 32, 2048), {"--devices", "16", "--double-buffer"}},
+    };
+}
+
+static vector<Kernel> corpus(const string& testsDir) {
+    vector<Kernel> kernels;
+    vector<filesystem::path> files;
+    for (const auto& entry : filesystem::directory_iterator(testsDir)) {
+        if (entry.path().extension() == ".cpp") files.push_back(entry.path());
+    }
+    sort(files.begin(), files.end());
+    for (const auto& file : files) {
+        ifstream input(file);
+        kernels.push_back({file.stem().string(),
+                           string(istreambuf_iterator<char>(input), istreambuf_iterator<char>()), {}});
+    }
+    for (auto& kernel : generatedKernels()) {
+        kernels.push_back(std::move(kernel));
+    }
+    return kernels;
+}
+
+// "<kernel> <metric values...>" lines; # starts a comment
+static map<string, vector<uint64_t>> loadBaseline(const string& path) {
+    map<string, vector<uint64_t>> baseline;
+    ifstream input(path);
+    string line;
+    while (getline(input, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        istringstream fields(line);
+        string name;
+        vector<uint64_t> values(METRICS.size());
+        fields >> name;
+        for (auto& value : values) fields >> value;
+        if (fields) baseline[name] = values;
+    }
+    return baseline;
+}
+
+static void saveBaseline(const string& path, const map<string, vector<uint64_t>>& measured) {
+    ofstream output(path);
+    if (!output.is_open()) {
+        throw runtime_error("Could not write baseline: " + path);
+    }
+    output << "# Generated program cost per kernel, recorded by PIM_Regress --update\n# kernel";
+    for (const auto& metric : METRICS) output << " " << metric;
+    output << "\n";
+    for (const auto& [name, values] : measured) {
+        output << name;
+        for (uint64_t value : values) output << " " << value;
+        output << "\n";
+    }
+}
+
+int main(int argc, char* argv[]) {
+    string testsDir = "tests";
+    string baselinePath = "tests/baseline.perf";
+    bool update = false;
+    vector<double> tolerance(METRICS.size(), DEFAULT_TOLERANCE);
+    
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--tests" && hasValue) {
+            testsDir = argv[++i];
+        } else if (arg == "--baseline" && hasValue) {
+            baselinePath = argv[++i];
+        } else if (arg == "--update") {
+            update = true;
+        } else if (arg == "--tolerance" && hasValue) {
+            // <percent> for every metric or <metric>=<percent> for one
+            string value = argv[++i];
+            size_t eq = value.find('=');
+            if (eq == string::npos) {
+                fill(tolerance.begin(), tolerance.end(), atof(value.c_str()));
+                continue;
+            }
+            auto metric = find(METRICS.begin(), METRICS.end(), value.substr(0, eq));
+            if (metric == METRICS.end()) {
+                cerr << "Error: unknown metric " << value.substr(0, eq) << "\n";
+                return 1;
+            }
+            tolerance[metric - METRICS.begin()] = atof(value.c_str() + eq + 1);
+        } else {
+            cerr << "Usage: " << argv[0] << " [--tests <dir>] [--baseline <file>] [--update] "
+                 << "[--tolerance <percent> | --tolerance <metric>=<percent>]...\n"
+                 << "Metrics: instructions, peak_bytes, progs, transfer_bytes, cycles\n";
+            return 1;
+        }
+    }
+    
+    map<string, vector<uint64_t>> baseline = loadBaseline(baselinePath);
+    if (baseline.empty() && !update) {
+        cerr << "Error: no baseline in " << baselinePath << " (record one with --update)\n";
+        return 1;
+    }
+    
+    map<string, vector<uint64_t>> measured;
+    int failures = 0, regressions = 0;
+    cout << left << setw(34) << "kernel";
+    for (const auto& metric : METRICS) cout << right << setw(22) << metric;
+    cout << "\n";
+    
+    for (const Kernel& kernel : corpus(testsDir)) {
+        vector<string> args = {kernel.name + ".cpp", "-o", kernel.name + ".isa"};
+        args.insert(args.end(), kernel.options.begin(), kernel.options.end());
+        Driver::Options options;
+        string error;
+        Driver::parseArguments(args, options, error);
+        options.verbose = false;
+        Driver::Session session;
+        session.persistent = false;
+        
+        // Compiler logging is dropped while measuring
+        vector<Driver::Output> outputs;
+        Partition::Plan plan;
+        streambuf* log = cout.rdbuf(nullptr);
+        try {
+            if (options.devices > 1) {
+                outputs = Driver::compileDevices(kernel.source, options, session, &plan);
+                outputs.erase(outputs.begin());
+            } else {
+                outputs.push_back({options.output, Driver::compile(kernel.source, options, session)});
+            }
+        } catch (const exception& e) {
+            error = e.what();
+        }
+        cout.rdbuf(log);
+        cout << left << setw(34) << kernel.name;
+        if (outputs.empty()) {
+            cout << "FAILED: " << error.substr(0, error.find('\n')) << "\n";
+            failures++;
+            continue;
+        }
+        
+        // Devices of a partitioned kernel add up, except that they run side by
+        // side between the host's scatter and gather
+        TargetBackend::Stats stats;
+        for (const auto& output : outputs) {
+            vector<string> lines;
+            istringstream program(output.text);
+            for (string line; getline(program, line);) lines.push_back(line);
+            TargetBackend::Stats device = TargetBackend::measureISA(lines);
+            stats.instructions += device.instructions;
+            stats.peakBytes = max(stats.peakBytes, device.peakBytes);
+            stats.programs += device.programs;
+            stats.transferBytes += device.transferBytes;
+            stats.cycles = device.cycles;
+        }
+        if (options.devices > 1) stats.cycles = Partition::totalCycles(plan);
+        vector<uint64_t> values = metricValues(stats);
+        measured[kernel.name] = values;
+        
+        // Value and change against the baseline; growth past the tolerance regresses
+        auto known = baseline.find(kernel.name);
+        bool regressed = false;
+        for (size_t m = 0; m < values.size(); m++) {
+            ostringstream cell;
+            cell << values[m];
+            if (known != baseline.end() && known->second[m] != values[m]) {
+                double before = static_cast<double>(known->second[m]);
+                double change = before > 0 ? (values[m] - before) * 100 / before : 100;
+                cell << " (" << showpos << fixed << setprecision(1) << change << "%)";
+                regressed |= change > tolerance[m];
+            }
+            cout << right << setw(22) << cell.str();
+        }
+        if (known == baseline.end()) cout << "  new";
+        if (regressed) {
+            cout << "  REGRESSION";
+            regressions++;
+        }
+        cout << "\n";
+    }
+    
+    if (update) {
+        saveBaseline(baselinePath, measured);
+        cout << "Recorded " << measured.size() << " kernels in " << baselinePath << "\n";
+        return failures ? 1 : 0;
+    }
+    for (const auto& [name, values] : baseline) {
+        if (!measured.count(name)) cout << "Kernel " << name << " is no longer in the corpus\n";
+    }
+    cout << measured.size() << " kernels measured, " << regressions << " regression(s), "
+         << failures << " failure(s)\n";
+    return failures || regressions ? 1 : 0;
+}
@@ -0,0 +1,208 @@
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <random>
+#include "Runtime.h"
+
+using namespace std;
+
+// Throughput of the host runtime: client threads keep a window of invocations
+// of one compiled program in flight on a Runtime::Queue, optionally checking
+// every result against a product computed on the host
+
+static const size_t WINDOW = 4; // invocations each client keeps in flight
+
+using Buffers = map<string, vector<int32_t>>;
+
+static void randomize(vector<int32_t>& data, mt19937& random) {
+    uniform_int_distribution<int32_t> element(-8, 8);
+    for (auto& value : data) value = element(random);
+}
+
+// "C=A*B", or "C=A*B,b8" for a batch of 8 products stacked one below the
+// other: the result and operands of a product every invocation computes
+struct Expectation {
+    string C, A, B;
+    int64_t M = 0, N = 0, K = 0, batch = 1;
+};
+
+static Expectation parseExpectation(const string& text, const Runtime::Program& program) {
+    size_t equals = text.find('='), times = text.find('*'), comma = text.find(',');
+    if (equals == string::npos || times == string::npos || times < equals || comma < times) {
+        throw runtime_error("--expect takes C=A*B or C=A*B,bBATCH, got " + text);
+    }
+    Expectation expect{text.substr(0, equals), text.substr(equals + 1, times - equals - 1),
+                       text.substr(times + 1, comma == string::npos ? string::npos : comma - times - 1)};
+    if (comma != string::npos) {
+        string batch = text.substr(comma + 1);
+        if (batch.size() < 2 || batch[0] != 'b' || batch.find_first_not_of("0123456789", 1) != string::npos) {
+            throw runtime_error("--expect: expected a batch bCOUNT after the comma, got " + text);
+        }
+        expect.batch = max<int64_t>(1, stoll(batch.substr(1)));
+    }
+    for (const string* name : {&expect.C, &expect.A, &expect.B}) {
+        if (!program.matrix(*name)) throw runtime_error("--expect: the program has no host matrix " + *name);
+    }
+    
+    // From the element counts of one product: |A||C| / |B| = M^2
+    double a = program.matrix(expect.A)->elements / expect.batch;
+    double b = program.matrix(expect.B)->elements / expect.batch;
+    double c = program.matrix(expect.C)->elements / expect.batch;
+    expect.M = llround(sqrt(a * c / b));
+    if (expect.M > 0) {
+        expect.N = static_cast<int64_t>(c) / expect.M;
+        expect.K = static_cast<int64_t>(a) / expect.M;
+    }
+    if (expect.M <= 0 || expect.M * expect.N != c || expect.M * expect.K != a || expect.K * expect.N != b ||
+        program.matrix(expect.C)->elements != static_cast<size_t>(expect.batch * expect.M * expect.N)) {
+        throw runtime_error("--expect: " + text + " does not match the shapes of the program's matrices");
+    }
+    return expect;
+}
+
+static bool matches(const Expectation& expect, const Runtime::Bindings& bindings) {
+    for (int64_t p = 0; p < expect.batch; p++) {
+        const int32_t* A = bindings.find(expect.A)->data + p * expect.M * expect.K;
+        const int32_t* B = bindings.find(expect.B)->data + p * expect.K * expect.N;
+        const int32_t* C = bindings.find(expect.C)->data + p * expect.M * expect.N;
+        for (int64_t i = 0; i < expect.M; i++) {
+            for (int64_t j = 0; j < expect.N; j++) {
+                uint32_t sum = 0;
+                for (int64_t k = 0; k < expect.K; k++) {
+                    sum += static_cast<uint32_t>(A[i * expect.K + k]) * static_cast<uint32_t>(B[k * expect.N + j]);
+                }
+                if (static_cast<int32_t>(sum) != C[i * expect.N + j]) return false;
+            }
+        }
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        cerr << "Usage: " << argv[0] << " <program.isa> [--invocations N] [--clients T] [--workers W]"
+             << " [--batch B] [--stub] [--expect C=A*B[,bBATCH]]...\n";
+        return 1;
+    }
+    
+    try {
+        size_t invocations = 1000;
+        int clients = 4;
+        vector<string> expectTexts;
+        Runtime::QueueOptions options;
+        for (int i = 2; i < argc; i++) {
+            string arg = argv[i];
+            bool hasValue = i + 1 < argc;
+            if (arg == "--invocations" && hasValue) {
+                invocations = stoul(argv[++i]);
+            } else if (arg == "--clients" && hasValue) {
+                clients = max(1, stoi(argv[++i]));
+            } else if (arg == "--workers" && hasValue) {
+                options.workers = stoi(argv[++i]);
+            } else if (arg == "--batch" && hasValue) {
+                options.batch = max<size_t>(1, stoul(argv[++i]));
+            } else if (arg == "--stub") {
+                options.device = Runtime::makeStub;
+            } else if (arg == "--expect" && hasValue) {
+                expectTexts.push_back(argv[++i]);
+            } else {
+                throw runtime_error("Unknown option: " + arg);
+            }
+        }
+        
+        auto program = Runtime::Program::load(argv[1]);
+        vector<Expectation> expects;
+        for (const auto& text : expectTexts) expects.push_back(parseExpectation(text, *program));
+        
+        // Constants are bound once, for every device's load
+        mt19937 random(17);
+        Buffers constantData;
+        Runtime::Bindings constants;
+        for (const auto& matrix : program->matrices()) {
+            if (!matrix.constant) continue;
+            auto& data = constantData[matrix.name];
+            data.resize(matrix.elements);
+            randomize(data, random);
+            constants.input(matrix.name, data.data(), data.size());
+        }
+        
+        Runtime::Queue queue(program, constants, options);
+        cout << "[Runtime] " << argv[1] << ": " << program->matrices().size() << " host matrices, "
+             << constantData.size() << " constant, " << queue.workers() << " workers" << endl;
+        
+        // Each client cycles through a window of invocations, each with its
+        // own buffers, waiting on the oldest before reusing its slot
+        atomic<uint64_t> failures{0}, mismatches{0};
+        auto client = [&](int index) {
+            mt19937 clientRandom(100 + index);
+            vector<Buffers> data(WINDOW);
+            vector<Runtime::Bindings> bindings(WINDOW);
+            vector<future<void>> inFlight(WINDOW);
+            for (size_t slot = 0; slot < WINDOW; slot++) {
+                for (const auto& [name, values] : constantData) {
+                    bindings[slot].input(name, values.data(), values.size());
+                }
+                for (const auto& matrix : program->matrices()) {
+                    if (matrix.constant) continue;
+                    auto& buffer = data[slot][matrix.name];
+                    buffer.resize(matrix.elements);
+                    randomize(buffer, clientRandom);
+                    if (matrix.output) {
+                        bindings[slot].output(matrix.name, buffer.data(), buffer.size());
+                    } else {
+                        bindings[slot].input(matrix.name, buffer.data(), buffer.size());
+                    }
+                }
+            }
+            auto retire = [&](size_t slot) {
+                if (!inFlight[slot].valid()) return;
+                try {
+                    inFlight[slot].get();
+                    for (const auto& expect : expects) {
+                        if (!matches(expect, bindings[slot])) {
+                            mismatches++;
+                            break;
+                        }
+                    }
+                } catch (const exception& e) {
+                    if (failures++ == 0) cerr << "Error: " << e.what() << endl;
+                }
+            };
+            
+            size_t share = invocations / clients + (static_cast<size_t>(index) < invocations % clients ? 1 : 0);
+            for (size_t i = 0; i < share; i++) {
+                size_t slot = i % WINDOW;
+                retire(slot);
+                inFlight[slot] = queue.submit(bindings[slot]);
+            }
+            for (size_t slot = 0; slot < WINDOW; slot++) retire(slot);
+        };
+        
+        auto start = chrono::steady_clock::now();
+        vector<thread> threads;
+        for (int i = 0; i < clients; i++) threads.emplace_back(client, i);
+        for (auto& thread : threads) thread.join();
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        
+        auto stats = queue.stats();
+        cout << "[Runtime] " << stats.completed << " invocations from " << clients << " clients in "
+             << seconds * 1000 << " ms: " << static_cast<uint64_t>(stats.completed / max(seconds, 1e-9))
+             << " invocations/s, average batch "
+             << (stats.batches ? static_cast<double>(stats.completed) / stats.batches : 0.0) << endl;
+        if (!expects.empty()) {
+            string checked;
+            for (const auto& text : expectTexts) checked += (checked.empty() ? "" : " ") + text;
+            cout << "[Runtime] " << checked << ": " << mismatches << " mismatched results" << endl;
+        }
+        if (failures || mismatches) {
+            cout << "[Runtime] " << failures << " failed invocations" << endl;
+            return 1;
+        }
+    } catch (const exception& e) {
+        cerr << "Error: " << e.what() << endl;
+        return 1;
+    }
+    
+    return 0;
+}
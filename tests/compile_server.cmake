@@ -0,0 +1,73 @@
+# Start a compile server on a temporary socket, compile a program directly
+# and twice through PIM_Client with the same command line: both served
+# programs must be byte-identical to the direct one, and the second must
+# come from the server's response cache.
+# Usage: cmake -DCOMPILER=<PIM_Compiler> -DCLIENT=<PIM_Client> -DSOURCE=<test.cpp>
+#              -DWORK=<directory> [-DFLAGS=<compiler options>] -P compile_server.cmake
+string(RANDOM LENGTH 8 SUFFIX)
+set(SOCKET /tmp/pim_server_test_${SUFFIX}.sock)
+set(LOG ${WORK}/server.log)
+file(MAKE_DIRECTORY ${WORK})
+file(REMOVE ${LOG})
+separate_arguments(FLAGS)
+
+execute_process(COMMAND sh -c "exec '${COMPILER}' --serve '${SOCKET}' > '${LOG}' 2>&1 & echo $!"
+                OUTPUT_VARIABLE SERVER OUTPUT_STRIP_TRAILING_WHITESPACE)
+
+function(stop_server)
+    execute_process(COMMAND kill ${SERVER})
+    file(REMOVE ${SOCKET})
+endfunction()
+function(fail MESSAGE)
+    stop_server()
+    if(EXISTS ${LOG})
+        file(READ ${LOG} SERVED)
+        message("Server log:\n${SERVED}")
+    endif()
+    message(FATAL_ERROR "${MESSAGE}")
+endfunction()
+
+# The server is ready once it listens
+foreach(ATTEMPT RANGE 100)
+    if(EXISTS ${SOCKET})
+        break()
+    endif()
+    execute_process(COMMAND ${CMAKE_COMMAND} -E sleep 0.05)
+endforeach()
+if(NOT EXISTS ${SOCKET})
+    fail("the server did not start listening on ${SOCKET}")
+endif()
+
+execute_process(COMMAND ${COMPILER} ${SOURCE} -o ${WORK}/direct.isa ${FLAGS}
+                RESULT_VARIABLE STATUS OUTPUT_QUIET)
+if(NOT STATUS EQUAL 0)
+    fail("the direct compile failed")
+endif()
+foreach(REQUEST first second)
+    file(REMOVE ${WORK}/served.isa)
+    execute_process(COMMAND ${CLIENT} ${SOURCE} -o ${WORK}/served.isa --socket ${SOCKET} ${FLAGS}
+                    RESULT_VARIABLE STATUS ERROR_VARIABLE ERROR)
+    if(NOT STATUS EQUAL 0)
+        fail("the ${REQUEST} request failed: ${ERROR}")
+    endif()
+    execute_process(COMMAND ${CMAKE_COMMAND} -E compare_files ${WORK}/direct.isa ${WORK}/served.isa
+                    RESULT_VARIABLE DIFFERENT)
+    if(NOT DIFFERENT EQUAL 0)
+        fail("the ${REQUEST} served program differs from the direct compile")
+    endif()
+endforeach()
+
+file(STRINGS ${LOG} SERVED REGEX "^\\[Server\\] .* -> ")
+list(LENGTH SERVED REQUESTS)
+if(NOT REQUESTS EQUAL 2)
+    fail("the server logged ${REQUESTS} request(s), expected 2")
+endif()
+list(GET SERVED 0 FIRST)
+list(GET SERVED 1 SECOND)
+if(FIRST MATCHES "\\(cached\\)" OR NOT FIRST MATCHES ": ok ")
+    fail("the first request was not compiled: ${FIRST}")
+endif()
+if(NOT SECOND MATCHES ": ok \\(cached\\) ")
+    fail("the second request was not answered from the cache: ${SECOND}")
+endif()
+stop_server()
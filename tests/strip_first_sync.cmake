@@ -0,0 +1,18 @@
+# Copy a compiled program without the first SYNC among its matrix operations,
+# so a runtime test can check that the simulator catches the missing barrier.
+# Usage: cmake -DINPUT=<program.isa> -DOUTPUT=<copy.isa> -P strip_first_sync.cmake
+file(READ ${INPUT} PROGRAM)
+string(FIND "${PROGRAM}" "# MATRIX OPERATIONS" OPERATIONS)
+if(OPERATIONS EQUAL -1)
+    message(FATAL_ERROR "${INPUT} has no matrix operations")
+endif()
+string(SUBSTRING "${PROGRAM}" 0 ${OPERATIONS} HEADER)
+string(SUBSTRING "${PROGRAM}" ${OPERATIONS} -1 BODY)
+string(FIND "${BODY}" "\nSYNC\n" SYNC)
+if(SYNC EQUAL -1)
+    message(FATAL_ERROR "${INPUT} has no SYNC among its matrix operations")
+endif()
+string(SUBSTRING "${BODY}" 0 ${SYNC} BEFORE)
+math(EXPR REST "${SYNC} + 5")
+string(SUBSTRING "${BODY}" ${REST} -1 AFTER)
+file(WRITE ${OUTPUT} "${HEADER}${BEFORE}${AFTER}")
@@ -0,0 +1,23 @@
+#include <iostream>
+#define N 16
+#define K 256
+
+// Tall reduction: a small output with a deep K, such as a projection of a
+// long sequence; one core alone would leave the others idle
+void project(int X[N][K], int W[K][N], int Y[N][N]) {
+    for (int i = 0; i < N; i++)
+        for (int j = 0; j < N; j++) {
+            Y[i][j] = 0;
+            for (int k = 0; k < K; k++)
+                Y[i][j] += X[i][k] * W[k][j];
+        }
+}
+
+int main() {
+    int X[N][K];
+    int W[K][N];
+    int Y[N][N];
+
+    project(X, W, Y);
+    return 0;
+}
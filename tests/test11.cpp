@@ -0,0 +1,25 @@
+#include <iostream>
+#define N 8
+
+// One layer applied to a stream of inputs: W is the same in every call
+void layer(int X[N][N], int W[N][N], int Y[N][N]) {
+    for (int i = 0; i < N; i++)
+        for (int j = 0; j < N; j++) {
+            Y[i][j] = 0;
+            for (int k = 0; k < N; k++)
+                Y[i][j] += X[i][k] * W[k][j];
+        }
+}
+
+int main() {
+    int W[N][N];
+    int A[N][N];
+    int B[N][N];
+    int C[N][N];
+    int D[N][N];
+
+    layer(A, W, B);
+    layer(B, W, C);
+    layer(C, W, D);
+    return 0;
+}
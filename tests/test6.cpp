@@ -0,0 +1,24 @@
+
+#include <iostream>
+#define N 64
+
+// i-k-j loop order under a kernel name the parser has no special knowledge of
+void gemm_ikj(int A[N][N], int B[N][N], int C[N][N], int n) {
+    for (int i = 0; i < N; i++)
+        for (int j = 0; j < N; j++)
+            C[i][j] = 0;
+
+    for (int i = 0; i < N; i++) {
+        for (int k = 0; k < N; k++) {
+            for (int j = 0; j < N; j++) {
+                C[i][j] = C[i][j] + A[i][k] * B[k][j];
+            }
+        }
+    }
+}
+
+int main() {
+    static int A[N][N], B[N][N], C[N][N];
+    gemm_ikj(A, B, C, N);
+    return 0;
+}
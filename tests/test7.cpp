@@ -0,0 +1,27 @@
+
+#include <iostream>
+#define ROWS 4
+#define COLS 2
+#define INNER 8
+
+// Dot-product form accumulating into a scalar before the store
+void linear(int X[ROWS][INNER], int W[INNER][COLS], int Y[ROWS][COLS]) {
+    for (int j = 0; j < COLS; j++) {
+        for (int i = 0; i < ROWS; i++) {
+            int sum = 0;
+            for (int k = 0; k < INNER; k++) {
+                sum += W[k][j] * X[i][k];
+            }
+            Y[i][j] = sum;
+        }
+    }
+}
+
+int main() {
+    int X[ROWS][INNER] = {{0}};
+    int W[INNER][COLS] = {{0}};
+    int Y[ROWS][COLS];
+
+    linear(X, W, Y);
+    return 0;
+}
@@ -0,0 +1,50 @@
+
+#include <iostream>
+#define N 8
+
+// Attention block: the Q, K and V projections are independent of each other
+void attention(int X[N][N], int Wq[N][N], int Wk[N][N], int Wv[N][N],
+               int Q[N][N], int Kt[N][N], int V[N][N], int S[N][N], int O[N][N]) {
+    for (int i = 0; i < N; i++)
+        for (int j = 0; j < N; j++) {
+            Q[i][j] = 0;
+            for (int k = 0; k < N; k++)
+                Q[i][j] += X[i][k] * Wq[k][j];
+        }
+
+    for (int i = 0; i < N; i++)
+        for (int j = 0; j < N; j++) {
+            Kt[i][j] = 0;
+            for (int k = 0; k < N; k++)
+                Kt[i][j] += X[i][k] * Wk[k][j];
+        }
+
+    for (int i = 0; i < N; i++)
+        for (int j = 0; j < N; j++) {
+            V[i][j] = 0;
+            for (int k = 0; k < N; k++)
+                V[i][j] += X[i][k] * Wv[k][j];
+        }
+
+    // Scores and output depend on the projections
+    for (int i = 0; i < N; i++)
+        for (int j = 0; j < N; j++) {
+            S[i][j] = 0;
+            for (int k = 0; k < N; k++)
+                S[i][j] += Q[i][k] * Kt[k][j];
+        }
+
+    for (int i = 0; i < N; i++)
+        for (int j = 0; j < N; j++) {
+            O[i][j] = 0;
+            for (int k = 0; k < N; k++)
+                O[i][j] += S[i][k] * V[k][j];
+        }
+}
+
+int main() {
+    static int X[N][N], Wq[N][N], Wk[N][N], Wv[N][N];
+    static int Q[N][N], Kt[N][N], V[N][N], S[N][N], O[N][N];
+    attention(X, Wq, Wk, Wv, Q, Kt, V, S, O);
+    return 0;
+}
@@ -0,0 +1,38 @@
+#include <iostream>
+#define N 64
+#define HEADS 8
+#define D 8
+
+// Decode step: a single token's activations go through the weight matrices as
+// matrix-vector products, and each attention head's small product is
+// independent of the others
+void decode(int x[N], int Wo[N][N], int y[N], int Wf[N][N], int h[N],
+            int Q[HEADS][D][D], int Kt[HEADS][D][D], int S[HEADS][D][D]) {
+    for (int j = 0; j < N; j++) {
+        y[j] = 0;
+        for (int k = 0; k < N; k++)
+            y[j] += x[k] * Wo[k][j];
+    }
+
+    for (int i = 0; i < N; i++) {
+        int sum = 0;
+        for (int k = 0; k < N; k++)
+            sum += Wf[i][k] * y[k];
+        h[i] = sum;
+    }
+
+    for (int b = 0; b < HEADS; b++)
+        for (int i = 0; i < D; i++)
+            for (int j = 0; j < D; j++) {
+                S[b][i][j] = 0;
+                for (int k = 0; k < D; k++)
+                    S[b][i][j] += Q[b][i][k] * Kt[b][k][j];
+            }
+}
+
+int main() {
+    static int x[N], Wo[N][N], y[N], Wf[N][N], h[N];
+    static int Q[HEADS][D][D], Kt[HEADS][D][D], S[HEADS][D][D];
+    decode(x, Wo, y, Wf, h, Q, Kt, S);
+    return 0;
+}